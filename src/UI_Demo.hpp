@@ -8,8 +8,8 @@ inline void TextLayoutTest(UI::Context* context)
 {
     UI::BoxStyle root;
     root.flow = {.vertical_alignment = UI::Flow::CENTERED, .horizontal_alignment = UI::Flow::CENTERED};
-    root.width = {GetScreenWidth()};
-    root.height = {GetScreenHeight()};
+    root.width = {context->GetInput().screen_width};
+    root.height = {context->GetInput().screen_height};
     root.color = {50, 50, 60, 255};
 
     UI::BoxStyle box1;
@@ -28,7 +28,7 @@ inline void TextLayoutTest(UI::Context* context)
         .Id("SomeBox")
         .PreRun([&]
         {
-            if(UI::IsHover() && UI::IsMousePressed(UI::MOUSE_LEFT))
+            if(UI::IsHover() && UI::Input().IsMousePressed(UI::MOUSE_LEFT))
                 UI::State().custom_flags = 1;
             else
                 UI::State().custom_flags = 0;
@@ -52,12 +52,14 @@ inline void LayoutTest(UI::Context* context)
 {
     UI::BoxStyle root;
     root.flow.axis = UI::Flow::VERTICAL;
-    root.width = {GetScreenWidth()};
-    root.height = {GetScreenHeight()};
+    //From the input snapshot, the host sets it before building so no backend call runs on the ui thread
+    root.width = {context->GetInput().screen_width};
+    root.height = {context->GetInput().screen_height};
     root.color = {50, 50, 60, 255};
     root.gap_row = 10;
 
-    UI::BoxStyle top_bar =
+    //Styles that never change are compiled once at compile time
+    static constexpr UI::CompiledStyle top_bar = UI::CompileStyle(
     {
         .flow =
         {
@@ -67,10 +69,10 @@ inline void LayoutTest(UI::Context* context)
         .width = {100, UI::Unit::PARENT_PERCENT},
         .height = {65},
         .color = {25, 25, 25, 255}
-    };
-    UI::BoxStyle bottom_bar = top_bar;
+    });
+    static constexpr UI::CompiledStyle bottom_bar = top_bar;
 
-    UI::BoxStyle middle_base =
+    static constexpr UI::CompiledStyle middle_base = UI::CompileStyle(
     {
         .flow =
         {
@@ -79,9 +81,9 @@ inline void LayoutTest(UI::Context* context)
         .width = {100, UI::Unit::PARENT_PERCENT},
         .height = {100, UI::Unit::AVAILABLE_PERCENT},
         .gap_column = 10
-    };
+    });
 
-    UI::BoxStyle left_panel =
+    static constexpr UI::CompiledStyle left_panel = UI::CompileStyle(
     {
         .flow =
         {
@@ -93,12 +95,23 @@ inline void LayoutTest(UI::Context* context)
         .max_width = {400},
         .color = {25, 25, 25, 255},
         .corner_radius = 10
-    };
-    UI::BoxStyle right_panel = left_panel;
-    right_panel.padding = {10, 10, 10, 10};
-    right_panel.min_width = {0};
+    });
+    static constexpr UI::CompiledStyle right_panel = UI::CompileStyle(
+    {
+        .flow =
+        {
+            .axis = UI::Flow::VERTICAL,
+        },
+        .width = {100, UI::Unit::AVAILABLE_PERCENT},
+        .height = {100, UI::Unit::PARENT_PERCENT},
+        .min_width = {0},
+        .max_width = {400},
+        .padding = {10, 10, 10, 10},
+        .color = {25, 25, 25, 255},
+        .corner_radius = 10
+    });
 
-    UI::BoxStyle middle_panel =
+    static constexpr UI::CompiledStyle middle_panel = UI::CompileStyle(
     {
         .flow =
         {
@@ -109,49 +122,51 @@ inline void LayoutTest(UI::Context* context)
         .min_width = {100, UI::Unit::CONTENT_PERCENT},
         .color = {25, 25, 25, 255},
         .corner_radius = 5,
-    };
-    UI::BoxStyle timeline =
+    });
+    static constexpr UI::CompiledStyle timeline = UI::CompileStyle(
     {
         .width = {60, UI::Unit::PARENT_PERCENT},
         .height = {12},
         .color = {5, 5, 5, 255},
         .corner_radius = 6
-    };
+    });
 
-    auto CustomButton = [&](UI::Color color, const UI::StringU32& name, const UI::StringAsci& id)
+    //Buttons are repeated many times, so their styles are registered once and shared
+    UI::StyleHandle button_container = context->RegisterStyle(
     {
-        UI::BoxStyle h_container
-        {
-            .flow =
-            {
-                .vertical_alignment = UI::Flow::CENTERED,
-            },
-            .width = {100, UI::Unit::PARENT_PERCENT},
-            .height = {100, UI::Unit::CONTENT_PERCENT},
-            .padding = {5, 5, 5, 5},
-            //.color = {60, 60, 60, 255},
-            .gap_column = 10,
-            .corner_radius = 10,
-        };
-
-        UI::BoxStyle image
+        .flow =
         {
-            .width = {50},
-            .height = {50},
-            .color = color,
-            .corner_radius = 10
-
-        };
+            .vertical_alignment = UI::Flow::CENTERED,
+        },
+        .width = {100, UI::Unit::PARENT_PERCENT},
+        .height = {100, UI::Unit::CONTENT_PERCENT},
+        .padding = {5, 5, 5, 5},
+        //.color = {60, 60, 60, 255},
+        .gap_column = 10,
+        .corner_radius = 10,
+    });
+    UI::StyleHandle button_image = context->RegisterStyle(
+    {
+        .width = {50},
+        .height = {50},
+        .corner_radius = 10
+    });
 
-        UI::Box(h_container)
+    auto CustomButton = [&](UI::Color color, const UI::StringU32& name, const UI::StringAsci& id)
+    {
+        UI::Box(button_container)
         .Id(id)
         .OnDirectHover([&]
         {
-            UI::Style().color = {50, 50, 50, 255};
+            UI::Override().BgColor({50, 50, 50, 255});
         })
         .Run([&]
         {
-            UI::Box(image)
+            UI::Box(button_image)
+            .PreRun([&]
+            {
+                UI::Override().BgColor(color);
+            })
             .Run([&]
             {
 
@@ -162,19 +177,19 @@ inline void LayoutTest(UI::Context* context)
     };
     auto BasicButton = [&](const UI::StringU32& str, const UI::StringAsci& id)
     {
-        UI::BoxStyle basic_button
+        static constexpr UI::CompiledStyle basic_button = UI::CompileStyle(
         {
             .width = {100, UI::Unit::CONTENT_PERCENT},
             .height = {100, UI::Unit::CONTENT_PERCENT},
             .padding = {10,10,9,9},
             .color = {42, 42, 42, 255},
             .corner_radius = 20
-        };
+        });
         UI::Box(basic_button)
         .Id(id)
         .OnDirectHover([&]
         {
-            UI::Style().color = {60, 60, 60, 255};
+            UI::Override().BgColor({60, 60, 60, 255});
         })
         .Run([&]
         {
@@ -184,7 +199,7 @@ inline void LayoutTest(UI::Context* context)
 
     auto LeftPanel = [&]
     {
-        UI::BoxStyle v_container =
+        static constexpr UI::CompiledStyle v_container = UI::CompileStyle(
         {
             .flow =
             {
@@ -197,16 +212,16 @@ inline void LayoutTest(UI::Context* context)
             .color = {20, 20, 20, 255},
             .gap_row = 10,
             .corner_radius = 10
-        };
-        UI::BoxStyle h_container =
+        });
+        static constexpr UI::CompiledStyle h_container = UI::CompileStyle(
         {
             .width = {100, UI::Unit::PARENT_PERCENT},
             .height = {100, UI::Unit::CONTENT_PERCENT},
             .min_width = {100, UI::Unit::CONTENT_PERCENT},
             .gap_column = 10
-        };
+        });
 
-        UI::BoxStyle playlist_container
+        static constexpr UI::CompiledStyle playlist_container = UI::CompileStyle(
         {
             .flow =
             {
@@ -215,7 +230,7 @@ inline void LayoutTest(UI::Context* context)
             .width = {100,UI::Unit::PARENT_PERCENT},
             .height = {100, UI::Unit::AVAILABLE_PERCENT},
             .scissor = true
-        };
+        });
 
         UI::Box(v_container).Run([&]
         {
@@ -236,12 +251,12 @@ inline void LayoutTest(UI::Context* context)
         .OnHover([&]
         {
             float scroll_y = UI::State().custom_anim;
-            scroll_y -= UI::GetMouseScroll() * 40;
+            scroll_y -= UI::Input().mouse_scroll * 40;
             UI::State().custom_anim = UI::Clamp(scroll_y, 0.0f, (float)UI::Info().MaxScrollY());
         })
         .PreRun([&]
         {
-            UI::Style().scroll_y = UI::State().custom_anim;
+            UI::Override().Scroll(0, (int)UI::State().custom_anim);
         })
         .Run([&]
         {
@@ -253,7 +268,7 @@ inline void LayoutTest(UI::Context* context)
 
     auto MiddlePanel = [&]
     {
-        UI::BoxStyle h_container
+        static constexpr UI::CompiledStyle h_container = UI::CompileStyle(
         {
             .flow =
             {
@@ -263,8 +278,8 @@ inline void LayoutTest(UI::Context* context)
             .height = {100, UI::Unit::CONTENT_PERCENT},
             .padding = {16, 16, 16, 16},
             .gap_column = 10,
-        };
-        UI::BoxStyle image
+        });
+        static constexpr UI::CompiledStyle image = UI::CompileStyle(
         {
             .flow =
             {
@@ -275,15 +290,15 @@ inline void LayoutTest(UI::Context* context)
             .height = {200},
             .color = {255, 210, 210, 255},
             .corner_radius = 10,
-        };
+        });
 
-        UI::BoxStyle play_button
+        static constexpr UI::CompiledStyle play_button = UI::CompileStyle(
         {
             .width = {50},
             .height = {50},
             .color = {200, 255, 200, 255},
             .corner_radius = 24
-        };
+        });
         static float liked_song_scroll = 0;
         UI::BoxStyle v_container =
         {
@@ -311,7 +326,7 @@ inline void LayoutTest(UI::Context* context)
         .Id("liked-song-panel")
         .OnHover([&]
         {
-            liked_song_scroll -= UI::GetMouseScroll() * 40;
+            liked_song_scroll -= UI::Input().mouse_scroll * 40;
             liked_song_scroll = UI::Clamp(liked_song_scroll, 0.0f, (float)UI::Info().MaxScrollY());
         })
         .Run([&]
@@ -328,7 +343,7 @@ inline void LayoutTest(UI::Context* context)
     {
         UI::Box(top_bar).Run([&]
         {
-            UI::BoxStyle search_bar =
+            static constexpr UI::CompiledStyle search_bar = UI::CompileStyle(
             {
                 .flow = {.vertical_alignment = UI::Flow::CENTERED, .horizontal_alignment = UI::Flow::CENTERED},
                 .width = {40, UI::Unit::PARENT_PERCENT},
@@ -336,7 +351,7 @@ inline void LayoutTest(UI::Context* context)
                 .margin = {10, 10, 12, 12},
                 .color = {60, 60, 60, 255},
                 .corner_radius = 16
-            };
+            });
             UI::Box(search_bar)
             .Run([&]
             {
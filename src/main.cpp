@@ -1,10 +1,205 @@
 #include <functional>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 #include <raylib/raylib.h>
 #include "ui/ui.hpp"
 #include "UI_Demo.hpp"
 
+/*
+    --render-thread: the ui is built on its own thread and handed to this thread through a FrameRing.
+    This thread owns the window and the GL context, so it captures the input and draws frame N while
+    the ui thread builds frame N + 1 from the newer input.
+*/
+static void RunWithRenderThread(UI::Context& context)
+{
+    //Holds one snapshot, the next one is only written after the ui thread took the last
+    UI::InputSnapshot input;
+    std::atomic<uint32_t> input_count = 0;
+    std::atomic<uint32_t> input_taken = 0;
+    std::atomic<bool> is_running = true;
+    UI::FrameRing ring;
+    context.SetFrameRing(&ring);
+
+    std::thread ui_thread([&]
+    {
+        uint32_t handled = 0;
+        while(true)
+        {
+            input_count.wait(handled);
+            if(!is_running)
+                break;
+            context.SetInput(input);
+            handled++;
+            input_taken.store(handled);
+            input_taken.notify_one();
+            LayoutTest(&context);
+            UI::Draw();
+        }
+    });
+
+    DisableEventWaiting();
+    bool has_frame = false; //The first frame is still being built
+    uint32_t sent = 0;
+    while(!WindowShouldClose())
+    {
+        for(uint32_t taken = input_taken.load(); taken != sent; taken = input_taken.load())
+            input_taken.wait(taken);
+        input = UI::InputSnapshot::Capture();
+        sent++;
+        input_count.fetch_add(1);
+        input_count.notify_one();
+
+        BeginDrawing();
+        ClearBackground(Color{0, 0, 0, 255});
+        const UI::FramePacket* packet = has_frame? ring.BeginRead(): nullptr;
+        if(packet)
+        {
+            UI::ReplayFramePacket(*packet);
+            ring.EndRead();
+        }
+        has_frame = true;
+        EndDrawing();
+    }
+    is_running = false;
+    input_count.fetch_add(1);
+    input_count.notify_one();
+    ring.Close();
+    ui_thread.join();
+    context.SetFrameRing(nullptr);
+}
 
-int main(void)
+/*
+    --bench-frame-ring: builds the demo layout frame_count times and hands every frame to a stub consumer
+    that spins instead of drawing, as long as building a frame takes. Compares doing both on one thread
+    with a consumer thread. Latency is from the start of building a frame until the consumer is done with it.
+*/
+static void ConsumeFramePacket(const UI::FramePacket& packet, double gpu_ms, uint64_t& checksum)
+{
+    StopWatch watch;
+    watch.Start();
+    for(uint32_t i = 0; i < packet.commands.Size(); i++)
+        checksum += packet.commands[i].bounds.x + packet.commands[i].text_size;
+    while(watch.Stop() < gpu_ms);
+}
+static void FrameRingBenchmark(UI::Context& context, int frame_count)
+{
+    UI::InputSnapshot input = UI::InputSnapshot::Capture();
+    UI::FrameRing ring;
+    context.SetFrameRing(&ring);
+    std::vector<double> started(frame_count);
+    std::vector<double> consumed(frame_count);
+    StopWatch clock;
+    uint64_t checksum = 0;
+
+    //Also warms up the caches
+    clock.Start();
+    for(int i = 0; i < 100; i++)
+    {
+        context.SetInput(input);
+        LayoutTest(&context);
+        UI::Draw();
+        ring.BeginRead();
+        ring.EndRead();
+    }
+    double gpu_ms = clock.Stop() / 100;
+    printf("building a frame: %.3f ms, %u draw commands\n", gpu_ms, context.GetDrawStats().command_count);
+
+    for(int threaded = 0; threaded < 2; threaded++)
+    {
+        clock.Start();
+        std::thread consumer;
+        if(threaded)
+        {
+            consumer = std::thread([&]
+            {
+                for(int i = 0; i < frame_count; i++)
+                {
+                    const UI::FramePacket* packet = ring.BeginRead();
+                    ConsumeFramePacket(*packet, gpu_ms, checksum);
+                    ring.EndRead();
+                    consumed[i] = clock.Stop();
+                }
+            });
+        }
+        for(int i = 0; i < frame_count; i++)
+        {
+            started[i] = clock.Stop();
+            context.SetInput(input);
+            LayoutTest(&context);
+            UI::Draw();
+            if(!threaded)
+            {
+                ConsumeFramePacket(*ring.BeginRead(), gpu_ms, checksum);
+                ring.EndRead();
+                consumed[i] = clock.Stop();
+            }
+        }
+        if(threaded)
+            consumer.join();
+        double total = clock.Stop();
+
+        double latency = 0;
+        double max_latency = 0;
+        for(int i = 0; i < frame_count; i++)
+        {
+            latency += consumed[i] - started[i];
+            max_latency = std::max(max_latency, consumed[i] - started[i]);
+        }
+        printf("%s: %.0f frames/s, latency avg %.3f ms max %.3f ms\n", threaded? "render thread": "single thread",
+            frame_count * 1000.0 / total, latency / frame_count, max_latency);
+    }
+    printf("checksum %llu\n", (unsigned long long)checksum);
+    context.SetFrameRing(nullptr);
+}
+
+/*
+    --capture <path>: runs the demo and writes every frame it builds to path.
+    --replay <path>: builds the frames of a capture as fast as possible without the demo and reports the slowest.
+    Frames go to a FrameRing that is emptied right away, so only the context is measured, not the backend
+*/
+static void ReplayBenchmark(UI::Context& context, const char* path)
+{
+    UI::CaptureReplayer replayer;
+    if(!replayer.Open(path))
+    {
+        printf("%s is not a capture of this build\n", path);
+        return;
+    }
+    uint32_t frame_count = replayer.GetFrameCount();
+    if(!frame_count)
+    {
+        printf("%s has no frames\n", path);
+        return;
+    }
+    UI::FrameRing ring;
+    context.SetFrameRing(&ring);
+    std::vector<double> times(frame_count);
+    StopWatch watch;
+    for(uint32_t i = 0; i < frame_count; i++)
+    {
+        watch.Start();
+        replayer.ReplayFrame(&context, i);
+        UI::Draw();
+        times[i] = watch.Stop();
+        ring.BeginRead();
+        ring.EndRead();
+    }
+    context.SetFrameRing(nullptr);
+
+    uint32_t slowest = std::max_element(times.begin(), times.end()) - times.begin();
+    double total = 0;
+    for(double time: times)
+        total += time;
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    printf("%u frames: avg %.3f ms, p99 %.3f ms, max %.3f ms (frame %u)\n", frame_count, total / frame_count,
+        sorted[(frame_count - 1) * 99 / 100], times[slowest], slowest);
+}
+
+int main(int argc, char** argv)
 {
     float screenWidth = 960;
     float screenHeight = 600;
@@ -12,14 +207,47 @@ int main(void)
     SetConfigFlags(FLAG_MSAA_4X_HINT | FLAG_WINDOW_RESIZABLE);
     InitWindow(screenWidth, screenHeight, "Window");
     SetExitKey(0);
-    // SetTargetFPS(60);
+    SetTargetFPS(60);
 
-    UI::Init_impl("assets/fonts/Roboto-Regular.ttf");
+    UI::Init_impl("assets/fonts/Roboto-Regular.ttf", "assets/fonts/Roboto-Regular.atlas");
     UI::Context context(128 * UI::KB, 128 * UI::KB);
     UI::DebugInspector inspector(8 * UI::MB);
     context.SetDebugInspector(&inspector, UI::KEY_F1);
+    if(argc > 1 && std::strcmp(argv[1], "--bench-frame-ring") == 0)
+    {
+        FrameRingBenchmark(context, 2000);
+        CloseWindow();
+        return 0;
+    }
+    if(argc > 1 && std::strcmp(argv[1], "--render-thread") == 0)
+    {
+        //The inspector draws through the backend from the ui thread
+        context.SetDebugInspector(nullptr, UI::KEY_F1);
+        RunWithRenderThread(context);
+        CloseWindow();
+        return 0;
+    }
+    if(argc > 2 && std::strcmp(argv[1], "--replay") == 0)
+    {
+        context.SetDebugInspector(nullptr, UI::KEY_F1);
+        ReplayBenchmark(context, argv[2]);
+        CloseWindow();
+        return 0;
+    }
+    UI::CaptureRecorder recorder;
+    if(argc > 2 && std::strcmp(argv[1], "--capture") == 0)
+    {
+        if(!recorder.Open(argv[2]))
+        {
+            printf("Cannot create %s\n", argv[2]);
+            CloseWindow();
+            return 1;
+        }
+        context.SetCapture(&recorder);
+    }
     while (!WindowShouldClose()) // Detect window close button or ESC key
     {
+        context.SetInput(UI::InputSnapshot::Capture());
         LayoutTest(&context);
         // UI::Root(&context, {.width={GetScreenWidth()}, .height = {GetScreenHeight()}, .color = {255, 255, 255, 255}}, [&]
         // {
@@ -51,10 +279,23 @@ int main(void)
         BeginDrawing();
         ClearBackground(Color{0, 0, 0, 255});
         UI::Draw();
+        //EndDrawing() sleeps until the next input event while the ui is static.
+        //That wait has no timeout, so a redraw requested for later keeps the loop polling until it is due
+        if(std::isinf(context.NextRequiredFrameTime()))
+            EnableEventWaiting();
+        else
+            DisableEventWaiting();
         // DrawText(TextFormat("Fps = %d", GetFPS()), 10, 10, 20, WHITE);
         EndDrawing();
     }
 
+    if(recorder.IsOpen())
+    {
+        context.SetCapture(nullptr);
+        recorder.Close();
+        printf("%u frames, %llu bytes captured\n", recorder.GetFrameCount(), (unsigned long long)recorder.GetByteCount());
+    }
+
     CloseWindow(); // Close window and OpenGL context
 
     return 0;
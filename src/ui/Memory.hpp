@@ -4,6 +4,14 @@
 #include <cstring>
 #include <cassert>
 #include <type_traits>
+#include <atomic>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+    #include <sys/mman.h>
+    #define UI_VIRTUAL_MEMORY 1
+#else
+    #define UI_VIRTUAL_MEMORY 0
+#endif
 
 #include <chrono>
 class StopWatch
@@ -45,11 +53,20 @@ namespace UI::Internal
     template<typename T>
     class Map;
 
+    template<typename T>
+    class DynamicArray;
+
+    template<typename T>
+    class ConcurrentQueue;
+
     class MemoryArena;
 
     template<typename T>
     class ArenaLL;
 
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    class ArenaStack;
+
     template<typename T>
     class ArenaMap;
 
@@ -162,18 +179,100 @@ namespace UI::Internal
         T* GetValue(uint64_t key);
         void Remove(uint64_t key);
         bool ShouldResize() const;
+        //Calls func(key, value) for every item, items must not be inserted/removed inside func
+        template<typename Func>
+        void ForEach(Func&& func);
     private:
         Item* data = nullptr;
         uint32_t capacity = 0;
         uint32_t size = 0;
     };
 
+    //Heap array that keeps its capacity when cleared, used for scratch buffers reused across calls
+    template<typename T>
+    class DynamicArray
+    {
+    public:
+        DynamicArray() = default;
+        DynamicArray(const DynamicArray&) = delete;
+        DynamicArray& operator=(const DynamicArray&) = delete;
+        ~DynamicArray();
+        void Free();
+        //Keeps capacity
+        void Clear();
+        void Reserve(uint32_t count);
+        void Push(const T& value);
+        void Pop();
+        //New elements are default constructed
+        void Resize(uint32_t count);
+        T& Back();
+        bool IsEmpty() const;
+        uint32_t Size() const;
+        uint32_t Capacity() const;
+        T& operator[](uint32_t index);
+        const T& operator[](uint32_t index) const;
+        T* Data();
+    private:
+        T* data = nullptr;
+        uint32_t capacity = 0;
+        uint32_t size = 0;
+    };
+
+    //Bounded lock-free queue, any number of threads can push and pop. Capacity must be a power of two
+    template<typename T>
+    class ConcurrentQueue
+    {
+    public:
+        ConcurrentQueue() = default;
+        ConcurrentQueue(const ConcurrentQueue&) = delete;
+        ConcurrentQueue& operator=(const ConcurrentQueue&) = delete;
+        ~ConcurrentQueue();
+        void Init(uint32_t capacity);
+        void Free();
+        //Returns false when full
+        bool Push(const T& value);
+        //Returns false when empty
+        bool Pop(T& value);
+        uint32_t Capacity() const;
+    private:
+        struct Cell
+        {
+            std::atomic<uint64_t> sequence;
+            T value;
+        };
+        Cell* cells = nullptr;
+        uint64_t mask = 0;
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+    };
+
+    /*
+        With UI_VIRTUAL_MEMORY the capacity of arenas of COMMIT_BYTES or more is only reserved address space,
+        pages are committed in COMMIT_BYTES steps when the offset first reaches them, so a large capacity
+        costs nothing until it is used. Smaller arenas are allocated up front.
+        Arenas of HUGE_ARENA_BYTES or more are aligned for transparent huge pages and commit whole huge pages.
+        Reset() and Rewind() keep the peak offset. Reset() and RewindFrame() mark the end of a frame, when the
+        peak stayed under half of the committed bytes for DECOMMIT_RESETS frames the pages above twice that
+        peak are given back to the system. Plain Rewind() calls inside a frame are not counted.
+        Without it (Windows, web) every arena is allocated up front.
+    */
     class MemoryArena
     {
         char* data = nullptr;
         uint64_t capacity = 0;
         uint64_t current_offset = 0;
+        uint64_t committed = 0; //Bytes from data that can be written
+        uint64_t commit_bytes = 0; //Granularity of committed
+        char* mapping = nullptr; //Start of the reservation, data is aligned inside of it
+        uint64_t mapping_bytes = 0;
+        uint64_t window_peak = 0; //Highest offset since the last decommit check
+        uint32_t window_resets = 0;
     public:
+        static constexpr uint64_t COMMIT_BYTES = 64 * 1024;
+        static constexpr uint64_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+        static constexpr uint64_t HUGE_ARENA_BYTES = 16 * 1024 * 1024;
+        static constexpr uint32_t DECOMMIT_RESETS = 256;
+
         MemoryArena(uint64_t cap);
         ~MemoryArena();
         void ResizeAndReset(uint64_t bytes);
@@ -194,10 +293,27 @@ namespace UI::Internal
         T* New(const T& value);
 
         void Rewind(void* ptr);
+        //Rewind() at the end of a frame, for arenas whose start outlives the frame
+        void RewindFrame(void* ptr);
 
         void Reset();
         uint64_t GetOffset() const;
         uint64_t Capacity() const;
+        //Bytes that currently take memory
+        uint64_t GetCommitted() const;
+        //True when ptr was allocated from this arena and is still before the offset
+        bool Contains(const void* ptr) const;
+        //True when ptr is at the offset, so nothing was allocated after the allocation that ends at ptr
+        bool EndsAt(const void* ptr) const;
+    private:
+        void Reserve(uint64_t bytes);
+        void Release();
+        //Makes [0, end) writable, false when the system is out of memory
+        bool Commit(uint64_t end);
+        //Called before the offset moves back, the pages above the new offset are unused from then on
+        void TrackPeak();
+        //Called once per frame, decommits when the peak stayed low for DECOMMIT_RESETS frames
+        void TrackUsage();
     };
 
 
@@ -221,10 +337,41 @@ namespace UI::Internal
         //Just sets head/tail to nullptr
         void Clear();
         bool PopHead();
+        //Moves the nodes of other to the end of this list, other is left empty
+        void Append(ArenaLL& other);
         Node* GetHead();
         Node* GetTail();
     };
 
+    //Unbounded stack made of fixed size blocks allocated from an arena.
+    //Popped blocks are kept and reused, they are only freed with the arena.
+    template<typename T, uint32_t BLOCK_CAPACITY = 64>
+    class ArenaStack
+    {
+        struct Block
+        {
+            Block* prev = nullptr;
+            Block* next = nullptr;
+            uint32_t size = 0;
+            T data[BLOCK_CAPACITY];
+        };
+        Block* first = nullptr;
+        Block* top = nullptr;
+        uint32_t size = 0;
+    public:
+        //returns false if arena is out of space
+        bool Push(const T& value, MemoryArena* arena);
+        void Pop();
+        T& Peek();
+        bool IsEmpty() const;
+        uint32_t Size() const;
+        //Just forgets the blocks, use after the arena was reset/rewound
+        void Clear();
+        //Frees the blocks, nothing else may be allocated from the arena while the stack is used.
+        //Otherwise the blocks are only forgotten so the later allocations survive
+        void RewindArena(MemoryArena* arena);
+    };
+
     template<typename T>
     class ArenaDLL
     {
@@ -518,6 +665,193 @@ namespace UI::Internal
         return data[index];
     }
 
+    template<typename T>
+    template<typename Func>
+    inline void Map<T>::ForEach(Func&& func)
+    {
+        for(uint32_t i = 0; i < capacity; i++)
+        {
+            if(data[i].key != 0)
+                func(data[i].key, data[i].value);
+        }
+    }
+
+    // ============= DynamicArray ======================
+    template<typename T>
+    inline DynamicArray<T>::~DynamicArray()
+    {
+        Free();
+    }
+    template<typename T>
+    inline void DynamicArray<T>::Free()
+    {
+        if(data)
+            delete[] data;
+        data = nullptr;
+        size = 0;
+        capacity = 0;
+    }
+    template<typename T>
+    inline void DynamicArray<T>::Clear()
+    {
+        size = 0;
+    }
+    template<typename T>
+    inline void DynamicArray<T>::Reserve(uint32_t count)
+    {
+        if(count <= capacity)
+            return;
+        T* old_data = data;
+        data = new T[count];
+        for(uint32_t i = 0; i < size; i++)
+            data[i] = old_data[i];
+        if(old_data)
+            delete[] old_data;
+        capacity = count;
+    }
+    template<typename T>
+    inline void DynamicArray<T>::Push(const T& value)
+    {
+        if(size == capacity)
+            Reserve(capacity? capacity * 2: 64);
+        data[size++] = value;
+    }
+    template<typename T>
+    inline void DynamicArray<T>::Pop()
+    {
+        assert(size && "DynamicArray is empty");
+        size--;
+    }
+    template<typename T>
+    inline void DynamicArray<T>::Resize(uint32_t count)
+    {
+        Reserve(count);
+        for(uint32_t i = size; i < count; i++)
+            data[i] = T();
+        size = count;
+    }
+    template<typename T>
+    inline T& DynamicArray<T>::Back()
+    {
+        assert(size && "DynamicArray is empty");
+        return data[size - 1];
+    }
+    template<typename T>
+    inline bool DynamicArray<T>::IsEmpty() const
+    {
+        return size == 0;
+    }
+    template<typename T>
+    inline uint32_t DynamicArray<T>::Size() const
+    {
+        return size;
+    }
+    template<typename T>
+    inline uint32_t DynamicArray<T>::Capacity() const
+    {
+        return capacity;
+    }
+    template<typename T>
+    inline T& DynamicArray<T>::operator[](uint32_t index)
+    {
+        assert(index < size && "DynamicArray out of scope");
+        return data[index];
+    }
+    template<typename T>
+    inline const T& DynamicArray<T>::operator[](uint32_t index) const
+    {
+        assert(index < size && "DynamicArray out of scope");
+        return data[index];
+    }
+    template<typename T>
+    inline T* DynamicArray<T>::Data()
+    {
+        return data;
+    }
+
+    // ============= ConcurrentQueue ======================
+    //Every cell has a sequence number that tells whether it is ready for a push (== position) or a pop (== position + 1)
+    template<typename T>
+    inline ConcurrentQueue<T>::~ConcurrentQueue()
+    {
+        Free();
+    }
+    template<typename T>
+    inline void ConcurrentQueue<T>::Init(uint32_t capacity)
+    {
+        assert(capacity && (capacity & (capacity - 1)) == 0 && "ConcurrentQueue capacity must be a power of two");
+        Free();
+        cells = new Cell[capacity];
+        for(uint32_t i = 0; i < capacity; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        mask = capacity - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+    template<typename T>
+    inline void ConcurrentQueue<T>::Free()
+    {
+        if(cells)
+            delete[] cells;
+        cells = nullptr;
+        mask = 0;
+    }
+    template<typename T>
+    inline bool ConcurrentQueue<T>::Push(const T& value)
+    {
+        assert(cells && "ConcurrentQueue is not initialized");
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Cell& cell = cells[pos & mask];
+            uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)sequence - (int64_t)pos;
+            if(diff == 0)
+            {
+                if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+    template<typename T>
+    inline bool ConcurrentQueue<T>::Pop(T& value)
+    {
+        assert(cells && "ConcurrentQueue is not initialized");
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Cell& cell = cells[pos & mask];
+            uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)sequence - (int64_t)(pos + 1);
+            if(diff == 0)
+            {
+                if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+    template<typename T>
+    inline uint32_t ConcurrentQueue<T>::Capacity() const
+    {
+        return (uint32_t)(mask + 1);
+    }
+
     template<typename T>
     inline Map<T>::~Map()
     {
@@ -635,17 +969,21 @@ namespace UI::Internal
             else if(data[index].key == key)
             {
                 size--;
-                uint32_t prev = index;
-                for(uint32_t j = 1; j < capacity; j++)
+                data[index] = Item();
+                //Shifts back the following items of the cluster that can no longer be reached
+                uint32_t next = index;
+                while(true)
                 {
-                    uint32_t index2 = (index + j) % capacity;
-                    if(data[index2].key == 0 || index2 == data[index2].key % capacity)
-                    {
-                        data[index] = data[prev];
-                        data[prev] = Item();
+                    next = (next + 1) % capacity;
+                    if(data[next].key == 0)
                         break;
-                    }
-                    prev = index2;
+                    uint32_t home = data[next].key % capacity;
+                    bool is_reachable = index <= next? (index < home && home <= next): (index < home || home <= next);
+                    if(is_reachable)
+                        continue;
+                    data[index] = data[next];
+                    data[next] = Item();
+                    index = next;
                 }
                 return;
             }
@@ -657,25 +995,109 @@ namespace UI::Internal
 
     //MemoryArena Implementation
     inline MemoryArena::MemoryArena(uint64_t bytes)
-        : capacity(bytes), current_offset(0), data(new char[bytes])
     {
-        assert(data); //Over Capacity
+        Reserve(bytes);
     }
     inline MemoryArena::~MemoryArena()
     {
-        delete[] data;
+        Release();
     }
     inline void MemoryArena::ResizeAndReset(uint64_t bytes)
     {
-        if(data)
+        Release();
+        Reserve(bytes);
+    }
+    inline void MemoryArena::Reserve(uint64_t bytes)
+    {
+        capacity = bytes;
+        current_offset = 0;
+        window_peak = 0;
+        window_resets = 0;
+        if(!bytes)
+            return;
+    #if UI_VIRTUAL_MEMORY
+        if(bytes < COMMIT_BYTES)
         {
-            delete[] data;
-            data = nullptr;
+            data = new char[bytes];
+            committed = bytes;
+            return;
         }
+        bool is_huge = bytes >= HUGE_ARENA_BYTES;
+        commit_bytes = is_huge? HUGE_PAGE_BYTES: COMMIT_BYTES;
+        uint64_t size = (bytes + commit_bytes - 1) & ~(commit_bytes - 1);
+        mapping_bytes = size + (is_huge? HUGE_PAGE_BYTES: 0); //Room to align data
+        void* reserved = mmap(nullptr, mapping_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(reserved != MAP_FAILED && "Could not reserve the arena");
+        if(reserved == MAP_FAILED)
+        {
+            capacity = 0;
+            mapping_bytes = 0;
+            return;
+        }
+        mapping = (char*)reserved;
+        data = is_huge? (char*)(((uintptr_t)mapping + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1)): mapping;
+        #ifdef MADV_HUGEPAGE
+            if(is_huge)
+                madvise(data, size, MADV_HUGEPAGE); //Only a hint, regular pages are fine too
+        #endif
+        committed = 0;
+    #else
         data = new char[bytes];
-        capacity = bytes;
+        assert(data); //Over Capacity
+        committed = bytes;
+    #endif
+    }
+    inline void MemoryArena::Release()
+    {
+    #if UI_VIRTUAL_MEMORY
+        if(mapping)
+            munmap(mapping, mapping_bytes);
+        else
+            delete[] data;
+        mapping = nullptr;
+        mapping_bytes = 0;
+    #else
+        delete[] data;
+    #endif
+        data = nullptr;
+        capacity = 0;
+        committed = 0;
         current_offset = 0;
-        assert(data); //should not happen
+    }
+    inline bool MemoryArena::Commit(uint64_t end)
+    {
+    #if UI_VIRTUAL_MEMORY
+        uint64_t new_committed = (end + commit_bytes - 1) & ~(commit_bytes - 1);
+        if(mprotect(data + committed, new_committed - committed, PROT_READ | PROT_WRITE) != 0)
+            return false;
+        committed = new_committed;
+        return true;
+    #else
+        return end <= committed;
+    #endif
+    }
+    inline void MemoryArena::TrackPeak()
+    {
+        window_peak = current_offset > window_peak? current_offset: window_peak;
+    }
+    inline void MemoryArena::TrackUsage()
+    {
+    #if UI_VIRTUAL_MEMORY
+        if(!mapping)
+            return;
+        TrackPeak();
+        if(++window_resets < DECOMMIT_RESETS)
+            return;
+        uint64_t keep = (window_peak * 2 + commit_bytes - 1) & ~(commit_bytes - 1);
+        if(window_peak * 2 < committed && keep < committed)
+        {
+            madvise(data + keep, committed - keep, MADV_DONTNEED);
+            mprotect(data + keep, committed - keep, PROT_NONE);
+            committed = keep;
+        }
+        window_peak = 0;
+        window_resets = 0;
+    #endif
     }
     inline void* MemoryArena::Allocate(uint64_t bytes, uint8_t alignment)
     {
@@ -686,6 +1108,8 @@ namespace UI::Internal
         uint64_t new_offset = current_offset + bytes;
         if(new_offset <= capacity)
         {
+            if(new_offset > committed && !Commit(new_offset))
+                return nullptr;
             void* ptr = (data + current_offset);
             current_offset = new_offset;
             return ptr;
@@ -746,10 +1170,19 @@ namespace UI::Internal
         assert(ptr >= data && ptr < data + capacity);
         uint64_t new_offset = ((char*)ptr - data);
         if(new_offset < current_offset)
+        {
+            TrackPeak();
             current_offset = new_offset;
+        }
+    }
+    inline void MemoryArena::RewindFrame(void* ptr)
+    {
+        TrackUsage();
+        Rewind(ptr);
     }
     inline void MemoryArena::Reset()
     {
+        TrackUsage();
         current_offset = 0;
     }
     inline uint64_t MemoryArena::GetOffset() const
@@ -760,6 +1193,94 @@ namespace UI::Internal
     {
         return capacity;
     }
+    inline uint64_t MemoryArena::GetCommitted() const
+    {
+        return committed;
+    }
+    inline bool MemoryArena::Contains(const void* ptr) const
+    {
+        return ptr >= data && ptr < data + current_offset;
+    }
+    inline bool MemoryArena::EndsAt(const void* ptr) const
+    {
+        return ptr == data + current_offset;
+    }
+
+    //ArenaStack Implementation
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline bool ArenaStack<T, BLOCK_CAPACITY>::Push(const T& value, MemoryArena* arena)
+    {
+        assert(arena);
+        if(!top || top->size == BLOCK_CAPACITY)
+        {
+            if(top && top->next)
+            {
+                top = top->next;
+            }
+            else
+            {
+                Block* block = arena->New<Block>();
+                if(!block)
+                    return false;
+                block->prev = top;
+                if(top)
+                    top->next = block;
+                else
+                    first = block;
+                top = block;
+            }
+            top->size = 0;
+        }
+        top->data[top->size++] = value;
+        size++;
+        return true;
+    }
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline void ArenaStack<T, BLOCK_CAPACITY>::Pop()
+    {
+        assert(size && "ArenaStack is empty");
+        top->size--;
+        size--;
+        if(top->size == 0 && top->prev)
+            top = top->prev;
+    }
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline T& ArenaStack<T, BLOCK_CAPACITY>::Peek()
+    {
+        assert(size && "ArenaStack is empty");
+        return top->data[top->size - 1];
+    }
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline bool ArenaStack<T, BLOCK_CAPACITY>::IsEmpty() const
+    {
+        return size == 0;
+    }
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline uint32_t ArenaStack<T, BLOCK_CAPACITY>::Size() const
+    {
+        return size;
+    }
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline void ArenaStack<T, BLOCK_CAPACITY>::Clear()
+    {
+        first = nullptr;
+        top = nullptr;
+        size = 0;
+    }
+    template<typename T, uint32_t BLOCK_CAPACITY>
+    inline void ArenaStack<T, BLOCK_CAPACITY>::RewindArena(MemoryArena* arena)
+    {
+        assert(arena && "No Arena passed");
+        //Blocks above top are kept for reuse, the last one ends the stack's memory
+        Block* last = top;
+        while(last && last->next)
+            last = last->next;
+        bool is_last = !last || arena->EndsAt(last + 1);
+        assert(is_last && "Arena was used after the stack's blocks, they cannot be freed");
+        if(is_last)
+            arena->Rewind(first);
+        Clear();
+    }
 
     //ArenaLL Implementation
     template<typename T>
@@ -802,6 +1323,18 @@ namespace UI::Internal
         return true;
     }
     template<typename T>
+    inline void ArenaLL<T>::Append(ArenaLL& other)
+    {
+        if(other.head == nullptr)
+            return;
+        if(head == nullptr)
+            head = other.head;
+        else
+            tail->next = other.head;
+        tail = other.tail;
+        other.Clear();
+    }
+    template<typename T>
     inline void ArenaLL<T>::Clear()
     {
         head = nullptr;
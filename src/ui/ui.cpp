@@ -1,25 +1,35 @@
 #include "ui.hpp"
 #include "Memory.hpp"
 #include <algorithm>
+#include <climits>
 #include <cstdint>
 #include <ios>
+#if UI_VIRTUAL_MEMORY
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 namespace UI
 {
     using namespace Internal;
     void DisplayError(const Error& error);
-    //Not Active
-    Error CheckUnitErrors(const BoxCore& style);
 
     //Not Active
     Error CheckNodeContradictions(const BoxCore& child, const BoxCore& parent);
 
     //Used during tree descending
     int FixedUnitToPx(Unit unit, int root_size);
-    BoxCore ComputeStyleSheet(const BoxStyle& style, const BoxCore& root);
+
+    //Style registry helpers
+    uint64_t HashStyle(const BoxStyle& style);
+    bool IsSameStyle(const BoxStyle& a, const BoxStyle& b);
+    void ApplyStyleOverride(BoxCore& box, const StyleOverride& style_override);
+    void ApplyStyleOverride(BoxStyle& style, const StyleOverride& style_override);
 
     //Text related functions
     int MeasureTextSpans(BoxCore& box);
+    int MeasureText(const StringU32& text, const TextStyle& style);
 
     //size should includes '\0' if null terminated string are used
 
@@ -30,6 +40,10 @@ namespace UI
     void ComputeParentWidthPercent(BoxCore& box, int parent_width);
     void ComputeParentHeightPercent(BoxCore& box, int parent_width);
 
+    //Memoization helpers
+    void ReserveArena(MemoryArena*& arena, uint64_t bytes);
+    bool IsMemoLayoutCacheable(const BoxCore& box);
+
 
     inline void BeginScissorMode_impl(const Rect& rect) { BeginScissorMode_impl((float)rect.x, (float)rect.y, (float)rect.width, (float)rect.height);}
     inline int MeasureChar_impl(char32_t c, const TextStyle& style) { return MeasureChar_impl(c, style.GetFontSize(), style.GetFontSpacing()); }
@@ -40,9 +54,10 @@ namespace UI
 //GLOBALS
 namespace UI
 {
-    Internal::FixedStack<Context*, 16> context_stack;
+    //Per thread so ParallelFor() workers can build with the global functions
+    thread_local Internal::FixedStack<Context*, 16> context_stack;
     Internal::FixedQueue<Context*, 16> context_queue;
-    Builder builder;
+    thread_local Builder builder;
     void PushContext(Context* context);
 }
 
@@ -71,6 +86,53 @@ namespace UI
         return context_stack.Peek();
     }
 
+    InputSnapshot InputSnapshot::Capture()
+    {
+        InputSnapshot input;
+        input.mouse_x = GetMouseX();
+        input.mouse_y = GetMouseY();
+        input.mouse_scroll = GetMouseScroll();
+        input.frame_time = GetFrameTime();
+        input.screen_width = GetScreenWidth();
+        input.screen_height = GetScreenHeight();
+        for(uint8_t button = MOUSE_LEFT; button <= MOUSE_BACK; button++)
+        {
+            input.mouse_pressed |= UI::IsMousePressed((MouseButton)button) << button;
+            input.mouse_released |= UI::IsMouseReleased((MouseButton)button) << button;
+            input.mouse_down |= UI::IsMouseDown((MouseButton)button) << button;
+        }
+        for(int key = 0; key < KEY_COUNT; key++)
+        {
+            input.SetKey(input.keys_pressed, (Key)key, UI::IsKeyPressed((Key)key));
+            input.SetKey(input.keys_released, (Key)key, UI::IsKeyReleased((Key)key));
+            input.SetKey(input.keys_down, (Key)key, UI::IsKeyDown((Key)key));
+            input.SetKey(input.keys_repeat, (Key)key, UI::IsKeyRepeat((Key)key));
+        }
+        while(input.char_count < CHAR_CAPACITY)
+        {
+            char c = GetPressedChar();
+            if(!c)
+                break;
+            input.chars[input.char_count++] = c;
+        }
+        return input;
+    }
+    bool InputSnapshot::HasEvents(const InputSnapshot& previous) const
+    {
+        if(mouse_pressed || mouse_released || char_count || mouse_scroll != 0.0f)
+            return true;
+        if(mouse_x != previous.mouse_x || mouse_y != previous.mouse_y || mouse_down != previous.mouse_down)
+            return true;
+        if(screen_width != previous.screen_width || screen_height != previous.screen_height)
+            return true;
+        for(int i = 0; i < (KEY_COUNT + 63) / 64; i++)
+        {
+            if(keys_pressed[i] || keys_released[i] || keys_repeat[i] || keys_down[i] != previous.keys_down[i])
+                return true;
+        }
+        return false;
+    }
+
     BoxInfo Info(const StringAsci& id)
     {
         if(IsContextActive())
@@ -106,12 +168,42 @@ namespace UI
             GetContext()->BeginBox(box_style, id, debug_info);
     }
 
+    void BeginBox(StyleHandle handle, const StyleOverride& style_override, const StringAsci& id, DebugInfo debug_info)
+    {
+        if(IsContextActive())
+            GetContext()->BeginBox(handle, style_override, id, debug_info);
+    }
+
+    void BeginBox(const CompiledStyle& style, const StyleOverride& style_override, const StringAsci& id, DebugInfo debug_info)
+    {
+        if(IsContextActive())
+            GetContext()->BeginBox(style, style_override, id, debug_info);
+    }
+
     void EndBox()
     {
         if(IsContextActive())
             GetContext()->EndBox();
     }
 
+    StyleHandle RegisterStyle(const BoxStyle& style)
+    {
+        if(IsContextActive())
+            return GetContext()->RegisterStyle(style);
+        return StyleHandle();
+    }
+
+    StringU32 FrameString(const char* fmt, ...)
+    {
+        if(!IsContextActive())
+            return StringU32();
+        va_list args;
+        va_start(args, fmt);
+        StringU32 string = GetContext()->FrameString(fmt, args);
+        va_end(args);
+        return string;
+    }
+
     void Draw()
     {
         assert(!context_queue.IsEmpty() && "No UI::Context attached or UI::Draw called multiple times");
@@ -134,10 +226,23 @@ namespace UI
     {
         builder.LineBreak();
     }
+    void TextSlot(uint8_t index, const TextStyle& style)
+    {
+        if(IsContextActive())
+            GetContext()->InsertTextSlot(index, style);
+    }
     Builder& Box(const BoxStyle& style, const StringAsci& id, DebugInfo debug_info)
     {
         return builder.Box(style, id, debug_info);
     }
+    Builder& Box(StyleHandle handle, const StringAsci& id, DebugInfo debug_info)
+    {
+        return builder.Box(handle, id, debug_info);
+    }
+    Builder& Box(const CompiledStyle& style, const StringAsci& id, DebugInfo debug_info)
+    {
+        return builder.Box(style, id, debug_info);
+    }
 
     BoxInfo Info()
     {
@@ -152,6 +257,17 @@ namespace UI
     {
         return builder.Style();
     }
+    StyleOverride& Override()
+    {
+        return builder.Override();
+    }
+    const InputSnapshot& Input()
+    {
+        static const InputSnapshot no_input;
+        if(IsContextActive())
+            return GetContext()->GetInput();
+        return no_input;
+    }
     BoxState& State()
     {
         return builder.State();
@@ -176,89 +292,60 @@ namespace UI
 //Box
 namespace UI
 {
-    TextSpans::Iterator TextSpans::Iterator::Next() const
+    TextLines::Iterator TextLines::Iterator::Next() const
     {
         Iterator it = *this;
-        if(!it.node)
+        if(!it.run)
             return it;
-        const TextSpan& span = it.node->value;
         it.string_index++;
-        if(it.string_index >= (int)span.Size()) //Iterate next
+        if(it.string_index >= (int)it.run->Size()) //Iterate next
         {
-            it.node = it.node->next;
+            it.run = it.run == it.last? nullptr: it.run + 1;
             it.string_index = 0;
         }
         return it;
     }
-    TextSpans::Iterator TextSpans::Iterator::Prev() const
+
+    char32_t TextLines::Iterator::GetChar() const
     {
-        Iterator it = *this;
-        if(!it.node)
-            return it;
-        const TextSpan& span = it.node->value;
-        it.string_index--;
-        if(it.string_index < 0)
-        {
-            if(it.node->prev)
-            {
-                it.node = it.node->prev;
-                it.string_index = (int)it.node->value.Size() - 1;
-            }
-            else
-            {
-                it.string_index = 0;
-            }
-        }
-        return it;
+        assert(run && string_index >= 0 && string_index < run->Size()); // my own sanity
+        return (*run)[string_index];
     }
-
-    char32_t TextSpans::Iterator::GetChar() const
+    TextStyle TextLines::Iterator::GetStyle() const
     {
-        assert(node && string_index >= 0 && string_index < node->value.Size()); // my own sanity
-        return node->value[string_index];
+        assert(run && string_index >= 0 && string_index < run->Size()); // my own sanity
+        return run->style;
     }
-    TextStyle TextSpans::Iterator::GetStyle() const
+    bool TextLines::Iterator::IsValid() const
     {
-        assert(node && string_index >= 0 && string_index < node->value.Size()); // my own sanity
-        return node->value.style;
+        return run;
     }
-    bool TextSpans::Iterator::IsValid() const
+
+    TextLines::Iterator TextLines::Begin() const
     {
-        return node;
+        if(runs.IsEmpty())
+            return Iterator{};
+        return Iterator{runs.data, runs.data + runs.Size() - 1, 0};
     }
 
-    StringU32 TextSpans::GetString(Iterator start, Iterator end)
+    bool TextLines::IsEmpty() const
     {
-        assert(start.node);
-        StringU32& string = start.node->value;
-        if(start.node == end.node) //if they are the same style
-        {
-            int size = Max(0 ,end.string_index - start.string_index);
-            return string.SubStr(start.string_index, size);
-        }
-        //Just returns the whole string in start
-        return string.SubStr(start.string_index, -1);
+        return lines.IsEmpty();
     }
 
-    TextSpan TextSpans::GetTextSpan(Iterator start, Iterator end)
+    uint64_t TextLines::Size() const
     {
-        assert(start.node);
-        return TextSpan{GetString(start, end), start.node->value.style};
+        return lines.Size();
     }
 
-    TextSpans::Iterator TextSpans::Begin()
+    StringU32 TextLines::GetString(const TextLine& line) const
     {
-        if(GetHead())
-            return Iterator{GetHead(), 0};
-        return Iterator{};
+        return runs[line.run].SubStr(line.start, line.size);
     }
 
-    //Index is initialized past the largest index when at end
-    TextSpans::Iterator TextSpans::End()
+    const TextStyle& TextLines::GetStyle(const TextLine& line) const
     {
-        if(GetTail())
-            return Iterator{GetTail(), (int)GetTail()->value.Size()};
-        return Iterator{};
+        return runs[line.run].style;
     }
 
     inline BoxCore::Type BoxCore::GetElementType() const
@@ -266,10 +353,6 @@ namespace UI
         return type;
     }
 
-    inline void BoxCore::SetFlowAxis(Flow::Axis axis){flow_axis = axis;}
-
-    inline void BoxCore::SetScissor(bool flag){scissor = flag;}
-
     inline Layout BoxCore::GetLayout() const
     {
         return layout;
@@ -285,11 +368,6 @@ namespace UI
         return scissor;
     }
 
-    inline bool BoxCore::IsDetached() const
-    {
-        return detach != Detach::NONE;
-    }
-
     inline bool BoxCore::IsTextElement() const
     {
         return !text_style_spans.IsEmpty();
@@ -359,9 +437,9 @@ namespace UI
     {
         LogError_impl(error.msg);
     }
-    Error CheckUnitErrors(const BoxCore& style)
+    void InvalidUnitCombination(const char* msg)
     {
-        return Error();
+        LogError_impl(msg);
     }
     Error CheckNodeContradictions(const BoxCore& child, const BoxCore& parent)
     {
@@ -411,62 +489,102 @@ namespace UI
         }
     }
 
-    BoxCore ComputeStyleSheet(const BoxStyle& style, const BoxCore& root)
-    {
-        int root_width = root.width - style.margin.left - style.margin.right - style.padding.left - style.padding.right;
-        int root_height = root.height - style.margin.top - style.margin.bottom - style.padding.top - style.padding.bottom;
-        root_width = Max(0, root_width);
-        root_height = Max(0, root_height);
-
-        BoxCore box;
-        box.texture = style.texture;
-        box.type = style.texture.HasTexture()? BoxCore::Type::IMAGE: BoxCore::Type::BOX;
-
-        box.background_color =          style.color;
-        box.border_color =              style.border_color;
-        //type 3
 
-        box.scroll_x =                  style.scroll_x;
-        box.scroll_y =                  style.scroll_y;
 
-        box.x =                         (int16_t)style.x;
-        box.y =                         (int16_t)style.y;
-        box.width =                     (uint16_t)style.width.value;
-        box.height =                    (uint16_t)style.height.value;
-        box.gap_row =                   (uint16_t)style.gap_row;
-        box.gap_column =                (uint16_t)style.gap_column;
-        box.min_width =                 (uint16_t)style.min_width.value;
-        box.max_width =                 (uint16_t)style.max_width.value;
-        box.min_height =                (uint16_t)style.min_height.value;
-        box.max_height =                (uint16_t)style.max_height.value;
-
-        box.width_unit =                style.width.unit;
-        box.height_unit =               style.height.unit;
-        box.min_width_unit =            style.min_width.unit;
-        box.max_width_unit =            style.max_width.unit;
-        box.min_height_unit =           style.min_height.unit;
-        box.max_height_unit =           style.max_height.unit;
-
-        box.grid_row_count =            Max((uint8_t)1, style.grid.row_count);
-        box.grid_column_count =         Max((uint8_t)1, style.grid.column_count);
-        box.grid_x =                    style.grid.x;
-        box.grid_y =                    style.grid.y;
-        box.grid_span_x =               Max((uint8_t)1, style.grid.span_x);
-        box.grid_span_y =               Max((uint8_t)1, style.grid.span_y);
+    //Hashed field by field since BoxStyle has padding bytes
+    //Calls func(value) with every field of the style, so hashing and comparing read the same fields
+    template<typename Func>
+    void ForEachStyleField(const BoxStyle& style, Func&& func)
+    {
+        auto UnitFields = [&](const Unit& unit)
+        {
+            func(CastToU64(unit.value));
+            func(CastToU64(unit.unit));
+        };
+        func(CastToU64(style.layout));
+        func(CastToU64(style.flow));
+        func(CastToU64(style.grid));
+        func(CastToU64(style.x));
+        func(CastToU64(style.y));
+        UnitFields(style.width);
+        UnitFields(style.height);
+        UnitFields(style.min_width);
+        UnitFields(style.max_width);
+        UnitFields(style.min_height);
+        UnitFields(style.max_height);
+        func(CastToU64(style.padding));
+        func(CastToU64(style.margin));
+        func(CastToU64(style.color));
+        func(CastToU64(style.border_color));
+        func(CastToU64((uintptr_t)style.texture.texture));
+        func(CastToU64(style.texture.x));
+        func(CastToU64(style.texture.y));
+        func(CastToU64(style.texture.width));
+        func(CastToU64(style.texture.height));
+        func(CastToU64(style.gap_row));
+        func(CastToU64(style.gap_column));
+        func(CastToU64(style.scroll_x));
+        func(CastToU64(style.scroll_y));
+        func(CastToU64(style.corner_radius));
+        func(CastToU64(style.border_width));
+        func(CastToU64(style.scissor));
+        func(CastToU64(style.detach));
+    }
+    uint64_t HashStyle(const BoxStyle& style)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        ForEachStyleField(style, [&](uint64_t value){ hash = HashCombine(hash, value); });
+        return hash? hash: 1; //0 is reserved for invalid handles
+    }
+    bool IsSameStyle(const BoxStyle& a, const BoxStyle& b)
+    {
+        uint64_t fields[64];
+        uint32_t count = 0;
+        ForEachStyleField(a, [&](uint64_t value){ assert(count < 64); fields[count++] = value; });
+        uint32_t index = 0;
+        bool is_same = true;
+        ForEachStyleField(b, [&](uint64_t value){ is_same &= fields[index++] == value; });
+        return is_same;
+    }
 
-        box.flow_vertical_alignment =   style.flow.vertical_alignment;
-        box.flow_horizontal_alignment = style.flow.horizontal_alignment;
-        //PIXEL VALUES
-        box.corner_radius =             style.corner_radius; //255 sets to circle
-        box.border_width =              style.border_width;
-        box.padding =                   style.padding;
-        box.margin =                    style.margin;
-        box.layout =                    style.layout;
-        box.detach =                    style.detach;
+    void ApplyStyleOverride(BoxCore& box, const StyleOverride& o)
+    {
+        if(o.Has(StyleOverride::WIDTH))
+        {
+            box.width =         (uint16_t)o.width.value;
+            box.width_unit =    o.width.unit;
+        }
+        if(o.Has(StyleOverride::HEIGHT))
+        {
+            box.height =        (uint16_t)o.height.value;
+            box.height_unit =   o.height.unit;
+        }
+        if(o.Has(StyleOverride::COLOR))
+            box.background_color = o.color;
+        if(o.Has(StyleOverride::BORDER_COLOR))
+            box.border_color = o.border_color;
+        if(o.Has(StyleOverride::SCROLL))
+        {
+            box.scroll_x = o.scroll_x;
+            box.scroll_y = o.scroll_y;
+        }
+    }
 
-        box.SetFlowAxis(style.flow.axis);
-        box.SetScissor(style.scissor);
-        return box;
+    void ApplyStyleOverride(BoxStyle& style, const StyleOverride& o)
+    {
+        if(o.Has(StyleOverride::WIDTH))
+            style.width = o.width;
+        if(o.Has(StyleOverride::HEIGHT))
+            style.height = o.height;
+        if(o.Has(StyleOverride::COLOR))
+            style.color = o.color;
+        if(o.Has(StyleOverride::BORDER_COLOR))
+            style.border_color = o.border_color;
+        if(o.Has(StyleOverride::SCROLL))
+        {
+            style.scroll_x = o.scroll_x;
+            style.scroll_y = o.scroll_y;
+        }
     }
 
 
@@ -476,7 +594,7 @@ namespace UI
         int width = 0;
         for(auto node = box.text_style_spans.GetHead(); node != nullptr; node = node->next)
         {
-            for(int i = 0; i < node->value.Size(); i++)
+            for(uint64_t i = 0; i < node->value.Size(); i++)
             {
                 char32_t c = node->value[i];
                 if(c == U'\n')
@@ -490,15 +608,33 @@ namespace UI
         }
         return largest_width;
     }
+    //Same as MeasureTextSpans() for a single span
+    int MeasureText(const StringU32& text, const TextStyle& style)
+    {
+        int largest_width = 0;
+        int width = 0;
+        for(uint64_t i = 0; i < text.Size(); i++)
+        {
+            if(text[i] == U'\n')
+            {
+                width = 0;
+                continue;
+            }
+            width += MeasureChar_impl(text[i], style);
+            largest_width = Max(largest_width, width);
+        }
+        return largest_width;
+    }
 
 
     //TEXT RENDERING
     StringAsci Fmt(const char *text, ...)
     {
-        static int index = 0;
+        //Per thread, ParallelFor() builds format ids at the same time
+        static thread_local int index = 0;
         constexpr uint32_t MAX_LENGTH = 512;
         constexpr uint32_t MAX_BUFFERS = 6;
-        static char buffer[MAX_BUFFERS][MAX_LENGTH];  // Fixed-size static buffer
+        static thread_local char buffer[MAX_BUFFERS][MAX_LENGTH];  // Fixed-size static buffer
         index = (index + 1) % MAX_BUFFERS;
 
         va_list args;
@@ -512,10 +648,10 @@ namespace UI
 
     StringU32 AsciToStrU32(const StringAsci& str)
     {
-        static int index = 0;
+        static thread_local int index = 0;
         constexpr uint32_t MAX_LENGTH = 512;
         constexpr uint32_t MAX_BUFFERS = 6;
-        static char32_t buffer[MAX_BUFFERS][MAX_LENGTH]{};  // Fixed-size static buffer
+        static thread_local char32_t buffer[MAX_BUFFERS][MAX_LENGTH]{};  // Fixed-size static buffer
 
         index = (index + 1) % MAX_BUFFERS;
 
@@ -567,6 +703,30 @@ namespace UI
         if(box.max_height_unit == Unit::Type::WIDTH_PERCENT)
             box.max_height = box.width * box.max_height / 100;
     }
+
+    //Memo arenas only ever hold one copy, so they are reset or regrown before each copy
+    void ReserveArena(MemoryArena*& arena, uint64_t bytes)
+    {
+        if(!arena)
+            arena = new MemoryArena(bytes);
+        else if(arena->Capacity() < bytes)
+            arena->ResizeAndReset(bytes);
+        else
+            arena->Reset();
+    }
+    //The layout inside the box only depends on its final width/height
+    bool IsMemoLayoutCacheable(const BoxCore& box)
+    {
+        if(box.IsTextElement())
+            return false;
+        const Unit::Type units[] = {box.width_unit, box.height_unit, box.min_width_unit, box.max_width_unit, box.min_height_unit, box.max_height_unit};
+        for(Unit::Type unit: units)
+        {
+            if(unit == Unit::Type::CONTENT_PERCENT || unit == Unit::Type::WIDTH_PERCENT)
+                return false;
+        }
+        return true;
+    }
 }
 
 
@@ -591,10 +751,62 @@ namespace UI
         std::cout<<element_count<<'\n';
         std::cout<<(float)arena1.GetOffset() / arena1.Capacity()<<'\n';
     }
+    Context::Context(Context* owner, uint64_t arena_bytes, uint64_t string_bytes) :
+        arena1(arena_bytes), arena2(0), arena3(string_bytes), owner(owner)
+    {
+    }
+    Context::~Context()
+    {
+        StopBuildThreads();
+        memo_cache.ForEach([](uint64_t key, MemoEntry& entry)
+        {
+            delete entry.pristine_arena;
+            delete entry.layout_arena;
+        });
+        template_cache.ForEach([](uint64_t key, TemplateEntry& entry)
+        {
+            delete entry.pristine_arena;
+        });
+        intern_pool.ForEach([](uint64_t key, InternEntry& entry)
+        {
+            delete[] entry.data;
+        });
+    }
     uint32_t Context::GetElementCount() const
     {
         return element_count;
     }
+    StyleHandle Context::RegisterStyle(const BoxStyle& style)
+    {
+        //A different style under the same hash moves on to the next key
+        Internal::Map<StyleSheet>& registry = (owner? owner: this)->style_registry;
+        StyleHandle handle;
+        handle.key = HashStyle(style);
+        StyleSheet* sheet = registry.GetValue(handle.key);
+        while(sheet && !IsSameStyle(sheet->style, style))
+        {
+            handle.key = HashCombine(handle.key, 1);
+            handle.key = handle.key? handle.key: 1;
+            sheet = registry.GetValue(handle.key);
+        }
+        if(sheet)
+            return handle;
+        if(owner) //The registry is shared by the build threads, so it is read only here
+        {
+            HandleInternalError(Error{Error::Type::INVALID_STYLE_HANDLE, "RegisterStyle() of a new style inside ParallelFor()"});
+            return StyleHandle();
+        }
+        BoxCore core = ComputeStyleSheet(style, BoxCore());
+        if(HandleInternalError(CheckUnitErrors(core)))
+            return StyleHandle();
+        sheet = style_registry.Insert(handle.key, StyleSheet{style, core});
+        assert(sheet && "Style registry failed to insert");
+        return handle;
+    }
+    bool Context::IsStyleRegistered(StyleHandle handle)
+    {
+        return handle.IsValid() && (owner? owner: this)->style_registry.GetValue(handle.key);
+    }
     bool Context::HasInternalError()
     {
         return internal_error.type != Error::Type::NO_ERROR;
@@ -617,6 +829,8 @@ namespace UI
     }
     BoxInfo Context::Info(uint64_t key)
     {
+        if(owner)
+            return owner->Info(key);
         #if UI_ENABLE_DEBUG
             if(is_debug_mode && inspector)
             {
@@ -624,18 +838,24 @@ namespace UI
             }
         #endif
 
-        BoxInfo* info = double_buffer_map.FrontValue(key);
+        const BoxInfo* info = double_buffer_map.FrontValue(key);
         if(info)
         {
             //TODO
+            BoxInfo result = *info; //Copied, build threads read the map at the same time
             if(directly_hovered_element_key == info->GetKey())
-                info->is_direct_hover = true;
-            return *info;
+                result.is_direct_hover = true;
+            return result;
         }
         return BoxInfo();
     }
     void Context::SetStates(uint64_t key, const BoxState& state)
     {
+        if(owner)
+        {
+            owner->SetStates(key, state);
+            return;
+        }
         #if UI_ENABLE_DEBUG
         if(is_debug_mode && inspector)
         {
@@ -661,7 +881,10 @@ namespace UI
         arena1.Rewind(tree_core);
 
         stack.Clear();
+        memo_stack.Clear();
+        memo_roots.Clear();
         deferred_elements.Clear();
+        layout_callbacks.Clear();
         tree_core = nullptr;
         element_count = 0;
         directly_hovered_element_key = 0;
@@ -675,13 +898,33 @@ namespace UI
     void Context::ResetAtBeginRoot()
     {
         double_buffer_map.SwapBuffer();
-        arena1.Rewind(tree_core);
+        arena1.RewindFrame(tree_core);
         arena3.Reset();
+        frame_alloc_bytes = 0;
 
         stack.Clear();
+        memo_stack.Clear();
+        memo_roots.Clear();
         deferred_elements.Clear();
+        layout_callbacks.Clear();
         tree_core = nullptr;
         element_count = 0;
+
+        for(uint32_t i = 0; fragments && i <= build_thread_count; i++)
+        {
+            Context* fragment = fragments[i];
+            fragment->arena1.Reset();
+            fragment->arena3.Reset();
+            fragment->stack.Clear();
+            fragment->memo_stack.Clear();
+        }
+
+        frame_index++;
+        if(frame_index % 64 == 0)
+            EvictMemoEntries();
+        //Texts that change every frame leave a candidate each, so they are dropped sooner
+        if(frame_index % 64 == 0 || intern_candidate_count > INTERN_MAX_CANDIDATES)
+            EvictInternedStrings();
     }
 
     void Context::ResetArena1()
@@ -698,6 +941,16 @@ namespace UI
     }
     void Context::BeginRoot(BoxStyle style, DebugInfo debug_info)
     {
+        if(capture)
+            capture_root_style = style;
+        if(!is_input_set)
+            input = InputSnapshot::Capture();
+        is_input_set = false;
+        has_input_events = input.HasEvents(previous_input);
+        previous_input = input;
+        time += input.frame_time;
+        is_animating = false;
+
         //Adjusting the root style based on margin and padding.
         //This is most likely the desired outcome
         style.width = {style.width.value - style.padding.right - style.padding.left - style.margin.right - style.margin.left, Unit::PIXEL};
@@ -708,7 +961,7 @@ namespace UI
         style.max_width.unit = Unit::PIXEL;
 
         #if UI_ENABLE_DEBUG
-            if(inspector && IsKeyPressed(activate_key))
+            if(inspector && input.IsKeyPressed(activate_key))
             {
                 is_debug_mode = !is_debug_mode;
                 if(is_debug_mode)
@@ -787,7 +1040,8 @@ namespace UI
             tree_core = arena1.New<TreeNode<BoxCore>>();
             assert(tree_core && "Arena out of space");
             tree_core->box = root_box;
-            stack.Push(tree_core);
+            bool pushed = stack.Push(tree_core, &arena1);
+            assert(pushed && "Arena out of space");
 
             prev_inserted_box = &tree_core->box;
         }
@@ -828,9 +1082,16 @@ namespace UI
 
         if(HasInternalError())
             return;
+        if(!memo_stack.IsEmpty())
+        {
+            HandleInternalError(Error{Error::Type::MISSING_END, "Missing EndMemo() or EndInstance()"});
+            return;
+        }
         if(stack.Size() == 1)
         {
             stack.Pop();
+            if(capture)
+                capture->WriteFrame(input, capture_root_style, tree_core);
         }
         else if(stack.Size() < 1)
         {
@@ -883,60 +1144,165 @@ namespace UI
 
         if(HasInternalError())
             return;
-        element_count++;
+        if(stack.IsEmpty())
+        {
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"});
+            return;
+        }
+        BoxCore box = ComputeStyleSheet(style, tree_core->box);
+        if(HandleInternalError(CheckUnitErrors(box)))
+            return;
+        BeginBoxCore(box, id);
+    }
 
-        //============ Persistent states =============
-        uint64_t id_key = 0;
-        if(!id.IsEmpty())
+    void Context::BeginBox(const CompiledStyle& style, const StyleOverride& style_override, const StringAsci& id, DebugInfo debug_info)
+    {
+        #if UI_ENABLE_DEBUG
+        if(is_debug_mode && inspector)
         {
-            id_key = Hash(id);
-            BoxInfo* current_info = double_buffer_map.FrontValue(id_key);
-            //Handling persistent state animation variables
-            if(current_info)
+            if(copy_tree)
             {
-                BoxState& s = current_info->state;
-                if(current_info->IsHover())
-                {
-                    s.hover_anim += GetFrameTime();
-                }
-                else
-                    s.hover_anim -= GetFrameTime();
-
-                if(current_info->IsRendered())
-                    s.appear_anim += GetFrameTime();
-                else
-                    s.appear_anim = 0;
-                s.hover_anim = Clamp(s.hover_anim, 0.0f, 1.0f);
-                s.appear_anim = Clamp(s.appear_anim, 0.0f, 1.0f);
+                BoxDebug box;
+                box.style = style.style;
+                ApplyStyleOverride(box.style, style_override);
+                box.debug_info = debug_info;
+                box.id = id;
+                inspector->Push(box);
+            }
+            else
+            {
+                return;
             }
         }
-        // ============================================
+        #endif
 
-        if(!stack.IsEmpty())  // should add to parent
+        if(HasInternalError())
+            return;
+        if(stack.IsEmpty())
+        {
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"});
+            return;
+        }
+        if(style.error != Error::Type::NO_ERROR) //Only possible when CompileStyle() ran at runtime
+        {
+            HandleInternalError(CheckUnitErrors(style.core));
+            return;
+        }
+        if(!style_override.flags)
         {
-            TreeNode<BoxCore>* parent_node = stack.Peek();
-            assert(parent_node);
-            assert(tree_core);
+            //Units were already validated by CompileStyle()
+            BeginBoxCore(style.core, id);
+            return;
+        }
+        BoxCore box = style.core;
+        ApplyStyleOverride(box, style_override);
+        if(HandleInternalError(CheckUnitErrors(box)))
+            return;
+        BeginBoxCore(box, id);
+    }
 
-            TreeNode<BoxCore> child_node;
-            child_node.box = ComputeStyleSheet(style, tree_core->box);
-            child_node.box.id_key = id_key;
+    void Context::BeginBox(StyleHandle handle, const StyleOverride& style_override, const StringAsci& id, DebugInfo debug_info)
+    {
+        const StyleSheet* sheet = (owner? owner: this)->style_registry.GetValue(handle.key);
+        assert(sheet && "Style was not registered with this context");
 
-            //Might bundle this with macro
-            if(HandleInternalError(CheckUnitErrors(child_node.box)))
+        #if UI_ENABLE_DEBUG
+        if(is_debug_mode && inspector)
+        {
+            if(copy_tree)
+            {
+                BoxDebug box;
+                box.style = sheet? sheet->style: BoxStyle();
+                ApplyStyleOverride(box.style, style_override);
+                box.debug_info = debug_info;
+                box.id = id;
+                inspector->Push(box);
+            }
+            else
+            {
                 return;
+            }
+        }
+        #endif
 
-            TreeNode<BoxCore>* child_ptr = parent_node->children.Add(child_node, &arena1);
-            assert(child_ptr && "Arena out of memory");
-            stack.Push(child_ptr);
-
-            prev_inserted_box = &child_ptr->box;
+        if(HasInternalError())
+            return;
+        if(!sheet)
+        {
+            HandleInternalError(Error{Error::Type::INVALID_STYLE_HANDLE, "BeginBox() with an unregistered StyleHandle"});
+            return;
         }
-        else
+        if(stack.IsEmpty())
         {
-            if(HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"}))
-                return;
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"});
+            return;
+        }
+        if(!style_override.flags)
+        {
+            //Units were already validated by RegisterStyle()
+            BeginBoxCore(sheet->core, id);
+            return;
+        }
+        BoxCore box = sheet->core;
+        ApplyStyleOverride(box, style_override);
+        if(HandleInternalError(CheckUnitErrors(box)))
+            return;
+        BeginBoxCore(box, id);
+    }
+
+    void Context::BeginBoxCore(const BoxCore& box, const StringAsci& id)
+    {
+        BeginBoxCore(box, id.IsEmpty()? 0: Hash(id));
+    }
+    void Context::BeginBoxCore(const BoxCore& box, uint64_t id_key)
+    {
+        element_count++;
+
+        //============ Persistent states =============
+        if(id_key)
+            UpdateBoxState(id_key);
+        // ============================================
+
+        TreeNode<BoxCore>* parent_node = stack.Peek();
+        assert(parent_node);
+        assert(tree_core);
+
+        TreeNode<BoxCore> child_node;
+        child_node.box = box;
+        child_node.box.id_key = id_key;
+
+        TreeNode<BoxCore>* child_ptr = parent_node->children.Add(child_node, &arena1);
+        assert(child_ptr && "Arena out of memory");
+        bool pushed = stack.Push(child_ptr, &arena1);
+        assert(pushed && "Arena out of memory");
+
+        prev_inserted_box = &child_ptr->box;
+    }
+
+    void Context::UpdateBoxState(uint64_t id_key)
+    {
+        //Fragments write the state of their own boxes in the owner's map
+        float frame_time = GetInput().frame_time;
+        BoxInfo* current_info = (owner? owner: this)->double_buffer_map.FrontValue(id_key);
+        //Handling persistent state animation variables
+        if(!current_info)
+            return;
+        BoxState& s = current_info->state;
+        if(current_info->IsHover())
+        {
+            s.hover_anim += frame_time;
         }
+        else
+            s.hover_anim -= frame_time;
+
+        if(current_info->IsRendered())
+            s.appear_anim += frame_time;
+        else
+            s.appear_anim = 0;
+        s.hover_anim = Clamp(s.hover_anim, 0.0f, 1.0f);
+        s.appear_anim = Clamp(s.appear_anim, 0.0f, 1.0f);
+        if(s.hover_anim != (current_info->IsHover()? 1.0f: 0.0f) || (current_info->IsRendered() && s.appear_anim < 1.0f))
+            is_animating = true;
     }
 
     void Context::EndBox()
@@ -1051,11 +1417,8 @@ namespace UI
         }
         assert(prev_inserted_box && "Should not be null");
         const char32_t* str_data = string.data;
-        if(copy_text)
-        {
-            str_data = arena3.NewArrayCopy(string.data, string.Size());
-            assert(str_data && "string arena out of memeory");
-        }
+        if(copy_text && !arena3.Contains(string.data)) //FrameString() texts already live long enough
+            str_data = InternString(string);
         TextSpan* span = prev_inserted_box->text_style_spans.Add(TextSpan{StringU32(str_data, string.Size()), style}, &arena1);
         assert(span && "Arena1 out of memory");
         return;
@@ -1081,1365 +1444,3729 @@ namespace UI
         prev_inserted_box = nullptr;
     }
 
-
-    // IMPORTANT, This is the heart of computing the text layout
-    inline void Context::ComputeTextLinesAndHeight(BoxCore& box)
+    /*
+        A memo is recorded by letting func build its boxes normally and copying them (with their strings)
+        into the entry's own arena once EndMemo() is reached. Later frames with the same deps_hash and root
+        size splice that copy into the tree instead of calling func.
+        When the memo built a single box whose size does not depend on its content, the children of that box
+        are also saved after layout at the end of Draw(), and reused as long as the box keeps the same size.
+    */
+    bool Context::BeginMemo(const StringAsci& id, uint64_t deps_hash)
     {
-        using Iterator = TextSpans::Iterator;
-        struct Int2 { int x = 0, y = 0; };
-        auto AddTextLine = [&](const TextSpan& span, Int2 pos, int width)
+        #if UI_ENABLE_DEBUG
+            if(is_debug_mode && inspector)
+                return true; //The inspector needs to see every box
+        #endif
+
+        if(HasInternalError())
+            return false;
+        if(stack.IsEmpty())
         {
-            TextLine line = {span, pos.x, pos.y, width};
-            TextLine* new_line = box.result_text_lines.Add(line, &arena2);
-            assert(new_line && "Arena2 out of memory");
-        };
-        int max_width = box.width;
-        int word_width = 0;
-        int span_width = 0;
-        Int2 pos;
-        Int2 cursor;
-        Iterator start = box.text_style_spans.Begin();
-        Iterator end = box.text_style_spans.Begin();
-        Iterator space{}; //Marks down the last white space hit
-
-        //passing the width of the text line
-        auto WrapIfPossible = [&](int cursor_x, int width) ->bool
-        {
-            if(cursor_x > max_width && space.IsValid())
-            {
-                AddTextLine(TextSpans::GetTextSpan(start, space), pos, width);
-                cursor.x = 0;
-                cursor.y += start.GetStyle().GetFontSize() + start.GetStyle().GetLineSpacing();
-                pos = cursor;
-                end = space; //This gets incremented at the end anyway
-                start = space.Next();
-                space = Iterator{};
-                return true;
-            }
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"});
             return false;
-        };
-
-        while(end.IsValid())
+        }
+        assert(!id.IsEmpty() && "Memo needs an id");
+
+        TreeNode<BoxCore>* parent = stack.Peek();
+        MemoFrame frame;
+        frame.key = id.IsEmpty()? 0: Hash(id);
+        frame.deps_hash = deps_hash;
+        frame.parent = parent;
+        frame.prev_tail = parent->children.GetTail();
+        frame.depth = stack.Size();
+        prev_inserted_box = nullptr; //Text must not be appended to a node outside of the memo
+
+        MemoEntry* entry = nullptr;
+        if(IsCacheBypassed()) //The cache belongs to the owner, recordings need plain boxes
+            frame.key = 0;
+        if(frame.key)
         {
-
-            int char_width = MeasureChar_impl(end.GetChar(), end.GetStyle());
-            span_width = cursor.x - pos.x;
-            cursor.x += char_width;
-            word_width += char_width;
-
-            if(end.GetChar() == U' ')
-            {
-                space = end;
-                word_width = 0;
-            }
-            if(end.GetChar() == U'\n')
-            {
-                AddTextLine(TextSpans::GetTextSpan(start, end), pos, span_width);
-                cursor.x = 0;
-                auto next = end.Next();
-                cursor.y += end.GetStyle().GetFontSize() + end.GetStyle().GetLineSpacing();
-                pos = cursor;
-                start = end.Next();
-                space = Iterator{};
-            }
-            else if(start.node != end.node) //Styles are different
+            entry = memo_cache.GetValue(frame.key);
+            if(!entry)
             {
-                auto it = end.Next();
-                int cursor_x = cursor.x;
-                int word = word_width;
-                int span = span_width;
-                bool did_wrap = false;
-                while(it.IsValid()) //Test if it needs to wrap
-                {
-                    int char_width = MeasureChar_impl(it.GetChar(), it.GetStyle());
-                    span = cursor_x - pos.x;
-                    cursor_x += char_width;
-                    word += char_width;
-                    if(WrapIfPossible(cursor_x, span - word))
-                    {
-                        did_wrap = true;
-                        break;
-                    }
-                    if(it.GetChar() == U' ') //if it doest wrap by now, then we can exit
-                        break;
-                    it = it.Next();
-                }
-                if(!did_wrap)
-                {
-                    AddTextLine(TextSpans::GetTextSpan(start, Iterator{}), pos, span_width);
-                    pos.x = cursor.x - char_width;
-                    pos.y = cursor.y;
-                    start = end;
-                    space = Iterator{};
-                }
+                entry = memo_cache.Insert(frame.key, MemoEntry());
+                assert(entry && "Memo cache failed to insert");
             }
-            else
+            else if(entry->last_frame == frame_index)
             {
-                WrapIfPossible(cursor.x, span_width - word_width);
+                assert(0 && "Memo id used twice in the same frame");
+                frame.key = 0;
+                entry = nullptr;
             }
-            end = end.Next();
         }
-
-        if(start.IsValid())
+        if(!entry) //Bypassed, func just runs every frame
         {
-            cursor.y += start.GetStyle().GetFontSize();
-            span_width = cursor.x - pos.x;
-            AddTextLine(TextSpans::GetTextSpan(start, Iterator{}), pos, span_width);
+            bool pushed = memo_stack.Push(frame, &arena1);
+            assert(pushed && "Arena out of memory");
+            return true;
         }
+        entry->last_frame = frame_index;
+
+        const BoxCore& root_box = tree_core->box;
+        bool is_hit = entry->pristine &&
+            entry->deps_hash == deps_hash &&
+            entry->root_width == root_box.width &&
+            entry->root_height == root_box.height;
+        bool is_outermost = memo_stack.IsEmpty();
+        frame.is_recording = !is_hit;
+        bool pushed = memo_stack.Push(frame, &arena1);
+        assert(pushed && "Arena out of memory");
+        if(!is_hit)
+            return true;
 
-        box.height += cursor.y;
+        //Splicing the recorded boxes
+        bool can_cache_layout = entry->is_layout_cacheable && is_outermost && layout_pipeline == LayoutPipeline::FUSED;
+        ArenaLL<TreeNode<BoxCore>>::Node* first = entry->pristine->children.GetHead();
+        if(can_cache_layout && entry->layout)
+        {
+            assert(first && !first->next);
+            TreeNode<BoxCore>* node = CopyNode(&first->value, &parent->children, &arena1, UPDATE_STATES);
+            UpdateMemoLayoutStates(*entry, nullptr);
+            memo_roots.Push(MemoRoot{node, frame.key, nullptr, true});
+            node->box.memo_root = memo_roots.Size();
+        }
+        else if(first)
+        {
+            CopyNodes(first, &parent->children, &arena1, UPDATE_STATES);
+            if(can_cache_layout)
+            {
+                TreeNode<BoxCore>* node = &parent->children.GetTail()->value;
+                memo_roots.Push(MemoRoot{node, frame.key, nullptr, false});
+                node->box.memo_root = memo_roots.Size();
+            }
+        }
+        return false;
     }
-
-
-    void Context::Draw()
+    void Context::EndMemo()
     {
         #if UI_ENABLE_DEBUG
             if(is_debug_mode && inspector)
-            {
                 return;
-            }
-        // if(inspector && enabled)
-        // {
-        //     if(!copy_tree)
-        //         return;
-        //     else
-        //         copy_tree = false; //Finish copying tree
-        // }
         #endif
 
-
-
-        if(HasInternalError())
+        MemoFrame frame;
+        if(!PopMemoFrame(frame, false) || !frame.is_recording)
             return;
-        assert(tree_core && "No RootNode Provided");
 
-        if(!stack.IsEmpty())
+        MemoEntry* entry = memo_cache.GetValue(frame.key);
+        assert(entry);
+        ArenaLL<TreeNode<BoxCore>>::Node* first = frame.prev_tail? frame.prev_tail->next: frame.parent->children.GetHead();
+
+        uint64_t bytes = sizeof(TreeNode<BoxCore>) + alignof(TreeNode<BoxCore>) + MeasureNodes(first, COPY_SPANS);
+        ReserveArena(entry->pristine_arena, bytes);
+        entry->pristine = entry->pristine_arena->New<TreeNode<BoxCore>>();
+        assert(entry->pristine && "Memo arena out of memory");
+        CopyNodes(first, &entry->pristine->children, entry->pristine_arena, COPY_SPANS);
+
+        entry->deps_hash = frame.deps_hash;
+        entry->root_width = tree_core->box.width;
+        entry->root_height = tree_core->box.height;
+        entry->layout = nullptr;
+        entry->is_layout_cacheable = first && !first->next && IsMemoLayoutCacheable(first->value.box);
+        if(entry->is_layout_cacheable && memo_stack.IsEmpty() && layout_pipeline == LayoutPipeline::FUSED)
         {
-            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing EndRoot()"});
-            return;
+            memo_roots.Push(MemoRoot{&first->value, frame.key, nullptr, false});
+            first->value.box.memo_root = memo_roots.Size();
         }
+    }
+    bool Context::PopMemoFrame(MemoFrame& frame, bool is_instance)
+    {
+        if(HasInternalError())
+            return false;
+        if(memo_stack.IsEmpty())
+        {
+            if(is_instance)
+                HandleInternalError(Error{Error::Type::MISSING_BEGIN, "Missing BeginInstance()"});
+            else
+                HandleInternalError(Error{Error::Type::MISSING_BEGIN, "Missing BeginMemo()"});
+            return false;
+        }
+        frame = memo_stack.Peek();
+        memo_stack.Pop();
+        if((frame.args != nullptr) != is_instance)
+        {
+            if(is_instance)
+                HandleInternalError(Error{Error::Type::MISSING_END, "Missing EndMemo()"});
+            else
+                HandleInternalError(Error{Error::Type::MISSING_END, "Missing EndInstance()"});
+            return false;
+        }
+        if(stack.Size() != frame.depth || stack.Peek() != frame.parent)
+        {
+            HandleInternalError(Error{Error::Type::MISSING_END, "Unbalanced BeginBox()/EndBox() inside a memo or instance"});
+            return false;
+        }
+        prev_inserted_box = nullptr;
+        return true;
+    }
 
+    /*
+        Instances copy the boxes recorded from the template shape and fill their slots.
+        Like memos, an instance made of a single box that is not sized by its content is a memo root,
+        its layout is saved under InstanceLayoutKey() and shared by every instance with the same key.
+        Once saved, an instance only adds its root to the tree. Drawing walks the shared layout and
+        swaps in the instance's copies of the slot boxes, which ResolveMemoLayout() fills and wraps.
+        The shared layout is dropped for an instance whose text slots change height.
+    */
+    bool Context::BeginInstance(const StringAsci& template_id, const InstanceArgs& args)
+    {
+        #if UI_ENABLE_DEBUG
+            if(is_debug_mode && inspector)
+                return true; //The inspector needs to see every box
+        #endif
 
-        //Layout pipeline
-        float time = 0;
-        StopWatch s;
-        ResetArena2();
-
-        s.Start();
-        WidthContentPercentPass(tree_core);
-        //std::cout<<"WidthContent:"<< s.Stop()<<'\n';
-
-        s.Start();
-        WidthPass(tree_core);
-        //std::cout<<"WidthPass:"<< s.Stop()<<'\n';
-
-        s.Start();
-        HeightContentPercentPass(tree_core);
-        //std::cout<<"HeightContent:"<< s.Stop()<<'\n';
+        if(HasInternalError())
+            return false;
+        if(stack.IsEmpty())
+        {
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"});
+            return false;
+        }
+        assert(!template_id.IsEmpty() && "Template needs an id");
 
-        s.Start();
-        HeightPass(tree_core);
-        //std::cout<<"HeightPass:"<< s.Stop()<<'\n';
+        //The args must live until Draw(), texts are copied like InsertText() does
+        InstanceArgs* stored_args = arena1.New<InstanceArgs>(args);
+        assert(stored_args && "Arena out of memory");
+        for(uint8_t i = 0; i < InstanceArgs::MAX_SLOTS; i++)
+        {
+            if(!(args.text_flags & (1 << i)))
+                continue;
+            stored_args->texts[i] = StringU32(InternString(args.texts[i]), args.texts[i].Size());
+        }
 
-        s.Start();
-        PositionPass(tree_core, 0, 0, BoxCore());
-        //std::cout<<"PositionPass:"<< s.Stop()<<'\n';
+        TreeNode<BoxCore>* parent = stack.Peek();
+        MemoFrame frame;
+        frame.key = Hash(template_id);
+        frame.parent = parent;
+        frame.prev_tail = parent->children.GetTail();
+        frame.args = stored_args;
+        frame.depth = stack.Size();
+        prev_inserted_box = nullptr;
+        if(IsCacheBypassed()) //Built every time and filled by EndInstance()
+        {
+            frame.is_recording = true;
+            bool pushed = memo_stack.Push(frame, &arena1);
+            assert(pushed && "Arena out of memory");
+            return true;
+        }
 
-        s.Start();
-        GenerateComputedTree();
-        //std::cout<<"GenerateTree:"<< s.Stop()<<'\n';
-        s.Start();
+        TemplateEntry* entry = template_cache.GetValue(frame.key);
+        if(!entry)
+        {
+            entry = template_cache.Insert(frame.key, TemplateEntry());
+            assert(entry && "Template cache failed to insert");
+        }
+        entry->last_frame = frame_index;
+
+        const BoxCore& root_box = tree_core->box;
+        bool is_hit = entry->pristine &&
+            entry->root_width == root_box.width &&
+            entry->root_height == root_box.height;
+        bool is_outermost = memo_stack.IsEmpty();
+        frame.is_recording = !is_hit;
+        bool pushed = memo_stack.Push(frame, &arena1);
+        assert(pushed && "Arena out of memory");
+        if(!is_hit)
+            return true;
 
-        directly_hovered_element_key = 0; //Reset the directly hovered element
-        //TODO - add all floating elements to a queue
+        ArenaLL<TreeNode<BoxCore>>::Node* first = entry->pristine->children.GetHead();
+        if(!first)
+            return false;
+        if(!entry->is_layout_cacheable || !is_outermost || layout_pipeline != LayoutPipeline::FUSED)
+        {
+            CopyNodes(first, &parent->children, &arena1, UPDATE_STATES, stored_args);
+            return false;
+        }
 
-        //This is most likely temporary because of performance, but I would like to keep developing
-        DetachedBoxesPass(tree_result, 0, 0);
-        //std::cout<<"Detach:"<< s.Stop()<<'\n';
-        DrawPass(tree_result, 0, 0, {0, 0, GetScreenWidth(), GetScreenHeight()});
-        while(!deferred_elements.IsEmpty())
+        uint64_t layout_key = InstanceLayoutKey(frame.key, *stored_args);
+        MemoEntry* layout = memo_cache.GetValue(layout_key);
+        if(!layout)
         {
-            const DeferredBox& box = deferred_elements.GetHead()->value;
-            DrawPass(box.node, box.x, box.y, {0, 0, GetScreenWidth(), GetScreenHeight()});
-            deferred_elements.PopHead();
+            layout = memo_cache.Insert(layout_key, MemoEntry());
+            assert(layout && "Memo cache failed to insert");
         }
-        //std::cout<<"Draw: " << s.Stop()<<"\n\n";
+        layout->last_frame = frame_index;
+        layout->pristine = entry->pristine;
+        TreeNode<BoxCore>* node = nullptr;
+        if(layout->layout)
+        {
+            node = CopyNode(&first->value, &parent->children, &arena1, UPDATE_STATES, stored_args);
+            UpdateMemoLayoutStates(*layout, stored_args);
+        }
+        else
+        {
+            CopyNodes(first, &parent->children, &arena1, UPDATE_STATES, stored_args);
+            node = &parent->children.GetTail()->value;
+        }
+        memo_roots.Push(MemoRoot{node, layout_key, stored_args, layout->layout != nullptr});
+        node->box.memo_root = memo_roots.Size();
+        return false;
     }
+    void Context::EndInstance()
+    {
+        #if UI_ENABLE_DEBUG
+            if(is_debug_mode && inspector)
+                return;
+        #endif
 
+        MemoFrame frame;
+        if(!PopMemoFrame(frame, true) || !frame.is_recording)
+            return;
 
-    void Context::WidthContentPercentPass_Flow(TreeNode<BoxCore>* node)
+        ArenaLL<TreeNode<BoxCore>>::Node* first = frame.prev_tail? frame.prev_tail->next: frame.parent->children.GetHead();
+        if(IsCacheBypassed())
+        {
+            FillInstanceSlots(first, *frame.args, nullptr);
+            return;
+        }
+        TemplateEntry* entry = template_cache.GetValue(frame.key);
+        assert(entry);
+
+        uint64_t bytes = sizeof(TreeNode<BoxCore>) + alignof(TreeNode<BoxCore>) + MeasureNodes(first, COPY_SPANS);
+        ReserveArena(entry->pristine_arena, bytes);
+        entry->pristine = entry->pristine_arena->New<TreeNode<BoxCore>>();
+        assert(entry->pristine && "Template arena out of memory");
+        CopyNodes(first, &entry->pristine->children, entry->pristine_arena, COPY_SPANS);
+        entry->root_width = tree_core->box.width;
+        entry->root_height = tree_core->box.height;
+        entry->is_layout_cacheable = first && !first->next && IsMemoLayoutCacheable(first->value.box);
+
+        //Filling the slots of the boxes that were just built, they are this call's instance
+        FillInstanceSlots(first, *frame.args, entry);
+
+        if(entry->is_layout_cacheable && memo_stack.IsEmpty() && layout_pipeline == LayoutPipeline::FUSED)
+        {
+            uint64_t layout_key = InstanceLayoutKey(frame.key, *frame.args);
+            MemoEntry* layout = memo_cache.GetValue(layout_key);
+            if(!layout)
+            {
+                layout = memo_cache.Insert(layout_key, MemoEntry());
+                assert(layout && "Memo cache failed to insert");
+            }
+            layout->last_frame = frame_index;
+            layout->pristine = entry->pristine;
+            layout->layout = nullptr; //Saved for the old shape
+            memo_roots.Push(MemoRoot{&first->value, layout_key, frame.args, false});
+            first->value.box.memo_root = memo_roots.Size();
+        }
+    }
+    void Context::FillInstanceSlots(ArenaLL<TreeNode<BoxCore>>::Node* first, const InstanceArgs& args, TemplateEntry* entry)
     {
-        assert(node);
-        BoxCore& parent_box = node->box;
-        int content_width = 0;
-        if(parent_box.GetFlowAxis() == Flow::Axis::HORIZONTAL)
+        if(entry)
+            entry->text_slots = 0;
+        assert(copy_frames.IsEmpty());
+        copy_frames.Push(CopyFrame{first, nullptr});
+        while(!copy_frames.IsEmpty())
         {
-            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+            CopyFrame& copy_frame = copy_frames.Back();
+            if(!copy_frame.next)
             {
-                WidthContentPercentPass(&temp->value);
-                BoxCore& box = temp->value.box;
-                if(box.IsDetached()) //later add check for parent being content_percent
-                    continue;
+                copy_frames.Pop();
+                continue;
+            }
+            TreeNode<BoxCore>* node = &copy_frame.next->value;
+            copy_frame.next = copy_frame.next->next;
+            BoxCore& box = node->box;
+            if(entry && box.slot && box.IsTextElement())
+            {
+                assert(!(entry->text_slots & (1 << (box.slot - 1))) && "Text slot used twice in a template");
+                entry->text_slots |= 1 << (box.slot - 1);
+                entry->slot_styles[box.slot - 1] = box.text_style_spans.GetHead()->value.style;
+            }
+            uint64_t id_key = box.id_key;
+            ApplyInstanceArgs(box, args, &arena1);
+            if(box.id_key && box.id_key != id_key)
+                UpdateBoxState(box.id_key);
+            if(!node->children.IsEmpty())
+                copy_frames.Push(CopyFrame{node->children.GetHead(), nullptr});
+        }
+    }
+    void Context::SetSlot(uint8_t index)
+    {
+        #if UI_ENABLE_DEBUG
+            if(is_debug_mode && inspector)
+                return;
+        #endif
+        assert(index < InstanceArgs::MAX_SLOTS);
+        if(HasInternalError() || stack.Size() <= 1)
+            return;
+        stack.Peek()->box.slot = index + 1;
+    }
+    void Context::InsertTextSlot(uint8_t index, const TextStyle& style, DebugInfo debug_info)
+    {
+        assert(index < InstanceArgs::MAX_SLOTS);
+        prev_inserted_box = nullptr; //Always its own text node
+        InsertText(style, StringU32(U" ", 1), nullptr, false, debug_info);
+        if(prev_inserted_box && !HasInternalError())
+            prev_inserted_box->slot = index + 1;
+        prev_inserted_box = nullptr;
+    }
+    void Context::ApplyInstanceArgs(BoxCore& box, const InstanceArgs& args, MemoryArena* arena)
+    {
+        if(!box.slot)
+            return;
+        uint8_t index = box.slot - 1;
+        uint8_t bit = 1 << index;
+        if(args.color_flags & bit)
+            box.background_color = args.colors[index];
+        if(args.id_flags & bit)
+            box.id_key = args.id_keys[index];
+        if(!box.IsTextElement())
+            return;
+        //Lines are always wrapped again, the ones copied from a shared layout belong to another instance.
+        //So is its text, without one the slot gets InsertTextSlot()'s placeholder back
+        box.result_text_lines = nullptr;
+        StringU32 text = (args.text_flags & bit)? args.texts[index]: StringU32(U" ", 1);
+        TextStyle style = box.text_style_spans.GetHead()->value.style;
+        box.text_style_spans.Clear();
+        TextSpan* span = box.text_style_spans.Add(TextSpan{text, style}, arena);
+        assert(span && "Arena out of memory");
+    }
+    //Instances share a layout when the template, the root size and the width of every text slot are the same
+    uint64_t Context::InstanceLayoutKey(uint64_t template_key, const InstanceArgs& args)
+    {
+        TemplateEntry* entry = template_cache.GetValue(template_key);
+        assert(entry);
+        uint64_t key = HashCombine(template_key, CastToU64(entry->root_width));
+        key = HashCombine(key, CastToU64(entry->root_height));
+        for(uint8_t i = 0; i < InstanceArgs::MAX_SLOTS; i++)
+        {
+            if(!(entry->text_slots & (1 << i)))
+                continue;
+            StringU32 text = (args.text_flags & (1 << i))? args.texts[i]: StringU32(U" ", 1);
+            key = HashCombine(key, CastToU64(MeasureText(text, entry->slot_styles[i])));
+        }
+        return key;
+    }
+    bool Context::IsCacheBypassed() const
+    {
+        return owner || capture;
+    }
+    uint64_t Context::MeasureNodes(ArenaLL<TreeNode<BoxCore>>::Node* first, uint8_t flags)
+    {
+        using SpanNode = ArenaDLL<TextSpan>::Node;
+        //Every allocation can be padded up to its alignment
+        const uint64_t node_bytes = sizeof(ArenaLL<TreeNode<BoxCore>>::Node) + alignof(ArenaLL<TreeNode<BoxCore>>::Node);
+        const uint64_t span_bytes = sizeof(SpanNode) + alignof(SpanNode) + alignof(char32_t);
+        const uint64_t run_bytes = sizeof(TextSpan) + alignof(char32_t);
+
+        uint64_t bytes = 0;
+        assert(copy_frames.IsEmpty());
+        copy_frames.Push(CopyFrame{first, nullptr});
+        while(!copy_frames.IsEmpty())
+        {
+            CopyFrame& frame = copy_frames.Back();
+            if(!frame.next)
+            {
+                copy_frames.Pop();
+                continue;
+            }
+            BoxCore& box = frame.next->value.box;
+            ArenaLL<TreeNode<BoxCore>>::Node* children = frame.next->value.children.GetHead();
+            frame.next = frame.next->next;
 
-                if(box.IsTextElement())
-                {
-                    float w = MeasureTextSpans(box);
-                    box.max_width = w;
-                    content_width += w;
-                }
-                else if(box.width_unit != Unit::Type::AVAILABLE_PERCENT &&
-                box.width_unit != Unit::Type::PARENT_PERCENT &&
-                box.max_width_unit != Unit::Type::PARENT_PERCENT &&
-                box.min_width_unit != Unit::Type::PARENT_PERCENT)
-                {
-                    box.width = Clamp(box.width, box.min_width, box.max_width);
-                    content_width += box.GetBoxModelWidth();
-                }
-                else
+            bytes += node_bytes;
+            if(flags & COPY_SPANS)
+            {
+                for(auto span = box.text_style_spans.GetHead(); span != nullptr; span = span->next)
+                    bytes += span_bytes + span->value.Size() * sizeof(char32_t);
+            }
+            if((flags & COPY_LINES) && box.result_text_lines)
+            {
+                const TextLines& text = *box.result_text_lines;
+                bytes += sizeof(TextLines) + alignof(TextLines) + alignof(TextSpan) + alignof(TextLine) + text.lines.Size() * sizeof(TextLine);
+                for(uint64_t i = 0; i < text.runs.Size(); i++)
+                    bytes += run_bytes + text.runs[i].Size() * sizeof(char32_t);
+            }
+            if(children)
+                copy_frames.Push(CopyFrame{children, nullptr});
+        }
+        return bytes;
+    }
+    TreeNode<BoxCore>* Context::CopyNode(TreeNode<BoxCore>* src, ArenaLL<TreeNode<BoxCore>>* dst, MemoryArena* arena, uint8_t flags, const InstanceArgs* args)
+    {
+        assert(src && dst && arena);
+        TreeNode<BoxCore> node;
+        node.box = src->box;
+        node.box.memo_root = 0;
+        if(flags & COPY_SPANS)
+        {
+            node.box.text_style_spans.Clear();
+            for(auto span = src->box.text_style_spans.GetHead(); span != nullptr; span = span->next)
+            {
+                TextSpan copy = span->value;
+                if(!copy.IsEmpty())
                 {
-                    content_width += box.GetBoxExpansionWidth() + box.min_width;
+                    copy.data = arena->NewArrayCopy(copy.data, copy.Size());
+                    assert(copy.data && "Memo arena out of memory");
                 }
-                content_width += parent_box.gap_column;
+                TextSpan* added = node.box.text_style_spans.Add(copy, arena);
+                assert(added && "Memo arena out of memory");
             }
-            content_width -= parent_box.gap_column;
         }
-        else
+        if((flags & COPY_LINES) && src->box.result_text_lines)
         {
-            int largest_width = 0;
-            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+            TextLines* copy = arena->New<TextLines>(*src->box.result_text_lines);
+            assert(copy && "Memo arena out of memory");
+            node.box.result_text_lines = copy;
+            TextLines& text = *copy;
+            if(!text.lines.IsEmpty())
             {
-                WidthContentPercentPass(&temp->value);
-                BoxCore& box = temp->value.box;
-                if(box.IsDetached())
+                text.lines.data = arena->NewArrayCopy(text.lines.data, text.lines.Size());
+                assert(text.lines.data && "Memo arena out of memory");
+            }
+            if(!text.runs.IsEmpty())
+            {
+                text.runs.data = arena->NewArrayCopy(text.runs.data, text.runs.Size());
+                assert(text.runs.data && "Memo arena out of memory");
+            }
+            for(uint64_t i = 0; i < text.runs.Size(); i++)
+            {
+                if(text.runs[i].IsEmpty())
                     continue;
-
-                if(box.IsTextElement())
-                {
-                    int width = MeasureTextSpans(box);
-                    if(largest_width < width)
-                        largest_width = width;
-                }
-
-                else if(box.width_unit != Unit::Type::AVAILABLE_PERCENT &&
-                box.width_unit != Unit::Type::PARENT_PERCENT &&
-                box.max_width_unit != Unit::Type::PARENT_PERCENT &&
-                box.min_width_unit != Unit::Type::PARENT_PERCENT)
-                {
-                    box.width = Clamp(box.width, box.min_width, box.max_width);
-                    int width = box.GetBoxModelWidth();
-                    if(largest_width < width)
-                        largest_width = width;
-                }
-                else
-                {
-                    int width = box.GetBoxExpansionWidth() + box.min_width;
-                    if(largest_width < width)
-                        largest_width = width;
-                }
+                text.runs[i].data = arena->NewArrayCopy(text.runs[i].data, text.runs[i].Size());
+                assert(text.runs[i].data && "Memo arena out of memory");
             }
-            content_width = largest_width;
         }
-        content_width = Max(0, content_width);
-        if(parent_box.width_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.width = content_width * parent_box.width / 100;
-        if(parent_box.min_width_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.min_width = content_width * parent_box.min_width / 100;
-        if(parent_box.max_width_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.max_width = content_width * parent_box.max_width / 100;
+        if(args)
+            ApplyInstanceArgs(node.box, *args, arena);
+        if(flags & UPDATE_STATES)
+        {
+            if(node.box.type != BoxType::TEXT)
+                element_count++;
+            if(node.box.id_key)
+                UpdateBoxState(node.box.id_key);
+        }
+        TreeNode<BoxCore>* added = dst->Add(node, arena);
+        assert(added && "Arena out of memory");
+        added->children.Clear();
+        return added;
     }
-    void Context::WidthContentPercentPass_Grid(TreeNode<BoxCore>* node)
+    void Context::CopyNodes(ArenaLL<TreeNode<BoxCore>>::Node* first, ArenaLL<TreeNode<BoxCore>>* dst, MemoryArena* arena, uint8_t flags, const InstanceArgs* args)
     {
-        assert(node);
-        BoxCore& parent_box = node->box;
-        int cell_width = 0;
-
-        //Finding the largest cell width
-        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+        assert(copy_frames.IsEmpty());
+        copy_frames.Push(CopyFrame{first, dst});
+        while(!copy_frames.IsEmpty())
         {
-            WidthContentPercentPass(&temp->value);
-            BoxCore& box = temp->value.box;
-            if(box.IsDetached())
-                return;
-            if(box.width_unit != Unit::Type::AVAILABLE_PERCENT &&
-            box.width_unit != Unit::Type::PARENT_PERCENT &&
-            box.max_width_unit != Unit::Type::PARENT_PERCENT &&
-            box.min_width_unit != Unit::Type::PARENT_PERCENT)
-            {
-                box.width = Clamp(box.width, box.min_width, box.max_width);
-                int width = box.GetBoxModelWidth() / box.grid_span_x;
-                if(cell_width < width)
-                    cell_width = width;
-            }
-            else
+            CopyFrame& frame = copy_frames.Back();
+            if(!frame.next)
             {
-                int width = box.GetBoxExpansionWidth() + box.min_width;
-                if(cell_width < width)
-                    cell_width = width;
+                copy_frames.Pop();
+                continue;
             }
+            TreeNode<BoxCore>* src = &frame.next->value;
+            frame.next = frame.next->next;
+            TreeNode<BoxCore>* copy = CopyNode(src, frame.dst, arena, flags, args);
+            if(!src->children.IsEmpty())
+                copy_frames.Push(CopyFrame{src->children.GetHead(), &copy->children});
         }
-        int total_width = cell_width * parent_box.grid_column_count + parent_box.gap_column * (parent_box.grid_column_count - 1);
-        if(parent_box.width_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.width = total_width;
-        if(parent_box.min_width_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.min_width = total_width;
-        if(parent_box.max_width_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.max_width = total_width;
     }
-    void Context::WidthContentPercentPass(TreeNode<BoxCore>* node)
+    bool Context::IsMemoLayoutCached(const BoxCore& box)
     {
-        if(!node)
-            return;
-        const BoxCore& box = node->box;
-        if(box.GetLayout() == Layout::FLOW)
-        {
-            WidthContentPercentPass_Flow(node);
-        }
-        else
-        {
-            WidthContentPercentPass_Grid(node);
-        }
+        return box.memo_root && memo_roots[box.memo_root - 1].is_layout_cached;
     }
-    void Context::WidthPass(TreeNode<BoxCore>* node)
+    bool Context::ResolveMemoLayout(TreeNode<BoxCore>* node)
     {
-        if(node == nullptr)
-            return;
-
+        assert(node && node->box.memo_root);
+        MemoRoot& memo = memo_roots[node->box.memo_root - 1];
+        if(!memo.is_layout_cached)
+            return false;
+        MemoEntry* entry = memo_cache.GetValue(memo.key);
+        assert(entry && entry->layout && entry->pristine);
         BoxCore& box = node->box;
-        //Might aswell compute this here since width is all calculated
-        ComputeWidthPercentForHeight(box);
-
-        if(node->children.IsEmpty())
-            return;
-        if(box.GetLayout() == Layout::FLOW)
+        bool is_cached = entry->layout_width == box.width && entry->layout_height == box.height;
+        if(is_cached && memo.args && entry->layout_box_count)
         {
-            WidthPass_Flow(node->children.GetHead(), box);
+            //Only the boxes with a slot differ between instances, the text slots are wrapped again
+            //and the layout is only shared if they keep the same height
+            memo.boxes = arena2.NewArray<BoxCore>(entry->layout_box_count);
+            assert(memo.boxes && "Arena2 out of memory");
+            for(uint32_t i = 0; i < entry->layout_box_count && is_cached; i++)
+            {
+                BoxCore& slot_box = memo.boxes[i];
+                slot_box = entry->layout_boxes[i].node->box;
+                ApplyInstanceArgs(slot_box, *memo.args, &arena2);
+                if(!slot_box.slot || !slot_box.IsTextElement())
+                    continue;
+                uint16_t height = slot_box.height;
+                slot_box.height = 0;
+                ComputeTextLinesAndHeight(slot_box);
+                is_cached = slot_box.height == height;
+            }
         }
-        else
+        if(is_cached)
         {
-            WidthPass_Grid(node->children.GetHead(), box);
+            box.result_content_width = entry->layout_content_width;
+            box.result_content_height = entry->layout_content_height;
+            memo.entry = entry;
+            return true;
         }
-    }
 
-    void Context::WidthPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box)
+        //Resized, the children are laid out again from the recorded boxes.
+        //arena2 is used since arena1 still holds the stacks of the running pass
+        memo.is_layout_cached = false;
+        memo.boxes = nullptr;
+        ArenaLL<TreeNode<BoxCore>>::Node* first = entry->pristine->children.GetHead();
+        assert(first && !first->next);
+        node->children.Clear();
+        CopyNodes(first->value.children.GetHead(), &node->children, &arena2, COPY_SHALLOW, memo.args);
+        WidthContentPercentPass(node);
+        WidthAndHeightContentPass(node);
+        return false;
+    }
+    //Saves the children of memo roots after layout, needs the final text lines so it runs at the end of Draw()
+    void Context::SaveMemoLayouts()
     {
-        assert(child);
-        ArenaLL<TreeNode<BoxCore>>::Node* temp;
-
-        struct GrowBox {
-            BoxCore* box = nullptr;
-            float result = 0;
-        };
-        ArenaLL<GrowBox> growing_elements;
-
-        if(parent_box.GetFlowAxis() == Flow::Axis::HORIZONTAL)
+        for(uint32_t i = 0; i < memo_roots.Size(); i++)
         {
-            float available_width = parent_box.width;
-            float total_percent = 0;
-            for(temp = child; temp != nullptr; temp = temp->next)
+            const MemoRoot& memo = memo_roots[i];
+            if(memo.is_layout_cached)
+                continue;
+            MemoEntry* entry = memo_cache.GetValue(memo.key);
+            assert(entry);
+            BoxCore& box = memo.node->box;
+            //Instances sharing the key, or one whose text slots wrapped to another height than the saved layout
+            if(entry->layout && (entry->layout_frame == frame_index ||
+                (entry->layout_width == box.width && entry->layout_height == box.height)))
+                continue;
+            ArenaLL<TreeNode<BoxCore>>::Node* first = memo.node->children.GetHead();
+            const uint8_t flags = COPY_SPANS | COPY_LINES;
+
+            //Counting the boxes that IndexMemoLayout() records
+            uint32_t box_count = 0;
+            assert(copy_frames.IsEmpty());
+            copy_frames.Push(CopyFrame{first, nullptr});
+            while(!copy_frames.IsEmpty())
             {
-                BoxCore& box = temp->value.box;
-                ComputeParentWidthPercent(box, parent_box.width);
-
-                if(box.width_unit != Unit::Type::AVAILABLE_PERCENT)
-                {
-                    box.width = Clamp(box.width, box.min_width, box.max_width);
-
-                    //detached boxes cannot be AVAILABLE_PERCENT
-                    if(!box.IsDetached()) //Ignore detached boxes
-                        available_width -= box.GetBoxModelWidth() + parent_box.gap_column;
-                }
-                else
+                CopyFrame& frame = copy_frames.Back();
+                if(!frame.next)
                 {
-                    bool err = (bool)growing_elements.Add(GrowBox{&box, 0}, &arena1);
-                    assert(err && "Arena out of memory");
-                    available_width -= box.GetBoxExpansionWidth() + parent_box.gap_column;
-                    total_percent += box.width;
+                    copy_frames.Pop();
+                    continue;
                 }
+                TreeNode<BoxCore>* node = &frame.next->value;
+                frame.next = frame.next->next;
+                if(node->box.id_key || node->box.slot)
+                    box_count++;
+                if(!node->children.IsEmpty())
+                    copy_frames.Push(CopyFrame{node->children.GetHead(), nullptr});
             }
-            available_width += parent_box.gap_column;
-
-            # if 1
-            float remaining_space = available_width;
-            if(total_percent < 100.0f)
-                remaining_space = remaining_space * (total_percent / 99.99f);
 
-            for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                remaining_space -= node->value.box->min_width;
-
-            while(remaining_space > 0)
+            uint64_t bytes = sizeof(TreeNode<BoxCore>) + alignof(TreeNode<BoxCore>) + MeasureNodes(first, flags) +
+                box_count * sizeof(LayoutBox) + alignof(LayoutBox);
+            ReserveArena(entry->layout_arena, bytes);
+            entry->layout = entry->layout_arena->New<TreeNode<BoxCore>>();
+            assert(entry->layout && "Memo arena out of memory");
+            CopyNodes(first, &entry->layout->children, entry->layout_arena, flags);
+            entry->layout_boxes = box_count? entry->layout_arena->NewArray<LayoutBox>(box_count): nullptr;
+            entry->layout_box_count = box_count;
+            IndexMemoLayout(*entry, memo.args != nullptr);
+            entry->layout_width = box.width;
+            entry->layout_height = box.height;
+            entry->layout_content_width = box.result_content_width;
+            entry->layout_content_height = box.result_content_height;
+            entry->layout_frame = frame_index;
+        }
+        memo_roots.Clear();
+    }
+    void Context::IndexMemoLayout(MemoEntry& entry, bool is_instance)
+    {
+        struct Frame
+        {
+            ArenaLL<TreeNode<BoxCore>>::Node* next = nullptr;
+            int x = 0;
+            int y = 0;
+        };
+        entry.layout_element_count = 0;
+        entry.layout_bounds = Rect();
+        entry.has_detached = false;
+        uint32_t index = 0;
+        bool has_bounds = false;
+        ArenaStack<Frame> frames;
+        bool pushed = frames.Push(Frame{entry.layout->children.GetHead(), 0, 0}, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
+        {
+            Frame& parent = frames.Peek();
+            if(!parent.next)
             {
-                int total_percent_below_min = 0;
-                int total_percent_in_bounds = 0;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                {
-                    GrowBox& b = node->value;
-                    if(b.result >= b.box->min_width && b.result < b.box->max_width)
-                        total_percent_in_bounds += b.box->width;
-                    if(b.result < b.box->min_width)
-                        total_percent_below_min += b.box->width;
-                }
-                int total_p = total_percent_in_bounds? total_percent_in_bounds: total_percent_below_min;
-                float min_p = 1.0f;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                {
-                    GrowBox& b = node->value;
-                    float normalized_weight = (float)total_p / (remaining_space * b.box->width);
-                    float p1 = ((float)b.box->min_width - b.result) * normalized_weight;
-                    float p2 = ((float)b.box->max_width - b.result) * normalized_weight;
-                    min_p = b.result < b.box->min_width? Min(p1, min_p): min_p;
-                    min_p = b.result < b.box->max_width? Min(p2, min_p): min_p;
-                }
-                if(!total_percent_in_bounds)
-                {
-                    for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                        if(node->value.result < node->value.box->min_width)
-                            node->value.result += min_p * remaining_space * ((float)node->value.box->width / total_p);
-                }
-                else
-                {
-                    float total_delta = 0;
-                    for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                    {
-                        if(node->value.result < node->value.box->max_width)
-                        {
-                            float normalized_weight = (float)node->value.box->width / total_p;
-                            float delta = min_p * remaining_space * normalized_weight;
-                            if(node->value.result >= node->value.box->min_width)
-                                total_delta += delta;
-                            node->value.result += delta;
-                        }
-                    }
-                    remaining_space -= total_delta;
-                }
-                if(total_p == 0)
-                    break;
+                frames.Pop();
+                continue;
             }
+            TreeNode<BoxCore>* node = &parent.next->value;
+            parent.next = parent.next->next;
+            BoxCore& box = node->box;
 
-            #endif
-
-            #if 0 //Available Percent version only with MAX values working
-            while(true)
+            //Same position as DrawBox() gives it
+            Rect draw = {box.x + box.result_rel_x + parent.x, box.y + box.result_rel_y + parent.y, box.GetRenderingWidth(), box.GetRenderingHeight()};
+            Rect& bounds = entry.layout_bounds;
+            if(!has_bounds)
+                bounds = draw;
+            int right = Max(bounds.x + bounds.width, draw.x + draw.width);
+            int bottom = Max(bounds.y + bounds.height, draw.y + draw.height);
+            bounds.x = Min(bounds.x, draw.x);
+            bounds.y = Min(bounds.y, draw.y);
+            bounds.width = right - bounds.x;
+            bounds.height = bottom - bounds.y;
+            has_bounds = true;
+
+            entry.has_detached |= box.IsDetached();
+            if(box.type != BoxType::TEXT)
+                entry.layout_element_count++;
+            if(box.id_key || box.slot)
+                entry.layout_boxes[index++] = LayoutBox{node, draw.x, draw.y};
+            if(!node->children.IsEmpty())
             {
-                int total_p = 0;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                {
-                    GrowBox& b = node->value;
-                    if(b.result < b.box->max_width)
-                    {
-                        total_p += b.box->width;
-                    }
-                }
-                //available_width = total_p < 100? available_width * total_p / 100: available_width; //this did not work
-                float min_p = 1;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                {
-                    GrowBox& b = node->value;
-                    if(b.result < b.box->max_width)
-                    {
-                        float p = (float)(b.box->max_width - b.result) * total_p / (available_width * b.box->width);
-                        min_p = Min(p, min_p);
-                    }
-                }
-                float total_delta = 0;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                {
-                    GrowBox& b = node->value;
-                    if(b.result < b.box->max_width)
-                    {
-                        float delta = min_p * available_width * b.box->width / total_p;
-                        b.result += delta;
-                        total_delta += delta;
-                    }
-                }
-                available_width -= total_delta;
-                if(total_delta == 0)
-                    break;
+                pushed = frames.Push(Frame{node->children.GetHead(), draw.x - box.scroll_x, draw.y - box.scroll_y}, &arena1);
+                assert(pushed && "Arena out of memory");
             }
-            #endif
-            for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                node->value.box->width = Max(node->value.box->min_width, (uint16_t)node->value.result);
-            arena1.Rewind(growing_elements.GetHead());
-            growing_elements.Clear();
+        }
+        frames.RewindArena(&arena1);
+        assert(index == entry.layout_box_count);
+        if(!is_instance)
+            return;
 
-            //Sets all final sizes
-            for(temp = child; temp != nullptr; temp = temp->next)
+        //The slots were filled by the instance that was laid out, the other instances start from the template's values
+        ArenaLL<TreeNode<BoxCore>>::Node* first = entry.pristine->children.GetHead();
+        assert(first && !first->next);
+        index = 0;
+        assert(copy_frames.IsEmpty());
+        copy_frames.Push(CopyFrame{first->value.children.GetHead(), nullptr});
+        while(!copy_frames.IsEmpty())
+        {
+            CopyFrame& frame = copy_frames.Back();
+            if(!frame.next)
             {
-                WidthPass(&temp->value);
+                copy_frames.Pop();
+                continue;
             }
-
-        } //End Horizontal
-        else // Compute Vertical layout in height pass
-        {
-            for(temp = child; temp != nullptr; temp = temp->next)
+            TreeNode<BoxCore>* node = &frame.next->value;
+            frame.next = frame.next->next;
+            const BoxCore& box = node->box;
+            if(box.id_key || box.slot)
             {
-                BoxCore& box = temp->value.box;
-                if(box.width_unit == Unit::Type::AVAILABLE_PERCENT)
-                    box.width_unit = Unit::Type::PARENT_PERCENT;
-                ComputeParentWidthPercent(box, parent_box.width);
-                box.width = Clamp(box.width, box.min_width, box.max_width);
-                WidthPass(&temp->value);
+                assert(index < entry.layout_box_count && "The layout does not match the template");
+                BoxCore& layout_box = entry.layout_boxes[index++].node->box;
+                layout_box.background_color = box.background_color;
+                layout_box.id_key = box.id_key;
             }
-        } //End vertical
+            if(!node->children.IsEmpty())
+                copy_frames.Push(CopyFrame{node->children.GetHead(), nullptr});
+        }
+        assert(index == entry.layout_box_count);
     }
-    void Context::WidthPass_Grid(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box) //Recurse Helpe
+    void Context::UpdateMemoLayoutStates(const MemoEntry& entry, const InstanceArgs* args)
     {
-        assert(child);
-
-        int cell_width = parent_box.GetGridCellWidth();
-        for(auto temp = child; temp!=nullptr; temp = temp->next)
+        element_count += entry.layout_element_count;
+        for(uint32_t i = 0; i < entry.layout_box_count; i++)
         {
-            BoxCore& box = temp->value.box;
-            if(box.width_unit == Unit::Type::AVAILABLE_PERCENT)
-                box.width_unit = Unit::Type::PARENT_PERCENT;
-
-            ComputeParentWidthPercent(box, cell_width * box.grid_span_x + parent_box.gap_column * (box.grid_span_x - 1));
-            box.width = Clamp(box.width, box.min_width, box.max_width);
-            WidthPass(&temp->value);
+            const BoxCore& box = entry.layout_boxes[i].node->box;
+            uint64_t id_key = box.id_key;
+            if(args && box.slot && (args->id_flags & (1 << (box.slot - 1))))
+                id_key = args->id_keys[box.slot - 1];
+            if(id_key)
+                UpdateBoxState(id_key);
+        }
+    }
+    void Context::CullMemoLayout(const MemoRoot& memo, int x, int y, const Rect& scissor_aabb)
+    {
+        assert(memo.entry);
+        if(!(draw_flags & DRAW_HIT_TEST))
+            return;
+        const MemoEntry& entry = *memo.entry;
+        for(uint32_t i = 0; i < entry.layout_box_count; i++)
+        {
+            const LayoutBox& layout_box = entry.layout_boxes[i];
+            BoxCore& box = memo.boxes? memo.boxes[i]: layout_box.node->box;
+            if(!box.id_key)
+                continue;
+            BoxResult result;
+            result.SetComputedResults(box);
+            Rect draw = {x + layout_box.x, y + layout_box.y, result.draw_width, result.draw_height};
+            InsertBoxInfo(box, result, draw, Rect::Intersection(scissor_aabb, draw), false);
         }
     }
+    void Context::EvictMemoEntries()
+    {
+        memo_evictions.Clear();
+        memo_cache.ForEach([&](uint64_t key, MemoEntry& entry)
+        {
+            if(frame_index - entry.last_frame < MEMO_MAX_AGE)
+                return;
+            delete entry.pristine_arena;
+            delete entry.layout_arena;
+            memo_evictions.Push(key);
+        });
+        for(uint32_t i = 0; i < memo_evictions.Size(); i++)
+            memo_cache.Remove(memo_evictions[i]);
 
+        //Their shared layouts were not used for longer, so they are already evicted
+        memo_evictions.Clear();
+        template_cache.ForEach([&](uint64_t key, TemplateEntry& entry)
+        {
+            if(frame_index - entry.last_frame < MEMO_MAX_AGE)
+                return;
+            delete entry.pristine_arena;
+            memo_evictions.Push(key);
+        });
+        for(uint32_t i = 0; i < memo_evictions.Size(); i++)
+            template_cache.Remove(memo_evictions[i]);
+    }
 
 
-    void Context::HeightPass(TreeNode<BoxCore>* node)
+    const char32_t* Context::InternString(const StringU32& string)
     {
-        if(node == nullptr || node->children.IsEmpty())
-            return;
-        const BoxCore& box = node->box;
-        if(box.GetLayout() == Layout::FLOW)
+        if(string.IsEmpty())
+            return string.data;
+        if(owner) //The pool belongs to the owner, fragments copy like a text seen for the first time
         {
-            HeightPass_Flow(node->children.GetHead(), box);
+            const char32_t* data = arena3.NewArrayCopy(string.data, string.Size());
+            assert(data && "string arena out of memeory");
+            return data;
+        }
+        uint64_t key = HashBytes(string.data, string.Size() * sizeof(char32_t));
+        key = key? key: 1; //0 is an empty slot in the map
+        InternEntry* entry = intern_pool.GetValue(key);
+        if(entry && entry->data)
+        {
+            if(entry->size == string.Size() && std::memcmp(entry->data, string.data, string.Size() * sizeof(char32_t)) == 0)
+            {
+                entry->last_frame = frame_index;
+                return entry->data;
+            }
+            //Collision, the pooled text is left alone
+        }
+        else if(entry)
+        {
+            entry->data = new char32_t[string.Size()];
+            entry->size = string.Size();
+            entry->last_frame = frame_index;
+            std::memcpy(entry->data, string.data, string.Size() * sizeof(char32_t));
+            intern_candidate_count--;
+            return entry->data;
         }
         else
         {
-            HeightPass_Grid(node->children.GetHead(), box);
+            entry = intern_pool.Insert(key, InternEntry{nullptr, 0, frame_index});
+            assert(entry && "Intern pool out of memory");
+            intern_candidate_count++;
         }
+        const char32_t* data = arena3.NewArrayCopy(string.data, string.Size());
+        assert(data && "string arena out of memeory");
+        return data;
     }
-    void Context::HeightPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box)
+    void Context::EvictInternedStrings()
     {
-        assert(child);
-        ArenaLL<TreeNode<BoxCore>>::Node* temp;
+        memo_evictions.Clear();
+        intern_pool.ForEach([&](uint64_t key, InternEntry& entry)
+        {
+            //Candidates only survive until the frame after they were seen
+            uint64_t max_age = entry.data? INTERN_MAX_AGE: 2;
+            if(frame_index - entry.last_frame < max_age)
+                return;
+            if(!entry.data)
+                intern_candidate_count--;
+            delete[] entry.data;
+            memo_evictions.Push(key);
+        });
+        for(uint32_t i = 0; i < memo_evictions.Size(); i++)
+            intern_pool.Remove(memo_evictions[i]);
+    }
 
-        struct GrowBox {
-            BoxCore* box = nullptr;
-            float result = 0;
-        };
-        ArenaLL<GrowBox> growing_elements;
 
-        if(parent_box.GetFlowAxis() == Flow::Axis::VERTICAL)
+    //Spans next to each other with the same style become one run, they are copied into arena2 when their strings are apart
+    void Context::BuildTextRuns(TextSpans& spans, TextLines& text)
+    {
+        uint64_t count = 0;
+        for(auto span = spans.GetHead(); span != nullptr; span = span->next)
         {
-            float available_height = parent_box.height;
-            float total_percent = 0;
-            for(temp = child; temp != nullptr; temp = temp->next)
+            if(!span->prev || !(span->value.style == span->prev->value.style))
+                count++;
+        }
+        if(count == 0)
+            return;
+        assert(count <= UINT16_MAX && "Too many text runs in one text element");
+        text.runs.data = arena2.NewArray<TextSpan>(count);
+        assert(text.runs.data && "Arena2 out of memory");
+        text.runs.size = count;
+
+        uint64_t index = 0;
+        auto span = spans.GetHead();
+        while(span)
+        {
+            TextSpan run = span->value;
+            bool is_contiguous = true;
+            auto next = span->next;
+            for(; next != nullptr && next->value.style == run.style; next = next->next)
             {
-                BoxCore& box = temp->value.box;
-                ComputeParentHeightPercent(box, parent_box.height);
-
-                if(box.height_unit != Unit::Type::AVAILABLE_PERCENT)
-                {
-                    box.height = Clamp(box.height, box.min_height, box.max_height);
-
-                    //detached boxes cannot be AVAILABLE_PERCENT
-                    if(!box.IsDetached()) //Ignore detached boxes
-                        available_height -= box.GetBoxModelHeight() + parent_box.gap_row;
-                }
-                else
-                {
-                    bool err = growing_elements.Add(GrowBox{&box, 0}, &arena1);
-                    assert(err && "Arena out of memory");
-                    available_height -= box.GetBoxExpansionHeight() + parent_box.gap_row;
-                    total_percent += box.height;
-                }
+                const TextSpan& other = next->value;
+                if(other.IsEmpty())
+                    continue;
+                if(run.IsEmpty())
+                    run.data = other.data;
+                else if(run.data + run.size != other.data)
+                    is_contiguous = false;
+                run.size += other.Size();
             }
-            available_height += parent_box.gap_row;
-
-            float remaining_space = available_height;
-            if(total_percent < 100.0f)
-                remaining_space = remaining_space * (total_percent / 99.99f);
-
-            for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                remaining_space -= node->value.box->min_height;
-
-            while(remaining_space > 0)
+            if(!is_contiguous)
             {
-                int total_percent_below_min = 0;
-                int total_percent_in_bounds = 0;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                {
-                    GrowBox& b = node->value;
-                    if(b.result >= b.box->min_height && b.result < b.box->max_height)
-                        total_percent_in_bounds += b.box->height;
-                    if(b.result < b.box->min_height)
-                        total_percent_below_min += b.box->height;
-                }
-                int total_p = total_percent_in_bounds? total_percent_in_bounds: total_percent_below_min;
-                float min_p = 1.0f;
-                for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
+                char32_t* data = arena2.NewArray<char32_t>(run.Size());
+                assert(data && "Arena2 out of memory");
+                run.data = data;
+                for(auto copy = span; copy != next; copy = copy->next)
                 {
-                    GrowBox& b = node->value;
-                    float normalized_weight = (float)total_p / (remaining_space * b.box->height);
-                    float p1 = ((float)b.box->min_height - b.result) * normalized_weight;
-                    float p2 = ((float)b.box->max_height - b.result) * normalized_weight;
-                    min_p = b.result < b.box->min_height? Min(p1, min_p): min_p;
-                    min_p = b.result < b.box->max_height? Min(p2, min_p): min_p;
+                    if(copy->value.IsEmpty())
+                        continue;
+                    std::memcpy(data, copy->value.data, copy->value.Size() * sizeof(char32_t));
+                    data += copy->value.Size();
                 }
-                if(!total_percent_in_bounds)
-                {
-                    for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                        if(node->value.result < node->value.box->min_height)
-                            node->value.result += min_p * remaining_space * ((float)node->value.box->height / total_p);
-                }
-                else
-                {
-                    float total_delta = 0;
-                    for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                    {
-                        if(node->value.result < node->value.box->max_height)
-                        {
-                            float normalized_weight = (float)node->value.box->height / total_p;
-                            float delta = min_p * remaining_space * normalized_weight;
-                            if(node->value.result >= node->value.box->min_height)
-                                total_delta += delta;
-                            node->value.result += delta;
-                        }
-                    }
-                    remaining_space -= total_delta;
-                }
-                if(total_p == 0)
-                    break;
-            }
-            for(auto node = growing_elements.GetHead(); node != nullptr; node = node->next)
-                node->value.box->height = Max(node->value.box->min_height, (uint16_t)node->value.result);
-            arena1.Rewind(growing_elements.GetHead());
-            growing_elements.Clear();
-
-            //Sets all final sizes
-            for(temp = child; temp != nullptr; temp = temp->next)
-            {
-                HeightPass(&temp->value);
-            }
-
-        } //End Vertical
-        else // Horizontal
-        {
-            for(temp = child; temp != nullptr; temp = temp->next)
-            {
-                BoxCore& box = temp->value.box;
-                if(box.height_unit == Unit::Type::AVAILABLE_PERCENT)
-                    box.height_unit = Unit::Type::PARENT_PERCENT;
-                ComputeParentHeightPercent(box, parent_box.height);
-                box.height = Clamp(box.height, box.min_height, box.max_height);
-                HeightPass(&temp->value);
             }
+            text.runs[index++] = run;
+            span = next;
         }
+        assert(index == count);
     }
-    void Context::HeightPass_Grid(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box) //Recurse Helpe
+
+    // IMPORTANT, This is the heart of computing the text layout
+    inline void Context::ComputeTextLinesAndHeight(BoxCore& box)
     {
-        assert(child);
-        int cell_height = parent_box.GetGridCellHeight();
-        for(auto temp = child; temp!=nullptr; temp = temp->next)
+        using Iterator = TextLines::Iterator;
+        struct Int2 { int x = 0, y = 0; };
+        box.result_text_lines = arena2.New<TextLines>();
+        assert(box.result_text_lines && "Arena2 out of memory");
+        TextLines& text = *box.result_text_lines;
+        BuildTextRuns(box.text_style_spans, text);
+        //Nothing else is allocated from arena2 while wrapping, so the lines end up next to each other
+        //End is exclusive, when it is in another run the line takes the rest of start's run
+        auto AddTextLine = [&](Iterator start, Iterator end, Int2 pos, int width)
         {
-            BoxCore& box = temp->value.box;
-            if(box.height_unit == Unit::Type::AVAILABLE_PERCENT)
-                box.height_unit = Unit::Type::PARENT_PERCENT;
-            ComputeParentHeightPercent(box, cell_height * box.grid_span_y + parent_box.gap_row * (box.grid_span_y - 1));
-            box.height = Clamp(box.height, box.min_height, box.max_height);
-            HeightPass(&temp->value);
-        }
-    }
-
+            assert(start.run);
+            int size = start.run == end.run? Max(0, end.string_index - start.string_index): (int)start.run->Size() - start.string_index;
+            TextLine line;
+            line.start = (uint32_t)start.string_index;
+            line.size = (uint32_t)size;
+            line.y = pos.y;
+            line.x = (int16_t)pos.x;
+            line.width = (uint16_t)width;
+            line.run = (uint16_t)(start.run - text.runs.data);
+            TextLine* new_line = arena2.New<TextLine>(line);
+            assert(new_line && "Arena2 out of memory");
+            if(text.lines.IsEmpty())
+                text.lines.data = new_line;
+            assert(new_line == text.lines.data + text.lines.size && "Text lines are not contiguous");
+            text.lines.size++;
+        };
+        int max_width = box.width;
+        int word_width = 0;
+        int span_width = 0;
+        Int2 pos;
+        Int2 cursor;
+        Iterator start = text.Begin();
+        Iterator end = text.Begin();
+        Iterator space{}; //Marks down the last white space hit
 
-    /*
-        This is an important path for measuring text height and generating
-        the line spans that will be saved in BoxResult
-    */
-    void Context::HeightContentPercentPass_Flow(TreeNode<BoxCore>* node)
-    {
-        assert(node);
-        BoxCore& parent_box = node->box;
-        ArenaLL<TreeNode<BoxCore>>::Node* child = node->children.GetHead();
-        int content_height = 0;
-        if(parent_box.GetFlowAxis() == Flow::Axis::HORIZONTAL)
+        //passing the width of the text line
+        auto WrapIfPossible = [&](int cursor_x, int width) ->bool
         {
-            int largest_height = 0;
-            for(ArenaLL<TreeNode<BoxCore>>::Node* temp = child; temp != nullptr; temp = temp->next)
+            if(cursor_x > max_width && space.IsValid())
             {
-                HeightContentPercentPass(&temp->value);
-                BoxCore& box = temp->value.box;
-
-                if(box.IsDetached()) //Ignore layout for detached boxes
-                    continue;
+                AddTextLine(start, space, pos, width);
+                cursor.x = 0;
+                cursor.y += start.GetStyle().GetFontSize() + start.GetStyle().GetLineSpacing();
+                pos = cursor;
+                end = space; //This gets incremented at the end anyway
+                start = space.Next();
+                space = Iterator{};
+                return true;
+            }
+            return false;
+        };
 
-                /* Measure text height here (old way)
-                if(box.text)
-                {
-                    //Width should be computed by this point
-                    Markdown md;
-                    box.width = Min(parent_box.width, box.width);
-                    md.SetInput(box.text, box.width, INT_MAX);
-                    while(md.ComputeNextTextRun()){}
-                    box.height = md.GetMeasuredHeight();
-                }
-                */
-                if(box.IsTextElement())
-                {
-                    this->ComputeTextLinesAndHeight(box);
-                }
+        while(end.IsValid())
+        {
 
+            int char_width = MeasureChar_impl(end.GetChar(), end.GetStyle());
+            span_width = cursor.x - pos.x;
+            cursor.x += char_width;
+            word_width += char_width;
 
-                //Ignoring these values
-                if(box.height_unit != Unit::Type::AVAILABLE_PERCENT &&
-                    box.height_unit != Unit::Type::PARENT_PERCENT &&
-                    box.min_height_unit != Unit::Type::PARENT_PERCENT &&
-                    box.max_height_unit != Unit::Type::PARENT_PERCENT)
+            if(end.GetChar() == U' ')
+            {
+                space = end;
+                word_width = 0;
+            }
+            if(end.GetChar() == U'\n')
+            {
+                AddTextLine(start, end, pos, span_width);
+                cursor.x = 0;
+                auto next = end.Next();
+                cursor.y += end.GetStyle().GetFontSize() + end.GetStyle().GetLineSpacing();
+                pos = cursor;
+                start = end.Next();
+                space = Iterator{};
+            }
+            else if(start.run != end.run) //Styles are different
+            {
+                auto it = end.Next();
+                int cursor_x = cursor.x;
+                int word = word_width;
+                int span = span_width;
+                bool did_wrap = false;
+                while(it.IsValid()) //Test if it needs to wrap
                 {
-                    box.height = Clamp(box.height, box.min_height, box.max_height);
-                    int height = box.GetBoxModelHeight();
-                    if(largest_height < height)
-                        largest_height = height;
+                    int char_width = MeasureChar_impl(it.GetChar(), it.GetStyle());
+                    span = cursor_x - pos.x;
+                    cursor_x += char_width;
+                    word += char_width;
+                    if(WrapIfPossible(cursor_x, span - word))
+                    {
+                        did_wrap = true;
+                        break;
+                    }
+                    if(it.GetChar() == U' ') //if it doest wrap by now, then we can exit
+                        break;
+                    it = it.Next();
                 }
-                else
+                if(!did_wrap)
                 {
-                    int height = box.GetBoxExpansionHeight() + box.min_height;
-                    if(largest_height < height)
-                        largest_height = height;
+                    AddTextLine(start, Iterator{}, pos, span_width);
+                    pos.x = cursor.x - char_width;
+                    pos.y = cursor.y;
+                    start = end;
+                    space = Iterator{};
                 }
             }
-            content_height = largest_height;
+            else
+            {
+                WrapIfPossible(cursor.x, span_width - word_width);
+            }
+            end = end.Next();
         }
-        else //Vertical
+
+        if(start.IsValid())
         {
-            for(ArenaLL<TreeNode<BoxCore>>::Node* temp = child; temp != nullptr; temp = temp->next)
+            cursor.y += start.GetStyle().GetFontSize();
+            span_width = cursor.x - pos.x;
+            AddTextLine(start, Iterator{}, pos, span_width);
+        }
+
+        box.height += cursor.y;
+    }
+
+
+    void Context::Draw()
+    {
+        #if UI_ENABLE_DEBUG
+            if(is_debug_mode && inspector)
             {
-                HeightContentPercentPass(&temp->value);
-                BoxCore& box = temp->value.box;
+                return;
+            }
+        // if(inspector && enabled)
+        // {
+        //     if(!copy_tree)
+        //         return;
+        //     else
+        //         copy_tree = false; //Finish copying tree
+        // }
+        #endif
 
-                if(box.IsDetached()) //Ignore layout for detached boxes
-                    continue;
 
-                /* Measure text height here
-                if(box.text)
-                {
-                    //Width should be computed by this point
-                    Markdown md;
-                    box.width = Min(parent_box.width, box.width);
-                    md.SetInput(box.text, box.width, INT_MAX);
-                    while(md.ComputeNextTextRun()){}
-                    box.height = md.GetMeasuredHeight();
-                }
-                */
 
-                if(box.IsTextElement())
-                {
-                    this->ComputeTextLinesAndHeight(box);
-                }
+        if(HasInternalError())
+            return;
+        assert(tree_core && "No RootNode Provided");
 
-                //Ignoring these values
-                if(box.height_unit != Unit::Type::AVAILABLE_PERCENT &&
-                    box.height_unit != Unit::Type::PARENT_PERCENT &&
-                    box.min_height_unit != Unit::Type::PARENT_PERCENT &&
-                    box.max_height_unit != Unit::Type::PARENT_PERCENT)
-                {
-                    box.height = Clamp(box.height, box.min_height, box.max_height);
-                    content_height += box.GetBoxModelHeight();
-                }
-                else
-                {
-                    content_height += box.GetBoxExpansionHeight() + box.min_height;
-                }
-                content_height += parent_box.gap_row;
-            }
-            content_height -= parent_box.gap_row;
-        }
-        if(parent_box.height_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.height = parent_box.height * content_height / 100;
-        if(parent_box.min_height_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.min_height = parent_box.min_height * content_height / 100;
-        if(parent_box.max_height_unit == Unit::Type::CONTENT_PERCENT)
-            parent_box.max_height = parent_box.max_height * content_height / 100;
-    }
-    void Context::HeightContentPercentPass_Grid(TreeNode<BoxCore>* node)
-    {
-        assert(node);
-        BoxCore& parent_box = node->box;
-        int content_width = 0;
-        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+        if(!stack.IsEmpty())
         {
-            WidthContentPercentPass(&temp->value);
-            BoxCore& box = temp->value.box;
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing EndRoot()"});
+            return;
         }
-    }
 
 
-    void Context::HeightContentPercentPass(TreeNode<BoxCore>* node)
-    {
-        if(!node)
-            return;
-        assert(node);
-        const BoxCore& box = node->box;
-        if(box.GetLayout() == Layout::FLOW)
+        //Layout pipeline
+        StopWatch s;
+        uint64_t prev_hovered_key = directly_hovered_element_key;
+        ResetArena2();
+        draw_commands.Clear();
+        draw_flags = is_same_frame_input? DRAW_HIT_TEST: DRAW_RENDER | DRAW_HIT_TEST;
+
+        if(layout_pipeline == LayoutPipeline::FUSED)
         {
-            HeightContentPercentPass_Flow(node);
+            s.Start();
+            FusedPipeline();
+            //std::cout<<"Fused:"<< s.Stop()<<'\n';
         }
         else
         {
-            HeightContentPercentPass_Grid(node);
+            s.Start();
+            WidthContentPercentPass(tree_core);
+            //std::cout<<"WidthContent:"<< s.Stop()<<'\n';
+
+            s.Start();
+            WidthPass(tree_core);
+            //std::cout<<"WidthPass:"<< s.Stop()<<'\n';
+
+            s.Start();
+            HeightContentPercentPass(tree_core);
+            //std::cout<<"HeightContent:"<< s.Stop()<<'\n';
+
+            s.Start();
+            HeightPass(tree_core);
+            //std::cout<<"HeightPass:"<< s.Stop()<<'\n';
+
+            s.Start();
+            PositionPass(tree_core);
+            //std::cout<<"PositionPass:"<< s.Stop()<<'\n';
+
+            s.Start();
+            GenerateComputedTree();
+            //std::cout<<"GenerateTree:"<< s.Stop()<<'\n';
+            s.Start();
+
+            directly_hovered_element_key = 0; //Reset the directly hovered element
+            //TODO - add all floating elements to a queue
+
+            //This is most likely temporary because of performance, but I would like to keep developing
+            DetachedBoxesPass(tree_result, 0, 0);
+            //std::cout<<"Detach:"<< s.Stop()<<'\n';
+            DrawPass(tree_result, 0, 0, {0, 0, input.screen_width, input.screen_height});
         }
-    }
+        DrawDeferredBoxes();
+        if(is_same_frame_input)
+        {
+            //Everything was only hit tested, the tree is drawn after the callbacks
+            RunLayoutCallbacks();
+            draw_flags = DRAW_RENDER;
+            DrawPass(tree_result, 0, 0, {0, 0, input.screen_width, input.screen_height});
+            DrawDeferredBoxes();
+        }
+        else
+            RunLayoutCallbacks();
+        FlushDrawCommands();
+        deferred_elements.Clear();
+        draw_flags = DRAW_RENDER | DRAW_HIT_TEST;
+        SaveMemoLayouts();
 
+        needs_redraw = has_input_events || is_animating || time >= redraw_time || prev_hovered_key != directly_hovered_element_key;
+        if(time >= redraw_time)
+            redraw_time = INFINITY;
+        //std::cout<<"Draw: " << s.Stop()<<"\n\n";
+    }
 
 
-    void Context::PositionPass(TreeNode<BoxCore>* node, int x, int y, const BoxCore& parent_box)
+    void Context::SetLayoutPipeline(LayoutPipeline pipeline)
     {
-        if(node == nullptr)
-            return;
-        BoxCore& box = node->box;
-        box.result_rel_x += parent_box.padding.left + box.margin.left;
-        box.result_rel_y += parent_box.padding.top + box.margin.top;
-        x += box.result_rel_x;
-        y += box.result_rel_y;
+        layout_pipeline = pipeline;
+    }
+    LayoutPipeline Context::GetLayoutPipeline() const
+    {
+        return layout_pipeline;
+    }
+    void Context::SetInput(const InputSnapshot& input)
+    {
+        this->input = input;
+        is_input_set = true;
+    }
+    const InputSnapshot& Context::GetInput() const
+    {
+        if(owner)
+            return owner->input;
+        return input;
+    }
+    bool Context::NeedsRedraw() const
+    {
+        #if UI_ENABLE_DEBUG
+            if(is_debug_mode && inspector)
+                return true;
+        #endif
+        return needs_redraw;
+    }
+    float Context::NextRequiredFrameTime() const
+    {
+        if(NeedsRedraw())
+            return 0.0f;
+        return (float)Max(0.0, redraw_time - time);
+    }
+    void Context::RequestRedraw(float seconds)
+    {
+        redraw_time = Min(redraw_time, time + Max(0.0f, seconds));
+    }
+    void Context::SetSameFrameInput(bool flag)
+    {
+        is_same_frame_input = flag;
+    }
+    bool Context::IsSameFrameInput() const
+    {
+        return is_same_frame_input;
+    }
 
-        if(node->children.IsEmpty())
+    /*
+        Same results as the multi pass pipeline in three traversals:
+        1. Post order: content widths
+        2. Pre order: widths. Post order: content heights and text lines (needs the final widths)
+        3. Pre order: heights, positions, computed tree, detached boxes, drawing and input
+        Detached subtrees are still laid out in 3 but drawn afterwards from the deferred queue.
+    */
+    void Context::FusedPipeline()
+    {
+        if(!tree_core)
             return;
 
-        if(box.GetLayout() == Layout::FLOW)
+        WidthContentPercentPass(tree_core);
+        WidthAndHeightContentPass(tree_core);
+
+        struct Frame
         {
-            PositionPass_Flow(node->children.GetHead(), x, y, box);
-        }
-        else
+            TreeNode<BoxCore>* core = nullptr;
+            ArenaLL<TreeNode<BoxCore>>::Node* next_child = nullptr;
+            TreeNode<BoxResult>* result = nullptr;
+            int x = 0;
+            int y = 0;
+            Rect scissor_aabb;
+            MemoRoot* memo = nullptr; //Inside a memo root whose cached layout is walked
+            bool is_drawn = true; //false inside detached subtrees, they are drawn from the deferred queue
+            bool is_layout_cached = false; //Inside a memo root whose layout was reused
+        };
+
+        directly_hovered_element_key = 0; //Reset the directly hovered element
+
+        BoxCore& root_box = tree_core->box;
+        root_box.result_rel_x += root_box.margin.left;
+        root_box.result_rel_y += root_box.margin.top;
+        HeightPass_Node(tree_core);
+        PositionPass_Node(tree_core);
+
+        tree_result = arena2.New<TreeNode<BoxResult>>();
+        assert(tree_result && "Arena2 out of memory");
+        tree_result->box.SetComputedResults(root_box);
+
+        ResultFrame root_frame = DrawBox(tree_result, 0, 0, {0, 0, input.screen_width, input.screen_height});
+        Frame frame;
+        frame.core = tree_core;
+        frame.next_child = tree_core->children.GetHead();
+        frame.result = tree_result;
+        frame.x = root_frame.x;
+        frame.y = root_frame.y;
+        frame.scissor_aabb = root_frame.scissor_aabb;
+
+        ArenaStack<Frame> frames;
+        bool pushed = frames.Push(frame, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
         {
-            PositionPass_Grid(node->children.GetHead(), x, y, box);
+            Frame& parent = frames.Peek();
+            if(!parent.next_child)
+            {
+                frames.Pop();
+                continue;
+            }
+            TreeNode<BoxCore>* core_node = &parent.next_child->value;
+            parent.next_child = parent.next_child->next;
+
+            frame.is_layout_cached = parent.is_layout_cached;
+            frame.memo = parent.memo;
+            bool is_memo_layout = false;
+            if(core_node->box.memo_root)
+            {
+                frame.is_layout_cached = ResolveMemoLayout(core_node);
+                is_memo_layout = frame.is_layout_cached;
+                frame.memo = is_memo_layout? &memo_roots[core_node->box.memo_root - 1]: nullptr;
+            }
+            if(!frame.is_layout_cached)
+            {
+                HeightPass_Node(core_node);
+                PositionPass_Node(core_node);
+            }
+
+            //Boxes of a cached layout are shared, an instance has its own copies of the ones with a slot
+            BoxCore* core = &core_node->box;
+            if(parent.memo && (core->id_key || core->slot))
+            {
+                uint32_t index = parent.memo->next_box++;
+                if(parent.memo->boxes)
+                    core = &parent.memo->boxes[index];
+            }
+            TreeNode<BoxResult> node;
+            node.box.SetComputedResults(*core);
+            TreeNode<BoxResult>* result_node = parent.result->children.Add(node, &arena2);
+            assert(result_node && "Arena2 out of memory");
+
+            const BoxCore& box = *core;
+            const BoxResult& result = result_node->box;
+            frame.core = core_node;
+            frame.next_child = is_memo_layout? frame.memo->entry->layout->children.GetHead(): core_node->children.GetHead();
+            frame.result = result_node;
+            frame.scissor_aabb = parent.scissor_aabb;
+            frame.is_drawn = parent.is_drawn;
+            if(box.IsDetached())
+            {
+                AddDetachedBoxToQueue(result_node, {parent.x, parent.y, parent.result->box.draw_width, parent.result->box.draw_height});
+                assert(deferred_elements.GetTail());
+                const DeferredBox& deferred = deferred_elements.GetTail()->value;
+                frame.x = box.x + result.rel_x + deferred.x - box.scroll_x;
+                frame.y = box.y + result.rel_y + deferred.y - box.scroll_y;
+                frame.is_drawn = false;
+            }
+            else if(parent.is_drawn)
+            {
+                ResultFrame drawn = DrawBox(result_node, parent.x, parent.y, parent.scissor_aabb);
+                frame.x = drawn.x;
+                frame.y = drawn.y;
+                frame.scissor_aabb = drawn.scissor_aabb;
+
+                //Nothing in a cached layout outside the clip is drawn or hovered, so it is not walked
+                const MemoEntry* entry = is_memo_layout? frame.memo->entry: nullptr;
+                if(entry && !entry->has_detached)
+                {
+                    Rect bounds = entry->layout_bounds;
+                    bounds.x += frame.x;
+                    bounds.y += frame.y;
+                    if(!Rect::Overlap(frame.scissor_aabb, bounds))
+                    {
+                        CullMemoLayout(*frame.memo, frame.x, frame.y, frame.scissor_aabb);
+                        frame.next_child = nullptr;
+                    }
+                }
+            }
+            else
+            {
+                frame.x = box.x + result.rel_x + parent.x - box.scroll_x;
+                frame.y = box.y + result.rel_y + parent.y - box.scroll_y;
+            }
+            pushed = frames.Push(frame, &arena1);
+            assert(pushed && "Arena out of memory");
         }
+        frames.RewindArena(&arena1);
     }
-    void Context::PositionPass_Flow(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, int x, int y, BoxCore& parent)
+    void Context::WidthAndHeightContentPass(TreeNode<BoxCore>* root)
     {
-        assert(child);
-        int content_height = 0;
-        int content_width = 0;
-        if(parent.GetFlowAxis() == Flow::HORIZONTAL)
+        ArenaStack<CoreFrame> frames;
+        WidthPass_Node(root);
+        bool pushed = frames.Push(CoreFrame{root, root->children.GetHead()}, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
         {
-            int count = 0;
-            for(auto temp = child; temp != nullptr; temp = temp->next)
-            {
-                const BoxCore& box = temp->value.box;
-                if(box.IsDetached()) continue;
-                count++;
-                content_width += box.GetBoxModelWidth();
-            }
-            content_width += Max(0, count - 1) * parent.gap_column;
-            int cursor_x = 0;
-            int offset = 0;
-            int available_width = parent.width - content_width;
-            switch(parent.flow_horizontal_alignment)
+            CoreFrame& frame = frames.Peek();
+            if(frame.next_child)
             {
-                case Flow::END:             cursor_x = available_width; break;
-                case Flow::CENTERED:        cursor_x = available_width/2; break;
-                case Flow::SPACE_AROUND:    cursor_x = offset = available_width / (count + 1); break;
-                case Flow::SPACE_BETWEEN:   if(count > 1) offset = available_width / (count - 1); break;
-                default: break;
+                TreeNode<BoxCore>* child = &frame.next_child->value;
+                frame.next_child = frame.next_child->next;
+                if(IsMemoLayoutCached(child->box))
+                    continue;
+                WidthPass_Node(child);
+                pushed = frames.Push(CoreFrame{child, child->children.GetHead()}, &arena1);
+                assert(pushed && "Arena out of memory");
+                continue;
             }
-            for(auto temp = child; temp != nullptr; temp = temp->next)
+            TreeNode<BoxCore>* node = frame.node;
+            frames.Pop();
+            HeightContentPercentPass_Node(node);
+        }
+        frames.RewindArena(&arena1);
+    }
+
+    void Context::WidthContentPercentPass_Flow(TreeNode<BoxCore>* node)
+    {
+        assert(node);
+        BoxCore& parent_box = node->box;
+        int content_width = 0;
+        if(parent_box.GetFlowAxis() == Flow::Axis::HORIZONTAL)
+        {
+            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
             {
                 BoxCore& box = temp->value.box;
-                if(box.IsDetached())
-                {
-                    PositionPass(&temp->value, x, y, parent);
+                if(box.IsDetached()) //later add check for parent being content_percent
                     continue;
+
+                if(box.IsTextElement())
+                {
+                    float w = MeasureTextSpans(box);
+                    box.max_width = w;
+                    content_width += w;
                 }
-                int cursor_y = 0;
-                int box_height = box.GetBoxModelHeight();
-                if(content_height < box_height)
-                    content_height = box_height;
-                int available_height = parent.height - box_height;
-                switch(parent.flow_vertical_alignment)
+                else if(box.width_unit != Unit::Type::AVAILABLE_PERCENT &&
+                box.width_unit != Unit::Type::PARENT_PERCENT &&
+                box.max_width_unit != Unit::Type::PARENT_PERCENT &&
+                box.min_width_unit != Unit::Type::PARENT_PERCENT)
                 {
-                    case Flow::START:   break;
-                    case Flow::END:     cursor_y = available_height; break;
-                    default:            cursor_y = available_height/2; break;
+                    box.width = Clamp(box.width, box.min_width, box.max_width);
+                    content_width += box.GetBoxModelWidth();
                 }
-
-                box.result_rel_x = cursor_x;
-                box.result_rel_y = cursor_y;
-
-                PositionPass(&temp->value, x, y, parent);
-                cursor_x += box.GetBoxModelWidth() + parent.gap_column + offset;
+                else
+                {
+                    content_width += box.GetBoxExpansionWidth() + box.min_width;
+                }
+                content_width += parent_box.gap_column;
             }
+            content_width -= parent_box.gap_column;
         }
         else
         {
-            int count = 0;
-            for(auto temp = child; temp != nullptr; temp = temp->next)
-            {
-                const BoxCore& box = temp->value.box;
-                if(box.IsDetached()) continue;
-                count++;
-                content_height += box.GetBoxModelHeight();
-            }
-            content_height += Max(0, count - 1) * parent.gap_row;
-            int cursor_y = 0;
-            int offset = 0;
-            int available_height = parent.height - content_height;
-            switch(parent.flow_vertical_alignment)
-            {
-                case Flow::END:             cursor_y = available_height; break;
-                case Flow::CENTERED:        cursor_y = available_height/2; break;
-                case Flow::SPACE_AROUND:    cursor_y = offset = available_height / (count + 1); break;
-                case Flow::SPACE_BETWEEN:   if(count > 1) offset = available_height / (count - 1); break;
-                default: break;
-            }
-            for(auto temp = child; temp != nullptr; temp = temp->next)
+            int largest_width = 0;
+            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
             {
                 BoxCore& box = temp->value.box;
                 if(box.IsDetached())
-                {
-                    PositionPass(&temp->value, x, y, parent);
                     continue;
-                }
-                int cursor_x = 0;
-                int box_width = box.GetBoxModelWidth();
-                if(content_width < box_width)
-                    content_width = box_width;
-                int available_width = parent.width - box_width;
-                switch(parent.flow_horizontal_alignment)
+
+                if(box.IsTextElement())
                 {
-                    case Flow::START:   break;
-                    case Flow::END:     cursor_x = available_width; break;
-                    default:            cursor_x = available_width/2; break;
+                    int width = MeasureTextSpans(box);
+                    if(largest_width < width)
+                        largest_width = width;
                 }
 
-                box.result_rel_x = cursor_x;
-                box.result_rel_y = cursor_y;
-
-                PositionPass(&temp->value, x, y, parent);
-                cursor_y += box.GetBoxModelHeight() + parent.gap_row + offset;
+                else if(box.width_unit != Unit::Type::AVAILABLE_PERCENT &&
+                box.width_unit != Unit::Type::PARENT_PERCENT &&
+                box.max_width_unit != Unit::Type::PARENT_PERCENT &&
+                box.min_width_unit != Unit::Type::PARENT_PERCENT)
+                {
+                    box.width = Clamp(box.width, box.min_width, box.max_width);
+                    int width = box.GetBoxModelWidth();
+                    if(largest_width < width)
+                        largest_width = width;
+                }
+                else
+                {
+                    int width = box.GetBoxExpansionWidth() + box.min_width;
+                    if(largest_width < width)
+                        largest_width = width;
+                }
             }
+            content_width = largest_width;
         }
-        parent.result_content_width = content_width;
-        parent.result_content_height = content_height;
+        content_width = Max(0, content_width);
+        if(parent_box.width_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.width = content_width * parent_box.width / 100;
+        if(parent_box.min_width_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.min_width = content_width * parent_box.min_width / 100;
+        if(parent_box.max_width_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.max_width = content_width * parent_box.max_width / 100;
     }
-    void Context::PositionPass_Grid(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, int x, int y, BoxCore& parent)
+    void Context::WidthContentPercentPass_Grid(TreeNode<BoxCore>* node)
     {
-        assert(child);
-        int cell_width = parent.GetGridCellWidth() + parent.gap_column;
-        int cell_height = parent.GetGridCellHeight() + parent.gap_row;
-        for(auto temp = child; temp!=nullptr; temp = temp->next)
+        assert(node);
+        BoxCore& parent_box = node->box;
+        int cell_width = 0;
+
+        //Finding the largest cell width
+        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
         {
             BoxCore& box = temp->value.box;
-            box.result_rel_x = cell_width * box.grid_x;
-            box.result_rel_y = cell_height * box.grid_y;
-            PositionPass(&temp->value, x, y, parent);
+            if(box.IsDetached())
+                continue;
+            if(box.width_unit != Unit::Type::AVAILABLE_PERCENT &&
+            box.width_unit != Unit::Type::PARENT_PERCENT &&
+            box.max_width_unit != Unit::Type::PARENT_PERCENT &&
+            box.min_width_unit != Unit::Type::PARENT_PERCENT)
+            {
+                box.width = Clamp(box.width, box.min_width, box.max_width);
+                int width = box.GetBoxModelWidth() / box.grid_span_x;
+                if(cell_width < width)
+                    cell_width = width;
+            }
+            else
+            {
+                int width = box.GetBoxExpansionWidth() + box.min_width;
+                if(cell_width < width)
+                    cell_width = width;
+            }
         }
+        int total_width = cell_width * parent_box.grid_column_count + parent_box.gap_column * (parent_box.grid_column_count - 1);
+        if(parent_box.width_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.width = total_width;
+        if(parent_box.min_width_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.min_width = total_width;
+        if(parent_box.max_width_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.max_width = total_width;
     }
-
-    void Context::DetachedBoxesPass(TreeNode<BoxResult>* node, int parent_x, int parent_y)
+    //Post order, a box's content size is known once all of its children are done
+    void Context::WidthContentPercentPass(TreeNode<BoxCore>* root)
     {
-        if(!node || !node->box.core)
+        if(!root)
             return;
-        const BoxResult& box_result = node->box;
-        const BoxCore& box_core = *node->box.core;
-        int x = box_core.x + box_result.rel_x + parent_x - box_core.scroll_x;
-        int y = box_core.y + box_result.rel_y + parent_y - box_core.scroll_y;
-
-        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+        ArenaStack<CoreFrame> frames;
+        bool pushed = frames.Push(CoreFrame{root, root->children.GetHead()}, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
         {
-            assert(temp->value.box.core);
-            if(temp->value.box.core->IsDetached())
+            CoreFrame& frame = frames.Peek();
+            if(frame.next_child)
             {
-                AddDetachedBoxToQueue(&temp->value, {x, y, box_result.draw_width, box_result.draw_height});
-                assert(deferred_elements.GetTail());
-                x = deferred_elements.GetTail()->value.x;
-                y = deferred_elements.GetTail()->value.y;
-                DetachedBoxesPass(&temp->value, x, y);
+                TreeNode<BoxCore>* child = &frame.next_child->value;
+                frame.next_child = frame.next_child->next;
+                if(IsMemoLayoutCached(child->box)) //Its children are already laid out
+                    continue;
+                pushed = frames.Push(CoreFrame{child, child->children.GetHead()}, &arena1);
+                assert(pushed && "Arena out of memory");
                 continue;
             }
-            DetachedBoxesPass(&temp->value, x, y);
+            TreeNode<BoxCore>* node = frame.node;
+            frames.Pop();
+            WidthContentPercentPass_Node(node);
         }
+        frames.RewindArena(&arena1);
     }
-
-    void Context::AddDetachedBoxToQueue(TreeNode<BoxResult>* node, const Rect& parent)
+    void Context::WidthContentPercentPass_Node(TreeNode<BoxCore>* node)
     {
-        assert(node);
-        const BoxResult& box = node->box;
-        assert(box.core);
-
-        DeferredBox result;
-        result.node = node;
-
-        switch(box.core->detach)
+        if(node->box.GetLayout() == Layout::FLOW)
         {
-           case Detach::LEFT:
-                result.x = box.draw_height;
-                break;
-            case Detach::RIGHT:
-                result.x = parent.width;
-                break;
-            case Detach::TOP:
-                result.y = -box.draw_height;
-                break;
-            case Detach::BOTTOM:
-                result.y = parent.height;
-                break;
-           case Detach::LEFT_CENTER:
-                result.x = box.draw_width;
-                result.y = (parent.height - box.draw_height)/2;
-                break;
-            case Detach::RIGHT_CENTER:
-                result.x = parent.width;
-                result.y = (parent.height - box.draw_height)/2;
-                break;
-            case Detach::TOP_CENTER:
-                result.x = (parent.width - box.draw_width)/2;
-                result.y = -box.draw_height;
-                break;
-            case Detach::BOTTOM_CENTER:
-                result.x = (parent.width - box.draw_width)/2;
-                result.y = parent.height;
-                break;
-           case Detach::LEFT_END:
-                result.x = box.draw_width;
-                result.y = parent.height - box.draw_height;
-                break;
-            case Detach::RIGHT_END:
-                result.x = parent.width;
-                result.y = parent.height - box.draw_height;
-                break;
-            case Detach::TOP_END:
-                result.x = parent.width - box.draw_width;
-                result.y = -box.draw_height;
-                break;
-            case Detach::BOTTOM_END:
-                result.x = parent.width - box.draw_width;
-                result.y = parent.height;
-                break;
-            default:
-                break;
+            WidthContentPercentPass_Flow(node);
+        }
+        else
+        {
+            WidthContentPercentPass_Grid(node);
         }
-        result.x += parent.x;
-        result.y += parent.y;
-
-        auto err = deferred_elements.Add(result, &arena2);
-        assert(err && "Arena2 out of memory");
     }
-
-    void Context::GenerateComputedTree()
+    //Pre order, a box's width is final before its children are sized
+    void Context::WidthPass(TreeNode<BoxCore>* root)
     {
-        if(!tree_core)
+        if(!root)
             return;
-
-        tree_result = arena2.New<TreeNode<BoxResult>>();
-        assert(tree_result && "Arena2 out of memory");
-        tree_result->box.SetComputedResults(tree_core->box);
-
-        GenerateComputedTree_h(tree_core, tree_result);
+        ArenaStack<TreeNode<BoxCore>*> nodes;
+        bool pushed = nodes.Push(root, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!nodes.IsEmpty())
+        {
+            TreeNode<BoxCore>* node = nodes.Peek();
+            nodes.Pop();
+            WidthPass_Node(node);
+            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+            {
+                pushed = nodes.Push(&temp->value, &arena1);
+                assert(pushed && "Arena out of memory");
+            }
+        }
+        nodes.RewindArena(&arena1);
     }
-    void Context::GenerateComputedTree_h(TreeNode<BoxCore>* tree_core, TreeNode<BoxResult>* tree_result)
+    void Context::WidthPass_Node(TreeNode<BoxCore>* node)
     {
-        assert(tree_core && tree_result);
-        for(auto temp = tree_core->children.GetHead(); temp != nullptr; temp = temp->next)
-        {
-            TreeNode<BoxResult> node;
-            node.box.SetComputedResults(temp->value.box);
-
-            TreeNode<BoxResult>* result_node = tree_result->children.Add(node, &arena2);
-            assert(result_node && "Arena2 out of memory");
+        BoxCore& box = node->box;
+        //Might aswell compute this here since width is all calculated
+        ComputeWidthPercentForHeight(box);
 
-            GenerateComputedTree_h(&temp->value, result_node);
+        if(node->children.IsEmpty())
+            return;
+        if(box.GetLayout() == Layout::FLOW)
+        {
+            WidthPass_Flow(node->children.GetHead(), box);
+        }
+        else
+        {
+            WidthPass_Grid(node->children.GetHead(), box);
         }
     }
 
-    //scissor_aabb is the parents aabb
-    void Context::DrawPass(TreeNode<BoxResult>* node, int parent_x, int parent_y, Rect scissor_aabb)
+    /*
+        Distributes the available space between AVAILABLE_PERCENT boxes in grow_items.
+        Every box grows with a shared level t: size = Clamp(weight * t, min, max).
+        The space above the minimums must sum up to the remaining space, so the level
+        is found by sorting the points where boxes start growing (min / weight) and
+        stop growing (max / weight) and sweeping them once, instead of clamping boxes
+        one at a time.
+    */
+    void Context::SolveAvailablePercent(float available_space, float total_percent)
     {
-        if(!node || !node->box.core)
-            return;
+        float remaining_space = available_space;
+        if(total_percent < 100.0f)
+            remaining_space = remaining_space * (total_percent / 99.99f);
 
-        BoxResult& box_result = node->box;
-        BoxCore& box_core = *node->box.core;
+        grow_events.Clear();
+        for(uint32_t i = 0; i < grow_items.Size(); i++)
+        {
+            GrowItem& item = grow_items[i];
+            remaining_space -= item.min;
+            item.result = item.min;
+            if(item.weight <= 0 || item.max <= item.min)
+                continue;
+            grow_events.Push(GrowEvent{item.min / item.weight, item.weight});
+            grow_events.Push(GrowEvent{item.max / item.weight, -item.weight});
+        }
+        if(remaining_space <= 0 || grow_events.IsEmpty())
+            return;
 
-        Rect draw;
-        draw.x = box_core.x + box_result.rel_x + parent_x;
-        draw.y = box_core.y + box_result.rel_y + parent_y;
-        draw.width = box_result.draw_width;
-        draw.height = box_result.draw_height;
-        bool should_render = false;
+        std::sort(grow_events.Data(), grow_events.Data() + grow_events.Size(), [](const GrowEvent& a, const GrowEvent& b)
+        {
+            return a.level < b.level;
+        });
 
-        if(Rect::Overlap(scissor_aabb, draw))
+        //Total growth is piecewise linear in the level, the slope only changes at events
+        float level = 0;
+        float slope = 0;
+        float filled = 0;
+        bool saturated = true;
+        for(uint32_t i = 0; i < grow_events.Size(); i++)
         {
-            should_render = true;
-            //Render current box
-            if(box_core.IsTextElement())
-            {
-                for(auto temp = box_result.text_lines.GetHead(); temp != nullptr; temp = temp->next)
-                {
-                    const TextLine& line = temp->value;
-                    int x = draw.x + line.x;
-                    int y = draw.y + line.y;
-                    DrawRectangle_impl(x, y, line.width, line.style.GetFontSize(), 0, 0, {}, line.style.GetBgColor());
-                    DrawText_impl(line.style, x, y, line.data, line.Size());
-                }
-            }
-            else if(box_core.texture.HasTexture())
+            const GrowEvent& event = grow_events[i];
+            float next_filled = filled + slope * (event.level - level);
+            if(slope > 0 && next_filled >= remaining_space)
             {
-                DrawTexturedRectangle_impl(draw.x, draw.y, draw.width, draw.height, box_core.texture);
-            }
-            else
-            {
-                DrawRectangle_impl(draw.x, draw.y, draw.width, draw.height, box_core.corner_radius, box_core.border_width, box_core.border_color, box_core.background_color);
+                level += (remaining_space - filled) / slope;
+                saturated = false;
+                break;
             }
+            filled = next_filled;
+            level = event.level;
+            slope += event.slope;
+        }
+
+        for(uint32_t i = 0; i < grow_items.Size(); i++)
+        {
+            GrowItem& item = grow_items[i];
+            if(item.weight <= 0 || item.max <= item.min)
+                continue;
+            item.result = saturated? item.max: Clamp(item.weight * level, item.min, item.max);
         }
+    }
 
+    void Context::WidthPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box)
+    {
+        assert(child);
+        assert(grow_items.IsEmpty());
+        ArenaLL<TreeNode<BoxCore>>::Node* temp;
 
-        //Input handling
-        Rect new_aabb = Rect::Intersection(scissor_aabb, draw);
-        if(box_core.id_key)
+        if(parent_box.GetFlowAxis() == Flow::Axis::HORIZONTAL)
         {
-            BoxInfo info;
-            info.is_rendered = should_render;
-            info.key = box_core.id_key;
-            info.x = draw.x;
-            info.y = draw.y;
-            info.padding = box_core.padding;
-            info.width = box_core.width;
-            info.height = box_core.height;
-            info.content_width = box_result.content_width;
-            info.content_height = box_result.content_height;
-            if(Rect::Contains(new_aabb, GetMouseX(), GetMouseY()))
+            float available_width = parent_box.width;
+            float total_percent = 0;
+            for(temp = child; temp != nullptr; temp = temp->next)
             {
-                info.is_hover = true;
-                if(directly_hovered_element_key != box_core.id_key)
-                    directly_hovered_element_key = box_core.id_key;
-            }
-            const BoxInfo* front_value = double_buffer_map.FrontValue(info.key);
-            if(front_value)
-                info.state = front_value->state;
-            BoxInfo* box_info = double_buffer_map.Insert(info.key, info);
-            assert(box_info && "DoubleBufferMap out of memory");
-        }
+                BoxCore& box = temp->value.box;
+                ComputeParentWidthPercent(box, parent_box.width);
 
-        if(box_core.IsScissor())
-            scissor_aabb = new_aabb;
+                if(box.width_unit != Unit::Type::AVAILABLE_PERCENT)
+                {
+                    box.width = Clamp(box.width, box.min_width, box.max_width);
 
+                    //detached boxes cannot be AVAILABLE_PERCENT
+                    if(!box.IsDetached()) //Ignore detached boxes
+                        available_width -= box.GetBoxModelWidth() + parent_box.gap_column;
+                }
+                else
+                {
+                    grow_items.Push(GrowItem{&box, (float)box.width, (float)box.min_width, (float)box.max_width});
+                    available_width -= box.GetBoxExpansionWidth() + parent_box.gap_column;
+                    total_percent += box.width;
+                }
+            }
+            available_width += parent_box.gap_column;
 
-        //Render children boxes
-        int x = draw.x - box_core.scroll_x;
-        int y = draw.y - box_core.scroll_y;
+            if(!grow_items.IsEmpty())
+            {
+                SolveAvailablePercent(available_width, total_percent);
+                for(uint32_t i = 0; i < grow_items.Size(); i++)
+                    grow_items[i].box->width = Max(grow_items[i].box->min_width, (uint16_t)grow_items[i].result);
+                grow_items.Clear();
+            }
 
-        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+        } //End Horizontal
+        else // Compute Vertical layout in height pass
         {
-            assert(temp->value.box.core);
-            if(temp->value.box.core->IsDetached())
+            for(temp = child; temp != nullptr; temp = temp->next)
             {
-                //AddDetachedBoxToQueue(&temp->value, draw);
-                continue;
+                BoxCore& box = temp->value.box;
+                if(box.width_unit == Unit::Type::AVAILABLE_PERCENT)
+                    box.width_unit = Unit::Type::PARENT_PERCENT;
+                ComputeParentWidthPercent(box, parent_box.width);
+                box.width = Clamp(box.width, box.min_width, box.max_width);
             }
+        } //End vertical
+    }
+    void Context::WidthPass_Grid(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box)
+    {
+        assert(child);
+
+        int cell_width = parent_box.GetGridCellWidth();
+        for(auto temp = child; temp!=nullptr; temp = temp->next)
+        {
+            BoxCore& box = temp->value.box;
+            if(box.width_unit == Unit::Type::AVAILABLE_PERCENT)
+                box.width_unit = Unit::Type::PARENT_PERCENT;
 
-            if(box_core.IsScissor())
-                BeginScissorMode_impl(scissor_aabb);
-            DrawPass(&temp->value, x, y, scissor_aabb);
+            ComputeParentWidthPercent(box, cell_width * box.grid_span_x + parent_box.gap_column * (box.grid_span_x - 1));
+            box.width = Clamp(box.width, box.min_width, box.max_width);
         }
-        if(box_core.IsScissor())
-            EndScissorMode_impl();
     }
 
 
-    DebugInspector::DebugInspector(uint64_t bytes) : arena(bytes/3), ui(bytes/3, bytes/3)
-    {
 
-    }
-    int DebugInspector::GetMouseDeltaX()
-    {
-        return GetMouseX() - mouse_x;
-    }
-    int DebugInspector::GetMouseDeltaY()
+    //Pre order, a box's height is final before its children are sized
+    void Context::HeightPass(TreeNode<BoxCore>* root)
     {
-        return GetMouseY() - mouse_y;
+        if(!root)
+            return;
+        ArenaStack<TreeNode<BoxCore>*> nodes;
+        bool pushed = nodes.Push(root, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!nodes.IsEmpty())
+        {
+            TreeNode<BoxCore>* node = nodes.Peek();
+            nodes.Pop();
+            HeightPass_Node(node);
+            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+            {
+                pushed = nodes.Push(&temp->value, &arena1);
+                assert(pushed && "Arena out of memory");
+            }
+        }
+        nodes.RewindArena(&arena1);
     }
-    void DebugInspector::Push(BoxDebug box)
+    void Context::HeightPass_Node(TreeNode<BoxCore>* node)
     {
-        if(!box.id.IsEmpty())
+        if(node->children.IsEmpty())
+            return;
+        const BoxCore& box = node->box;
+        if(box.GetLayout() == Layout::FLOW)
         {
-            box.id.data = arena.NewArrayCopy(box.id.data, box.id.Size());
-            assert(box.id.data && "DebugInspector out of memory");
+            HeightPass_Flow(node->children.GetHead(), box);
         }
-        if(!root)
+        else
         {
-            root = arena.New<TreeNodeDebug>();
-            assert(root && "Inspector out of memory");
-            root->box = box;
-            stack.Push(root);
-            return;
+            HeightPass_Grid(node->children.GetHead(), box);
         }
-        assert(!stack.IsEmpty());
-        TreeNodeDebug* parent = stack.Peek(); assert(parent);
-        TreeNodeDebug* child = parent->children.Add(TreeNodeDebug(box), &arena);
-        assert(child && "Inspector out of memory");
-        stack.Push(child);
-    }
-    void DebugInspector::Pop()
-    {
-        assert(!stack.IsEmpty() && "Begin/End uneven");
-        stack.Pop();
-    }
-
-    void DebugInspector::Reset()
-    {
-        arena.Reset();
-        root = nullptr;
-        selected_node = nullptr;
-        hovered_node = nullptr;
-        stack.Clear();
     }
-
-    void DebugInspector::Run()
+    void Context::HeightPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box)
     {
-        assert(stack.IsEmpty());
+        assert(child);
+        assert(grow_items.IsEmpty());
+        ArenaLL<TreeNode<BoxCore>>::Node* temp;
 
-        BoxStyle root_style =
+        if(parent_box.GetFlowAxis() == Flow::Axis::VERTICAL)
         {
-            .width = {GetScreenWidth()},
-            .height = {GetScreenHeight()},
-        };
+            float available_height = parent_box.height;
+            float total_percent = 0;
+            for(temp = child; temp != nullptr; temp = temp->next)
+            {
+                BoxCore& box = temp->value.box;
+                ComputeParentHeightPercent(box, parent_box.height);
 
-        UI::Root(&ui, root_style, [&]
-        {
-           CreateMockUI(root);
+                if(box.height_unit != Unit::Type::AVAILABLE_PERCENT)
+                {
+                    box.height = Clamp(box.height, box.min_height, box.max_height);
 
-           // ===== Rendering Selected/Hovered Boxes ====
-            if(hovered_node)
-            {
-                auto dim = hovered_node->box.dim;
-                BoxStyle hovered_box_style =
+                    //detached boxes cannot be AVAILABLE_PERCENT
+                    if(!box.IsDetached()) //Ignore detached boxes
+                        available_height -= box.GetBoxModelHeight() + parent_box.gap_row;
+                }
+                else
                 {
-                    .x = dim.x,
-                    .y = dim.y,
-                    .width = {dim.width},
-                    .height = {dim.height},
-                    .border_color = {255, 233, 233, 255},
-                    .border_width = 2,
-                    .detach = Detach::ABSOLUTE
-                };
-                Box(hovered_box_style).Run();
+                    grow_items.Push(GrowItem{&box, (float)box.height, (float)box.min_height, (float)box.max_height});
+                    available_height -= box.GetBoxExpansionHeight() + parent_box.gap_row;
+                    total_percent += box.height;
+                }
             }
-            if(selected_node)
-            {
-                auto dim = selected_node->box.dim;
-                BoxStyle selected_box_style =
-                {
-                    .x = dim.x,
-                    .y = dim.y,
-                    .width = {dim.width},
-                    .height = {dim.height},
-                    .border_color = {255, 100, 100, 255},
-                    .border_width = 2,
-                    .detach = Detach::ABSOLUTE
-                };
+            available_height += parent_box.gap_row;
 
-                Box(selected_box_style).Run();
+            if(!grow_items.IsEmpty())
+            {
+                SolveAvailablePercent(available_height, total_percent);
+                for(uint32_t i = 0; i < grow_items.Size(); i++)
+                    grow_items[i].box->height = Max(grow_items[i].box->min_height, (uint16_t)grow_items[i].result);
+                grow_items.Clear();
             }
-            // ==========================================
-            CreateDebugUI();
-
-        });
 
-        this->mouse_x = GetMouseX();
-        this->mouse_y = GetMouseY();
+        } //End Vertical
+        else // Horizontal
+        {
+            for(temp = child; temp != nullptr; temp = temp->next)
+            {
+                BoxCore& box = temp->value.box;
+                if(box.height_unit == Unit::Type::AVAILABLE_PERCENT)
+                    box.height_unit = Unit::Type::PARENT_PERCENT;
+                ComputeParentHeightPercent(box, parent_box.height);
+                box.height = Clamp(box.height, box.min_height, box.max_height);
+            }
+        }
     }
-    bool DebugInspector::AutoCloseTreeView(TreeNodeDebug* node)
+    void Context::HeightPass_Grid(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box)
     {
-        if(!node)
-            return false;
+        assert(child);
+        int cell_height = parent_box.GetGridCellHeight();
+        for(auto temp = child; temp!=nullptr; temp = temp->next)
+        {
+            BoxCore& box = temp->value.box;
+            if(box.height_unit == Unit::Type::AVAILABLE_PERCENT)
+                box.height_unit = Unit::Type::PARENT_PERCENT;
+            ComputeParentHeightPercent(box, cell_height * box.grid_span_y + parent_box.gap_row * (box.grid_span_y - 1));
+            box.height = Clamp(box.height, box.min_height, box.max_height);
+        }
+    }
 
-        bool found = false;
-        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
-            found = &temp->value == selected_node || AutoCloseTreeView(&temp->value) || found;
-        node->box.is_open = found;
 
-        return found;
-    }
-    void DebugInspector::CreateMockUI(TreeNodeDebug* node)
+    /*
+        This is an important path for measuring text height and generating
+        the line spans that will be saved in BoxResult
+    */
+    void Context::HeightContentPercentPass_Flow(TreeNode<BoxCore>* node)
     {
-        if(node == nullptr)
-            return;
-
-        if(node->box.line_break)
+        assert(node);
+        BoxCore& parent_box = node->box;
+        ArenaLL<TreeNode<BoxCore>>::Node* child = node->children.GetHead();
+        int content_height = 0;
+        if(parent_box.GetFlowAxis() == Flow::Axis::HORIZONTAL)
         {
-            LineBreak();
+            int largest_height = 0;
+            for(ArenaLL<TreeNode<BoxCore>>::Node* temp = child; temp != nullptr; temp = temp->next)
+            {
+                BoxCore& box = temp->value.box;
+
+                if(box.IsDetached()) //Ignore layout for detached boxes
+                    continue;
+
+                /* Measure text height here (old way)
+                if(box.text)
+                {
+                    //Width should be computed by this point
+                    Markdown md;
+                    box.width = Min(parent_box.width, box.width);
+                    md.SetInput(box.text, box.width, INT_MAX);
+                    while(md.ComputeNextTextRun()){}
+                    box.height = md.GetMeasuredHeight();
+                }
+                */
+                if(box.IsTextElement())
+                {
+                    this->ComputeTextLinesAndHeight(box);
+                }
+
+
+                //Ignoring these values
+                if(box.height_unit != Unit::Type::AVAILABLE_PERCENT &&
+                    box.height_unit != Unit::Type::PARENT_PERCENT &&
+                    box.min_height_unit != Unit::Type::PARENT_PERCENT &&
+                    box.max_height_unit != Unit::Type::PARENT_PERCENT)
+                {
+                    box.height = Clamp(box.height, box.min_height, box.max_height);
+                    int height = box.GetBoxModelHeight();
+                    if(largest_height < height)
+                        largest_height = height;
+                }
+                else
+                {
+                    int height = box.GetBoxExpansionHeight() + box.min_height;
+                    if(largest_height < height)
+                        largest_height = height;
+                }
+            }
+            content_height = largest_height;
         }
-        else if(node->box.text.IsEmpty())
+        else //Vertical
         {
-            Box(node->box.style)
-            .Id(Fmt("node-id:%llu", (uintptr_t)node))
-            .OnDirectHover([&]
+            for(ArenaLL<TreeNode<BoxCore>>::Node* temp = child; temp != nullptr; temp = temp->next)
             {
-                hovered_node = node;
-                if(IsMousePressed(MouseButton::MOUSE_LEFT))
+                BoxCore& box = temp->value.box;
+
+                if(box.IsDetached()) //Ignore layout for detached boxes
+                    continue;
+
+                /* Measure text height here
+                if(box.text)
                 {
-                    selected_node = node;
-                    AutoCloseTreeView(root);
+                    //Width should be computed by this point
+                    Markdown md;
+                    box.width = Min(parent_box.width, box.width);
+                    md.SetInput(box.text, box.width, INT_MAX);
+                    while(md.ComputeNextTextRun()){}
+                    box.height = md.GetMeasuredHeight();
                 }
+                */
 
-            })
-            .PreRun([&]
-            {
-                node->box.dim = {Info().DrawX(), Info().DrawY(), Info().DrawWidth(), Info().DrawHeight()};
-            })
-            .Run([&]
-            {
-                for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
-                    CreateMockUI(&temp->value);
-            });
+                if(box.IsTextElement())
+                {
+                    this->ComputeTextLinesAndHeight(box);
+                }
+
+                //Ignoring these values
+                if(box.height_unit != Unit::Type::AVAILABLE_PERCENT &&
+                    box.height_unit != Unit::Type::PARENT_PERCENT &&
+                    box.min_height_unit != Unit::Type::PARENT_PERCENT &&
+                    box.max_height_unit != Unit::Type::PARENT_PERCENT)
+                {
+                    box.height = Clamp(box.height, box.min_height, box.max_height);
+                    content_height += box.GetBoxModelHeight();
+                }
+                else
+                {
+                    content_height += box.GetBoxExpansionHeight() + box.min_height;
+                }
+                content_height += parent_box.gap_row;
+            }
+            content_height -= parent_box.gap_row;
         }
-        else
+        if(parent_box.height_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.height = parent_box.height * content_height / 100;
+        if(parent_box.min_height_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.min_height = parent_box.min_height * content_height / 100;
+        if(parent_box.max_height_unit == Unit::Type::CONTENT_PERCENT)
+            parent_box.max_height = parent_box.max_height * content_height / 100;
+    }
+    void Context::HeightContentPercentPass_Grid(TreeNode<BoxCore>* node)
+    {
+        assert(node);
+        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
         {
-            Text(node->box.text_style, node->box.text);
+            BoxCore& box = temp->value.box;
+            if(box.IsDetached())
+                continue;
+            if(box.IsTextElement())
+                this->ComputeTextLinesAndHeight(box);
         }
     }
 
-    void DebugInspector::CreateDebugUI()
+
+    //Post order, text lines are generated once the widths are known
+    void Context::HeightContentPercentPass(TreeNode<BoxCore>* root)
     {
-        BoxStyle base =
+        if(!root)
+            return;
+        ArenaStack<CoreFrame> frames;
+        bool pushed = frames.Push(CoreFrame{root, root->children.GetHead()}, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
         {
-            .flow =
+            CoreFrame& frame = frames.Peek();
+            if(frame.next_child)
             {
-                .axis = Flow::VERTICAL,
-                //.horizontal_alignment = Flow::CENTERED,
-            },
-            .x = base_dim.x,
-            .y = base_dim.y,
-            .width = {base_dim.width},
-            .height = {base_dim.height},
-            .color = theme.black1,
-            .border_color = theme.black0,
-            .corner_radius = 5,
-            .border_width = 2,
-            .detach = Detach::ABSOLUTE
-        };
-        base.color.a = 200;
-
-        BoxStyle title_bar =
+                TreeNode<BoxCore>* child = &frame.next_child->value;
+                frame.next_child = frame.next_child->next;
+                pushed = frames.Push(CoreFrame{child, child->children.GetHead()}, &arena1);
+                assert(pushed && "Arena out of memory");
+                continue;
+            }
+            TreeNode<BoxCore>* node = frame.node;
+            frames.Pop();
+            HeightContentPercentPass_Node(node);
+        }
+        frames.RewindArena(&arena1);
+    }
+    void Context::HeightContentPercentPass_Node(TreeNode<BoxCore>* node)
+    {
+        if(node->box.GetLayout() == Layout::FLOW)
         {
-            //.y = -12,
-            .width = {100, Unit::PARENT_PERCENT},
-            .height = {100, Unit::CONTENT_PERCENT},
-            .min_width = {100, Unit::CONTENT_PERCENT},
-            .padding = {10, 10, 5, 5},
-            .color = theme.black1,
-            .border_color = theme.black0,
-            .corner_radius = 5,
-            .border_width = 2,
-        };
+            HeightContentPercentPass_Flow(node);
+        }
+        else
+        {
+            HeightContentPercentPass_Grid(node);
+        }
+    }
 
-        TextStyle title_bar_text;
-        title_bar_text.FgColor(theme.white0).FontSize(24);
 
-        BoxStyle resize_button =
-        {
-            .width = {14},
-            .height = {14},
-            .color = theme.white0,
-            .detach = Detach::BOTTOM_END
-        };
 
-        BoxStyle h_container =
+    //Pre order, the parent places its children before they add their own margin/padding offsets
+    void Context::PositionPass(TreeNode<BoxCore>* root)
+    {
+        if(root == nullptr)
+            return;
+        root->box.result_rel_x += root->box.margin.left;
+        root->box.result_rel_y += root->box.margin.top;
+
+        ArenaStack<TreeNode<BoxCore>*> nodes;
+        bool pushed = nodes.Push(root, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!nodes.IsEmpty())
+        {
+            TreeNode<BoxCore>* node = nodes.Peek();
+            nodes.Pop();
+            PositionPass_Node(node);
+            for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+            {
+                pushed = nodes.Push(&temp->value, &arena1);
+                assert(pushed && "Arena out of memory");
+            }
+        }
+        nodes.RewindArena(&arena1);
+    }
+    void Context::PositionPass_Node(TreeNode<BoxCore>* node)
+    {
+        if(node->children.IsEmpty())
+            return;
+        BoxCore& box = node->box;
+        if(box.GetLayout() == Layout::FLOW)
+        {
+            PositionPass_Flow(node->children.GetHead(), box);
+        }
+        else
+        {
+            PositionPass_Grid(node->children.GetHead(), box);
+        }
+        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+        {
+            BoxCore& child = temp->value.box;
+            child.result_rel_x += box.padding.left + child.margin.left;
+            child.result_rel_y += box.padding.top + child.margin.top;
+        }
+    }
+    void Context::PositionPass_Flow(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, BoxCore& parent)
+    {
+        assert(child);
+        int content_height = 0;
+        int content_width = 0;
+        if(parent.GetFlowAxis() == Flow::HORIZONTAL)
+        {
+            int count = 0;
+            for(auto temp = child; temp != nullptr; temp = temp->next)
+            {
+                const BoxCore& box = temp->value.box;
+                if(box.IsDetached()) continue;
+                count++;
+                content_width += box.GetBoxModelWidth();
+            }
+            content_width += Max(0, count - 1) * parent.gap_column;
+            int cursor_x = 0;
+            int offset = 0;
+            int available_width = parent.width - content_width;
+            switch(parent.flow_horizontal_alignment)
+            {
+                case Flow::END:             cursor_x = available_width; break;
+                case Flow::CENTERED:        cursor_x = available_width/2; break;
+                case Flow::SPACE_AROUND:    cursor_x = offset = available_width / (count + 1); break;
+                case Flow::SPACE_BETWEEN:   if(count > 1) offset = available_width / (count - 1); break;
+                default: break;
+            }
+            for(auto temp = child; temp != nullptr; temp = temp->next)
+            {
+                BoxCore& box = temp->value.box;
+                if(box.IsDetached())
+                    continue;
+                int cursor_y = 0;
+                int box_height = box.GetBoxModelHeight();
+                if(content_height < box_height)
+                    content_height = box_height;
+                int available_height = parent.height - box_height;
+                switch(parent.flow_vertical_alignment)
+                {
+                    case Flow::START:   break;
+                    case Flow::END:     cursor_y = available_height; break;
+                    default:            cursor_y = available_height/2; break;
+                }
+
+                box.result_rel_x = cursor_x;
+                box.result_rel_y = cursor_y;
+
+                cursor_x += box.GetBoxModelWidth() + parent.gap_column + offset;
+            }
+        }
+        else
+        {
+            int count = 0;
+            for(auto temp = child; temp != nullptr; temp = temp->next)
+            {
+                const BoxCore& box = temp->value.box;
+                if(box.IsDetached()) continue;
+                count++;
+                content_height += box.GetBoxModelHeight();
+            }
+            content_height += Max(0, count - 1) * parent.gap_row;
+            int cursor_y = 0;
+            int offset = 0;
+            int available_height = parent.height - content_height;
+            switch(parent.flow_vertical_alignment)
+            {
+                case Flow::END:             cursor_y = available_height; break;
+                case Flow::CENTERED:        cursor_y = available_height/2; break;
+                case Flow::SPACE_AROUND:    cursor_y = offset = available_height / (count + 1); break;
+                case Flow::SPACE_BETWEEN:   if(count > 1) offset = available_height / (count - 1); break;
+                default: break;
+            }
+            for(auto temp = child; temp != nullptr; temp = temp->next)
+            {
+                BoxCore& box = temp->value.box;
+                if(box.IsDetached())
+                    continue;
+                int cursor_x = 0;
+                int box_width = box.GetBoxModelWidth();
+                if(content_width < box_width)
+                    content_width = box_width;
+                int available_width = parent.width - box_width;
+                switch(parent.flow_horizontal_alignment)
+                {
+                    case Flow::START:   break;
+                    case Flow::END:     cursor_x = available_width; break;
+                    default:            cursor_x = available_width/2; break;
+                }
+
+                box.result_rel_x = cursor_x;
+                box.result_rel_y = cursor_y;
+
+                cursor_y += box.GetBoxModelHeight() + parent.gap_row + offset;
+            }
+        }
+        parent.result_content_width = content_width;
+        parent.result_content_height = content_height;
+    }
+    void Context::PositionPass_Grid(Internal::ArenaLL<TreeNode<BoxCore>>::Node* child, BoxCore& parent)
+    {
+        assert(child);
+        int cell_width = parent.GetGridCellWidth() + parent.gap_column;
+        int cell_height = parent.GetGridCellHeight() + parent.gap_row;
+        for(auto temp = child; temp!=nullptr; temp = temp->next)
+        {
+            BoxCore& box = temp->value.box;
+            box.result_rel_x = cell_width * box.grid_x;
+            box.result_rel_y = cell_height * box.grid_y;
+        }
+    }
+
+    void Context::DetachedBoxesPass(TreeNode<BoxResult>* root, int parent_x, int parent_y)
+    {
+        if(!root || !root->box.core)
+            return;
+        ResultFrame frame;
+        frame.node = root;
+        frame.next_child = root->children.GetHead();
+        frame.x = root->box.core->x + root->box.rel_x + parent_x - root->box.core->scroll_x;
+        frame.y = root->box.core->y + root->box.rel_y + parent_y - root->box.core->scroll_y;
+
+        ArenaStack<ResultFrame> frames;
+        bool pushed = frames.Push(frame, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
+        {
+            ResultFrame& parent = frames.Peek();
+            if(!parent.next_child)
+            {
+                frames.Pop();
+                continue;
+            }
+            TreeNode<BoxResult>* node = &parent.next_child->value;
+            parent.next_child = parent.next_child->next;
+
+            assert(node->box.core);
+            const BoxResult& parent_result = parent.node->box;
+            int x = parent.x;
+            int y = parent.y;
+            if(node->box.core->IsDetached())
+            {
+                AddDetachedBoxToQueue(node, {parent.x, parent.y, parent_result.draw_width, parent_result.draw_height});
+                assert(deferred_elements.GetTail());
+                x = deferred_elements.GetTail()->value.x;
+                y = deferred_elements.GetTail()->value.y;
+            }
+            if(node->children.IsEmpty())
+                continue;
+
+            frame.node = node;
+            frame.next_child = node->children.GetHead();
+            frame.x = node->box.core->x + node->box.rel_x + x - node->box.core->scroll_x;
+            frame.y = node->box.core->y + node->box.rel_y + y - node->box.core->scroll_y;
+            pushed = frames.Push(frame, &arena1);
+            assert(pushed && "Arena out of memory");
+        }
+        frames.RewindArena(&arena1);
+    }
+
+    void Context::AddDetachedBoxToQueue(TreeNode<BoxResult>* node, const Rect& parent)
+    {
+        assert(node);
+        const BoxResult& box = node->box;
+        assert(box.core);
+
+        DeferredBox result;
+        result.node = node;
+
+        switch(box.core->detach)
+        {
+           case Detach::LEFT:
+                result.x = box.draw_height;
+                break;
+            case Detach::RIGHT:
+                result.x = parent.width;
+                break;
+            case Detach::TOP:
+                result.y = -box.draw_height;
+                break;
+            case Detach::BOTTOM:
+                result.y = parent.height;
+                break;
+           case Detach::LEFT_CENTER:
+                result.x = box.draw_width;
+                result.y = (parent.height - box.draw_height)/2;
+                break;
+            case Detach::RIGHT_CENTER:
+                result.x = parent.width;
+                result.y = (parent.height - box.draw_height)/2;
+                break;
+            case Detach::TOP_CENTER:
+                result.x = (parent.width - box.draw_width)/2;
+                result.y = -box.draw_height;
+                break;
+            case Detach::BOTTOM_CENTER:
+                result.x = (parent.width - box.draw_width)/2;
+                result.y = parent.height;
+                break;
+           case Detach::LEFT_END:
+                result.x = box.draw_width;
+                result.y = parent.height - box.draw_height;
+                break;
+            case Detach::RIGHT_END:
+                result.x = parent.width;
+                result.y = parent.height - box.draw_height;
+                break;
+            case Detach::TOP_END:
+                result.x = parent.width - box.draw_width;
+                result.y = -box.draw_height;
+                break;
+            case Detach::BOTTOM_END:
+                result.x = parent.width - box.draw_width;
+                result.y = parent.height;
+                break;
+            default:
+                break;
+        }
+        result.x += parent.x;
+        result.y += parent.y;
+
+        auto err = deferred_elements.Add(result, &arena2);
+        assert(err && "Arena2 out of memory");
+    }
+
+    void Context::GenerateComputedTree()
+    {
+        if(!tree_core)
+            return;
+
+        tree_result = arena2.New<TreeNode<BoxResult>>();
+        assert(tree_result && "Arena2 out of memory");
+        tree_result->box.SetComputedResults(tree_core->box);
+
+        //Walks both trees at the same time, the result nodes are added in the same order as the core nodes
+        struct Frame
+        {
+            ArenaLL<TreeNode<BoxCore>>::Node* next_child = nullptr;
+            TreeNode<BoxResult>* result = nullptr;
+        };
+        ArenaStack<Frame> frames;
+        bool pushed = frames.Push(Frame{tree_core->children.GetHead(), tree_result}, &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
+        {
+            Frame& frame = frames.Peek();
+            if(!frame.next_child)
+            {
+                frames.Pop();
+                continue;
+            }
+            TreeNode<BoxCore>* core_node = &frame.next_child->value;
+            frame.next_child = frame.next_child->next;
+
+            TreeNode<BoxResult> node;
+            node.box.SetComputedResults(core_node->box);
+
+            TreeNode<BoxResult>* result_node = frame.result->children.Add(node, &arena2);
+            assert(result_node && "Arena2 out of memory");
+
+            if(!core_node->children.IsEmpty())
+            {
+                pushed = frames.Push(Frame{core_node->children.GetHead(), result_node}, &arena1);
+                assert(pushed && "Arena out of memory");
+            }
+        }
+        frames.RewindArena(&arena1);
+    }
+
+    //scissor_aabb is the parents aabb
+    void Context::DrawPass(TreeNode<BoxResult>* root, int parent_x, int parent_y, Rect scissor_aabb)
+    {
+        if(!root || !root->box.core)
+            return;
+
+        ArenaStack<ResultFrame> frames;
+        bool pushed = frames.Push(DrawBox(root, parent_x, parent_y, scissor_aabb), &arena1);
+        assert(pushed && "Arena out of memory");
+        while(!frames.IsEmpty())
+        {
+            ResultFrame& frame = frames.Peek();
+            if(!frame.next_child)
+            {
+                frames.Pop();
+                continue;
+            }
+            TreeNode<BoxResult>* child = &frame.next_child->value;
+            frame.next_child = frame.next_child->next;
+
+            assert(child->box.core);
+            if(child->box.core->IsDetached())
+                continue;
+
+            pushed = frames.Push(DrawBox(child, frame.x, frame.y, frame.scissor_aabb), &arena1);
+            assert(pushed && "Arena out of memory");
+        }
+        frames.RewindArena(&arena1);
+    }
+    void Context::DrawDeferredBoxes()
+    {
+        for(auto node = deferred_elements.GetHead(); node != nullptr; node = node->next)
+        {
+            const DeferredBox& box = node->value;
+            DrawPass(box.node, box.x, box.y, {0, 0, input.screen_width, input.screen_height});
+        }
+    }
+
+    Context::ResultFrame Context::DrawBox(TreeNode<BoxResult>* node, int parent_x, int parent_y, Rect scissor_aabb)
+    {
+        assert(node && node->box.core);
+        BoxResult& box_result = node->box;
+        BoxCore& box_core = *node->box.core;
+
+        Rect draw;
+        draw.x = box_core.x + box_result.rel_x + parent_x;
+        draw.y = box_core.y + box_result.rel_y + parent_y;
+        draw.width = box_result.draw_width;
+        draw.height = box_result.draw_height;
+        bool should_render = Rect::Overlap(scissor_aabb, draw);
+
+        if(should_render && (draw_flags & DRAW_RENDER))
+        {
+            //Render current box
+            if(box_core.IsTextElement())
+            {
+                if(box_result.text_lines)
+                    DrawTextLines(*box_result.text_lines, draw.x, draw.y, scissor_aabb);
+            }
+            else if(box_core.texture.HasTexture())
+            {
+                DrawCommand command;
+                command.type = DrawCommand::Type::TEXTURE;
+                command.batch_key = (uintptr_t)box_core.texture.texture;
+                command.bounds = draw;
+                command.clip = scissor_aabb;
+                command.texture = box_core.texture;
+                PushDrawCommand(command);
+            }
+            else
+            {
+                PushRectangle(draw, scissor_aabb, box_core.corner_radius, box_core.border_width, box_core.border_color, box_core.background_color);
+            }
+        }
+
+
+        //Input handling
+        Rect new_aabb = Rect::Intersection(scissor_aabb, draw);
+        if(box_core.id_key && (draw_flags & DRAW_HIT_TEST))
+            InsertBoxInfo(box_core, box_result, draw, new_aabb, should_render);
+
+        ResultFrame frame;
+        frame.node = node;
+        frame.next_child = node->children.GetHead();
+        frame.scissor_aabb = box_core.IsScissor()? new_aabb: scissor_aabb;
+        //Children boxes are offset by the scroll
+        frame.x = draw.x - box_core.scroll_x;
+        frame.y = draw.y - box_core.scroll_y;
+        return frame;
+    }
+    void Context::InsertBoxInfo(const BoxCore& box, const BoxResult& result, const Rect& draw, const Rect& visible_aabb, bool is_rendered)
+    {
+        BoxInfo info;
+        info.is_rendered = is_rendered;
+        info.key = box.id_key;
+        info.x = draw.x;
+        info.y = draw.y;
+        info.padding = box.padding;
+        info.width = box.width;
+        info.height = box.height;
+        info.content_width = result.content_width;
+        info.content_height = result.content_height;
+        if(Rect::Contains(visible_aabb, input.mouse_x, input.mouse_y))
+        {
+            info.is_hover = true;
+            if(directly_hovered_element_key != box.id_key)
+                directly_hovered_element_key = box.id_key;
+        }
+        const BoxInfo* front_value = double_buffer_map.FrontValue(info.key);
+        if(front_value)
+            info.state = front_value->state;
+        BoxInfo* box_info = double_buffer_map.Insert(info.key, info);
+        assert(box_info && "DoubleBufferMap out of memory");
+    }
+    void Context::DrawTextLines(const TextLines& text, int x, int y, const Rect& clip)
+    {
+        const ArrayView<TextLine>& lines = text.lines;
+        int top = clip.y - y;
+        int bottom = clip.y + clip.height - y;
+        int left = clip.x - x;
+        int right = clip.x + clip.width - x;
+
+        //Binary search for the first row at or below top
+        uint64_t first = 0;
+        uint64_t count = lines.Size();
+        while(count > 0)
+        {
+            uint64_t half = count / 2;
+            if(lines[first + half].y < top)
+            {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else
+                count = half;
+        }
+        //Rows above top can still reach into the clip
+        while(first > 0)
+        {
+            int row_y = lines[first - 1].y;
+            uint64_t row_start = first;
+            bool is_visible = false;
+            while(row_start > 0 && lines[row_start - 1].y == row_y)
+            {
+                row_start--;
+                is_visible |= row_y + text.GetStyle(lines[row_start]).GetFontSize() > top;
+            }
+            if(!is_visible)
+                break;
+            first = row_start;
+        }
+
+        for(uint64_t i = first; i < lines.Size() && lines[i].y < bottom; i++)
+        {
+            const TextLine& line = lines[i];
+            const TextStyle& style = text.GetStyle(line);
+            StringU32 string = text.GetString(line);
+            if(line.x >= right || line.x + line.width <= left)
+                continue;
+            PushRectangle({x + line.x, y + line.y, line.width, style.GetFontSize()}, clip, 0, 0, {}, style.GetBgColor());
+
+            //Long lines skip the glyphs outside the clip, glyphs advance by MeasureChar_impl like in the layout
+            int start = 0;
+            int end = (int)string.Size();
+            int start_x = line.x;
+            if(line.x < left || line.x + line.width > right)
+            {
+                int glyph_x = line.x;
+                for(int c = 0; c < (int)string.Size(); c++)
+                {
+                    int glyph_width = MeasureChar_impl(string[c], style);
+                    if(glyph_x + glyph_width <= left)
+                    {
+                        start = c + 1;
+                        start_x = glyph_x + glyph_width;
+                    }
+                    else if(glyph_x >= right)
+                    {
+                        end = c;
+                        break;
+                    }
+                    glyph_x += glyph_width;
+                }
+            }
+            if(start < end)
+            {
+                DrawCommand command;
+                command.type = DrawCommand::Type::TEXT;
+                command.batch_key = DrawCommand::TEXT_KEY;
+                //The glyphs stay inside the line, the culled ones are left out of the bounds
+                command.bounds = {x + start_x, y + line.y, line.x + line.width - start_x, style.GetFontSize()};
+                command.clip = clip;
+                command.style = &style;
+                command.text = string.data + start;
+                command.text_size = end - start;
+                PushDrawCommand(command);
+            }
+        }
+    }
+    static bool IsSameRect(const Rect& a, const Rect& b)
+    {
+        return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+    }
+    //scissor is the region set in the backend, the whole screen needs none
+    static void ReplayDrawCommand(const DrawCommand& command, Rect& scissor, const Rect& screen)
+    {
+        if(!IsSameRect(command.clip, scissor))
+        {
+            scissor = command.clip;
+            if(IsSameRect(scissor, screen))
+                EndScissorMode_impl();
+            else
+                BeginScissorMode_impl(scissor);
+        }
+        switch(command.type)
+        {
+            case DrawCommand::Type::RECTANGLE:
+                DrawRectangle_impl(command.bounds.x, command.bounds.y, command.bounds.width, command.bounds.height, command.corner_radius, command.border_width, command.border_color, command.background_color);
+                break;
+            case DrawCommand::Type::TEXTURE:
+                DrawTexturedRectangle_impl(command.bounds.x, command.bounds.y, command.bounds.width, command.bounds.height, command.texture);
+                break;
+            case DrawCommand::Type::TEXT:
+                DrawText_impl(*command.style, command.bounds.x, command.bounds.y, command.text, command.text_size);
+                break;
+        }
+    }
+    void Context::PushDrawCommand(const DrawCommand& command)
+    {
+        draw_commands.Push(command);
+    }
+    void Context::PushRectangle(const Rect& bounds, const Rect& clip, float corner_radius, float border_width, Color border_color, Color background_color)
+    {
+        //Invisible boxes would only split batches
+        if(!background_color.a && (!border_width || !border_color.a))
+            return;
+        DrawCommand command;
+        command.type = DrawCommand::Type::RECTANGLE;
+        command.batch_key = DrawCommand::SHAPES_KEY;
+        command.bounds = bounds;
+        command.clip = clip;
+        command.corner_radius = corner_radius;
+        command.border_width = border_width;
+        command.border_color = border_color;
+        command.background_color = background_color;
+        PushDrawCommand(command);
+    }
+    /*
+        Commands of one scissor region are placed into batches in tree order. A command joins the latest batch
+        with its texture when no batch after it overlaps the command, otherwise it starts a new batch.
+        Replaying the batches in order keeps every overlapping pair in painter's order.
+    */
+    void Context::BatchDrawCommands(uint32_t first, uint32_t end)
+    {
+        draw_batches.Clear();
+        for(uint32_t i = first; i < end; i++)
+        {
+            const DrawCommand& command = draw_commands[i];
+            uint32_t target = UINT32_MAX;
+            uint32_t lookback_end = draw_batches.Size() - Min(draw_batches.Size(), MAX_BATCH_LOOKBACK);
+            for(uint32_t b = draw_batches.Size(); b > lookback_end; b--)
+            {
+                if(draw_batches[b - 1].key == command.batch_key)
+                {
+                    target = b - 1;
+                    break;
+                }
+                if(OverlapsBatch(b - 1, command.bounds))
+                    break;
+            }
+            draw_command_next[i] = UINT32_MAX;
+            if(target == UINT32_MAX)
+            {
+                DrawBatch batch;
+                batch.key = command.batch_key;
+                batch.bounds = command.bounds;
+                batch.first = i;
+                batch.last = i;
+                batch.count = 1;
+                draw_batches.Push(batch);
+                continue;
+            }
+            DrawBatch& batch = draw_batches[target];
+            draw_command_next[batch.last] = i;
+            batch.last = i;
+            batch.count++;
+            int right = Max(batch.bounds.x + batch.bounds.width, command.bounds.x + command.bounds.width);
+            int bottom = Max(batch.bounds.y + batch.bounds.height, command.bounds.y + command.bounds.height);
+            batch.bounds.x = Min(batch.bounds.x, command.bounds.x);
+            batch.bounds.y = Min(batch.bounds.y, command.bounds.y);
+            batch.bounds.width = right - batch.bounds.x;
+            batch.bounds.height = bottom - batch.bounds.y;
+        }
+    }
+    bool Context::OverlapsBatch(uint32_t batch_index, const Rect& bounds) const
+    {
+        const DrawBatch& batch = draw_batches[batch_index];
+        if(!Rect::Overlap(batch.bounds, bounds))
+            return false;
+        if(batch.count > MAX_BATCH_OVERLAP_TESTS)
+            return true;
+        for(uint32_t i = batch.first; i != UINT32_MAX; i = draw_command_next[i])
+        {
+            if(Rect::Overlap(draw_commands[i].bounds, bounds))
+                return true;
+        }
+        return false;
+    }
+    void Context::FlushDrawCommands()
+    {
+        //Counts the texture and scissor switches of the commands in the order they are visited
+        uint32_t* batches = nullptr;
+        uintptr_t last_key = 0;
+        Rect last_clip;
+        auto CountBatch = [&](const DrawCommand& command)
+        {
+            if(!*batches || command.batch_key != last_key || !IsSameRect(command.clip, last_clip))
+                (*batches)++;
+            last_key = command.batch_key;
+            last_clip = command.clip;
+        };
+
+        draw_stats = DrawStats();
+        draw_stats.command_count = draw_commands.Size();
+        batches = &draw_stats.batches_before;
+        for(uint32_t i = 0; i < draw_commands.Size(); i++)
+            CountBatch(draw_commands[i]);
+
+        draw_order.Clear();
+        draw_order.Reserve(draw_commands.Size());
+        draw_command_next.Resize(draw_commands.Size());
+        uint32_t region_start = 0;
+        while(region_start < draw_commands.Size())
+        {
+            uint32_t region_end = region_start + 1;
+            while(region_end < draw_commands.Size() && IsSameRect(draw_commands[region_end].clip, draw_commands[region_start].clip))
+                region_end++;
+            if(is_draw_sorting)
+            {
+                BatchDrawCommands(region_start, region_end);
+                for(uint32_t b = 0; b < draw_batches.Size(); b++)
+                {
+                    for(uint32_t i = draw_batches[b].first; i != UINT32_MAX; i = draw_command_next[i])
+                        draw_order.Push(i);
+                }
+            }
+            else
+            {
+                for(uint32_t i = region_start; i < region_end; i++)
+                    draw_order.Push(i);
+            }
+            region_start = region_end;
+        }
+        batches = &draw_stats.batches_after;
+        for(uint32_t i = 0; i < draw_order.Size(); i++)
+            CountBatch(draw_commands[draw_order[i]]);
+
+        if(frame_ring)
+            PublishFramePacket();
+        else
+        {
+            const Rect screen = {0, 0, input.screen_width, input.screen_height};
+            Rect scissor = screen;
+            for(uint32_t i = 0; i < draw_order.Size(); i++)
+                ReplayDrawCommand(draw_commands[draw_order[i]], scissor, screen);
+            if(!IsSameRect(scissor, screen))
+                EndScissorMode_impl();
+        }
+        draw_commands.Clear();
+    }
+    void Context::PublishFramePacket()
+    {
+        FramePacket* packet = frame_ring->BeginWrite();
+        if(!packet)
+            return;
+        packet->screen = {0, 0, input.screen_width, input.screen_height};
+        packet->frame_index = frame_index;
+        packet->commands.Clear();
+        packet->text.Clear();
+        packet->styles.Clear();
+
+        //Reserved up front so the pointers into the packet stay valid
+        uint32_t text_size = 0;
+        uint32_t text_count = 0;
+        for(uint32_t i = 0; i < draw_commands.Size(); i++)
+        {
+            if(draw_commands[i].type == DrawCommand::Type::TEXT)
+            {
+                text_size += draw_commands[i].text_size;
+                text_count++;
+            }
+        }
+        packet->commands.Reserve(draw_order.Size());
+        packet->text.Reserve(text_size);
+        packet->styles.Reserve(text_count);
+        for(uint32_t i = 0; i < draw_order.Size(); i++)
+        {
+            DrawCommand command = draw_commands[draw_order[i]];
+            if(command.type == DrawCommand::Type::TEXT)
+            {
+                uint32_t offset = packet->text.Size();
+                packet->text.Resize(offset + command.text_size);
+                std::memcpy(packet->text.Data() + offset, command.text, command.text_size * sizeof(char32_t));
+                packet->styles.Push(*command.style);
+                command.text = packet->text.Data() + offset;
+                command.style = &packet->styles.Back();
+            }
+            packet->commands.Push(command);
+        }
+        frame_ring->EndWrite();
+    }
+    void Context::SetDrawSorting(bool flag)
+    {
+        is_draw_sorting = flag;
+    }
+    bool Context::IsDrawSorting() const
+    {
+        return is_draw_sorting;
+    }
+    const DrawStats& Context::GetDrawStats() const
+    {
+        return draw_stats;
+    }
+
+    void* Context::FrameAllocate(uint64_t bytes, uint8_t alignment)
+    {
+        void* data = arena3.Allocate(bytes, alignment);
+        assert(data && "Frame arena out of memory");
+        if(data)
+            frame_alloc_bytes += bytes;
+        return data;
+    }
+    StringU32 Context::FrameString(const char* fmt, va_list args)
+    {
+        //Short texts are formatted on the stack so only the utf32 copy takes frame memory
+        char buffer[256];
+        va_list measure_args;
+        va_copy(measure_args, args);
+        int count = vsnprintf(buffer, sizeof(buffer), fmt, measure_args);
+        va_end(measure_args);
+        if(count <= 0)
+            return StringU32();
+        const char* ascii = buffer;
+        if(count >= (int)sizeof(buffer))
+        {
+            char* long_buffer = (char*)FrameAllocate(count + 1, alignof(char));
+            if(!long_buffer)
+                return StringU32();
+            vsnprintf(long_buffer, count + 1, fmt, args);
+            ascii = long_buffer;
+        }
+        char32_t* text = (char32_t*)FrameAllocate(count * sizeof(char32_t), alignof(char32_t));
+        if(!text)
+            return StringU32();
+        for(int i = 0; i < count; i++)
+            text[i] = (unsigned char)ascii[i];
+        return StringU32(text, count);
+    }
+    MemoryStats Context::GetMemoryStats() const
+    {
+        MemoryStats stats;
+        stats.frame_alloc_bytes = frame_alloc_bytes;
+        stats.frame_arena_bytes = arena3.GetOffset();
+        stats.frame_arena_capacity = arena3.Capacity();
+        stats.tree_arena_bytes = arena1.GetOffset();
+        stats.layout_arena_bytes = arena2.GetOffset();
+        stats.committed_bytes = arena1.GetCommitted() + arena2.GetCommitted() + arena3.GetCommitted();
+        for(uint32_t i = 0; fragments && i <= build_thread_count; i++)
+        {
+            const Context* fragment = fragments[i];
+            stats.frame_arena_bytes += fragment->arena3.GetOffset();
+            stats.frame_arena_capacity += fragment->arena3.Capacity();
+            stats.tree_arena_bytes += fragment->arena1.GetOffset();
+            stats.committed_bytes += fragment->arena1.GetCommitted() + fragment->arena3.GetCommitted();
+        }
+        return stats;
+    }
+    void Context::SetFrameRing(FrameRing* ring)
+    {
+        frame_ring = ring;
+    }
+    void Context::SetCapture(CaptureRecorder* recorder)
+    {
+        assert(!owner && "Fragments are recorded with their owner");
+        capture = recorder;
+    }
+
+    void ReplayFramePacket(const FramePacket& packet)
+    {
+        Rect scissor = packet.screen;
+        for(uint32_t i = 0; i < packet.commands.Size(); i++)
+            ReplayDrawCommand(packet.commands[i], scissor, packet.screen);
+        if(!IsSameRect(scissor, packet.screen))
+            EndScissorMode_impl();
+    }
+
+    FramePacket* FrameRing::BeginWrite()
+    {
+        uint64_t index = written.load(std::memory_order_relaxed) & ~CLOSED_BIT;
+        while(true)
+        {
+            uint64_t read_value = read.load(std::memory_order_acquire);
+            if(read_value & CLOSED_BIT)
+                return nullptr;
+            if(index - read_value < CAPACITY)
+                return &packets[index % CAPACITY];
+            read.wait(read_value, std::memory_order_acquire);
+        }
+    }
+    void FrameRing::EndWrite()
+    {
+        written.fetch_add(1, std::memory_order_release);
+        written.notify_one();
+    }
+    const FramePacket* FrameRing::BeginRead()
+    {
+        uint64_t index = read.load(std::memory_order_relaxed) & ~CLOSED_BIT;
+        while(true)
+        {
+            uint64_t written_value = written.load(std::memory_order_acquire);
+            if((written_value & ~CLOSED_BIT) > index)
+                return &packets[index % CAPACITY];
+            if(written_value & CLOSED_BIT)
+                return nullptr;
+            written.wait(written_value, std::memory_order_acquire);
+        }
+    }
+    const FramePacket* FrameRing::TryBeginRead()
+    {
+        uint64_t index = read.load(std::memory_order_relaxed) & ~CLOSED_BIT;
+        if((written.load(std::memory_order_acquire) & ~CLOSED_BIT) > index)
+            return &packets[index % CAPACITY];
+        return nullptr;
+    }
+    void FrameRing::EndRead()
+    {
+        read.fetch_add(1, std::memory_order_release);
+        read.notify_one();
+    }
+    void FrameRing::Close()
+    {
+        written.fetch_or(CLOSED_BIT, std::memory_order_release);
+        read.fetch_or(CLOSED_BIT, std::memory_order_release);
+        written.notify_all();
+        read.notify_all();
+    }
+    bool FrameRing::IsClosed() const
+    {
+        return written.load(std::memory_order_acquire) & CLOSED_BIT;
+    }
+    void Context::RunLayoutCallbacks()
+    {
+        for(auto node = layout_callbacks.GetHead(); node != nullptr; node = node->next)
+        {
+            const LayoutCallback& callback = node->value;
+            //Boxes that were not in this frame's tree have no info
+            const BoxInfo* info = double_buffer_map.BackValue(callback.key);
+            if(!info)
+                continue;
+            BoxInfo current = *info;
+            current.is_direct_hover = directly_hovered_element_key == current.key;
+            callback.invoke(callback.func, current);
+        }
+        layout_callbacks.Clear();
+    }
+
+    void Context::SetBuildThreads(uint32_t count, uint64_t arena_bytes, uint64_t string_bytes)
+    {
+        assert(!owner && "Build threads of a build thread");
+        StopBuildThreads();
+        if(!count)
+            return;
+        build_thread_count = count;
+        fragments = new Context*[count + 1];
+        for(uint32_t i = 0; i <= count; i++)
+            fragments[i] = new Context(this, arena_bytes, string_bytes);
+        is_build_stopping.store(false);
+        uint64_t generation = build_generation.load();
+        build_workers = new std::thread[count];
+        for(uint32_t i = 0; i < count; i++)
+            build_workers[i] = std::thread(&Context::BuildWorkerLoop, this, i + 1, generation);
+    }
+    uint32_t Context::GetBuildThreads() const
+    {
+        return build_thread_count;
+    }
+    void Context::StopBuildThreads()
+    {
+        if(!build_workers)
+            return;
+        is_build_stopping.store(true);
+        build_generation.fetch_add(1, std::memory_order_release);
+        build_generation.notify_all();
+        for(uint32_t i = 0; i < build_thread_count; i++)
+            build_workers[i].join();
+        delete[] build_workers;
+        build_workers = nullptr;
+        for(uint32_t i = 0; i <= build_thread_count; i++)
+            delete fragments[i];
+        delete[] fragments;
+        fragments = nullptr;
+        build_thread_count = 0;
+    }
+
+    /*
+        Every worker takes part in every ParallelFor(), even when the other threads took all the chunks,
+        so a generation is never missed and nothing is changed while a late worker still reads it.
+        The boxes only need the owner's read only state: the root box, styles, input and the infos of last frame.
+        Each box's own info is written by the thread that builds it.
+    */
+    void Context::ParallelFor_impl(uint32_t count, void (*invoke)(void* func, uint32_t index), void* func)
+    {
+        bool is_serial = !build_thread_count || count < 2 || owner;
+        #if UI_ENABLE_DEBUG
+            is_serial |= is_debug_mode && inspector != nullptr; //The inspector needs every box in order
+        #endif
+        if(is_serial)
+        {
+            for(uint32_t i = 0; i < count; i++)
+            {
+                prev_inserted_box = nullptr;
+                invoke(func, i);
+            }
+            prev_inserted_box = nullptr;
+            return;
+        }
+        if(HasInternalError())
+            return;
+        if(stack.IsEmpty())
+        {
+            HandleInternalError(Error{Error::Type::ROOT_NODE_CONTRADICTION, "Missing BeginRoot()"});
+            return;
+        }
+        prev_inserted_box = nullptr;
+
+        uint32_t thread_count = build_thread_count + 1;
+        uint32_t chunk_count = std::min(count, thread_count * CHUNKS_PER_BUILD_THREAD);
+        build_chunks.Clear();
+        for(uint32_t i = 0; i < chunk_count; i++)
+        {
+            BuildChunk chunk;
+            chunk.begin = (uint64_t)count * i / chunk_count;
+            chunk.end = (uint64_t)count * (i + 1) / chunk_count;
+            build_chunks.Push(chunk);
+        }
+        build_invoke = invoke;
+        build_func = func;
+        build_parent = stack.Peek();
+        for(uint32_t i = 0; i < thread_count; i++)
+        {
+            Context* fragment = fragments[i];
+            fragment->internal_error = Error();
+            fragment->element_count = 0;
+            fragment->frame_alloc_bytes = 0;
+            fragment->is_animating = false;
+            fragment->tree_core = tree_core;
+        }
+        next_build_chunk.store(0, std::memory_order_relaxed);
+        finished_build_workers.store(0, std::memory_order_relaxed);
+        build_generation.fetch_add(1, std::memory_order_release);
+        build_generation.notify_all();
+
+        BuildChunks(fragments[0]);
+        uint32_t finished = finished_build_workers.load(std::memory_order_acquire);
+        while(finished != build_thread_count)
+        {
+            finished_build_workers.wait(finished, std::memory_order_acquire);
+            finished = finished_build_workers.load(std::memory_order_acquire);
+        }
+
+        for(uint32_t i = 0; i < thread_count; i++)
+        {
+            Context* fragment = fragments[i];
+            element_count += fragment->element_count;
+            frame_alloc_bytes += fragment->frame_alloc_bytes;
+            is_animating |= fragment->is_animating;
+            if(fragment->HasInternalError() && !HasInternalError())
+                internal_error = fragment->internal_error; //Already displayed by the fragment
+        }
+        if(HasInternalError())
+            return;
+        for(uint32_t i = 0; i < build_chunks.Size(); i++)
+        {
+            build_parent->children.Append(build_chunks[i].node->children);
+            layout_callbacks.Append(build_chunks[i].layout_callbacks);
+        }
+    }
+    void Context::BuildChunks(Context* fragment)
+    {
+        //The global functions build into the context on top of this thread's stack
+        context_stack.Push(fragment);
+        builder.SetContext(fragment);
+        while(true)
+        {
+            uint32_t index = next_build_chunk.fetch_add(1, std::memory_order_relaxed);
+            if(index >= build_chunks.Size())
+                break;
+            BuildChunk& chunk = build_chunks[index];
+            while(!fragment->stack.IsEmpty())
+                fragment->stack.Pop();
+            while(!fragment->memo_stack.IsEmpty())
+                fragment->memo_stack.Pop();
+            fragment->layout_callbacks.Clear();
+
+            chunk.node = fragment->arena1.New<TreeNode<BoxCore>>();
+            assert(chunk.node && "Arena out of memory");
+            chunk.node->box = build_parent->box; //So EndBox() checks the children against the real parent
+            bool pushed = fragment->stack.Push(chunk.node, &fragment->arena1);
+            assert(pushed && "Arena out of memory");
+            for(uint32_t i = chunk.begin; i < chunk.end; i++)
+            {
+                fragment->prev_inserted_box = nullptr;
+                build_invoke(build_func, i);
+            }
+            if(!fragment->HasInternalError() && (fragment->stack.Size() != 1 || !fragment->memo_stack.IsEmpty()))
+                fragment->HandleInternalError(Error{Error::Type::MISSING_END, "Missing EndBox() inside ParallelFor()"});
+            chunk.layout_callbacks = fragment->layout_callbacks;
+        }
+        context_stack.Pop();
+        if(!context_stack.IsEmpty())
+            builder.SetContext(context_stack.Peek());
+    }
+    void Context::BuildWorkerLoop(uint32_t worker, uint64_t generation)
+    {
+        while(true)
+        {
+            build_generation.wait(generation, std::memory_order_acquire);
+            generation = build_generation.load(std::memory_order_acquire);
+            if(is_build_stopping.load())
+                return;
+            BuildChunks(fragments[worker]);
+            finished_build_workers.fetch_add(1, std::memory_order_release);
+            finished_build_workers.notify_one();
+        }
+    }
+
+
+    /*
+        Capture file: a CaptureHeader followed by records that start with a varint tag.
+        Every frame is a CAPTURE_FRAME record, the records that build its tree and CAPTURE_END_FRAME.
+        Style records append to tables shared by all later frames, so frames can only be replayed after
+        the file was indexed from its start. Structs are written as they are in memory
+    */
+    enum CaptureRecord : uint8_t
+    {
+        CAPTURE_FRAME = 1,      //InputSnapshot, BoxStyle of the root
+        CAPTURE_BOX_STYLE,      //BoxCore
+        CAPTURE_TEXT_STYLE,     //TextStyle
+        CAPTURE_BOX,            //varint box style index
+        CAPTURE_BOX_ID,         //varint box style index, uint64_t id key
+        CAPTURE_END_BOX,
+        CAPTURE_TEXT,           //varint span count, every span: varint text style index, varint byte count, UTF-8
+        CAPTURE_END_FRAME,
+    };
+    struct CaptureHeader
+    {
+        char magic[4] = {'U', 'I', 'C', 'P'};
+        uint32_t version = 1;
+        //A different build lays out the structs differently
+        uint32_t box_core_size = sizeof(BoxCore);
+        uint32_t box_style_size = sizeof(BoxStyle);
+        uint32_t text_style_size = sizeof(TextStyle);
+        uint32_t input_size = sizeof(InputSnapshot);
+    };
+    static_assert(std::is_trivially_copyable_v<BoxCore> && std::is_trivially_copyable_v<BoxStyle>, "Captures copy styles as bytes");
+    static_assert(std::is_trivially_copyable_v<InputSnapshot>, "Captures copy the input as bytes");
+
+    //Bounds checked reads from a mapped capture
+    struct CaptureReader
+    {
+        const uint8_t* data = nullptr;
+        uint64_t size = 0;
+        uint64_t offset = 0;
+        bool Read(void* dst, uint64_t byte_count)
+        {
+            if(byte_count > size - offset)
+                return false;
+            memcpy(dst, data + offset, byte_count);
+            offset += byte_count;
+            return true;
+        }
+        bool Skip(uint64_t byte_count)
+        {
+            if(byte_count > size - offset)
+                return false;
+            offset += byte_count;
+            return true;
+        }
+        bool ReadVarint(uint64_t& value)
+        {
+            value = 0;
+            for(uint32_t shift = 0; shift < 64 && offset < size; shift += 7)
+            {
+                uint8_t byte = data[offset++];
+                value |= (uint64_t)(byte & 0x7f) << shift;
+                if(!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+    };
+
+    static uint32_t Utf8Size(char32_t c)
+    {
+        return c < 0x80? 1: c < 0x800? 2: c < 0x10000? 3: 4;
+    }
+    //dst needs byte_count characters, returns the number written
+    static uint64_t DecodeUtf8(const uint8_t* src, uint64_t byte_count, char32_t* dst)
+    {
+        uint64_t count = 0;
+        uint64_t i = 0;
+        while(i < byte_count)
+        {
+            uint8_t byte = src[i];
+            uint32_t length = byte < 0x80? 1: byte < 0xe0? 2: byte < 0xf0? 3: 4;
+            if(length > byte_count - i)
+                break;
+            char32_t c = length == 1? byte: byte & (0x7f >> length);
+            for(uint32_t j = 1; j < length; j++)
+                c = (c << 6) | (src[i + j] & 0x3f);
+            dst[count++] = c;
+            i += length;
+        }
+        return count;
+    }
+
+    CaptureRecorder::~CaptureRecorder()
+    {
+        Close();
+    }
+    bool CaptureRecorder::Open(const char* path)
+    {
+        Close();
+        box_styles.Clear();
+        text_styles.Clear();
+        box_records.Clear();
+        text_records.Clear();
+        box_style_count = 0;
+        text_style_count = 0;
+        frame_count = 0;
+        byte_count = 0;
+        file = std::fopen(path, "wb");
+        if(!file)
+            return false;
+        CaptureHeader header;
+        if(std::fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            Close();
+            return false;
+        }
+        byte_count = sizeof(header);
+        return true;
+    }
+    void CaptureRecorder::Close()
+    {
+        if(file)
+            std::fclose(file);
+        file = nullptr;
+    }
+    bool CaptureRecorder::IsOpen() const
+    {
+        return file;
+    }
+    uint32_t CaptureRecorder::GetFrameCount() const
+    {
+        return frame_count;
+    }
+    uint64_t CaptureRecorder::GetByteCount() const
+    {
+        return byte_count;
+    }
+    void CaptureRecorder::WriteBytes(const void* src, uint64_t count)
+    {
+        uint32_t offset = buffer.Size();
+        buffer.Resize(offset + count);
+        memcpy(buffer.Data() + offset, src, count);
+    }
+    void CaptureRecorder::WriteVarint(uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            buffer.Push((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        buffer.Push((uint8_t)value);
+    }
+    uint32_t CaptureRecorder::GetBoxStyleIndex(const BoxCore& box)
+    {
+        //Only what BeginBox() sets is kept, the rest belongs to this frame's tree.
+        //Copied field by field into zeroed bytes so the padding does not make equal styles differ
+        BoxCore style;
+        std::memset((void*)&style, 0, sizeof(style));
+        style.texture.x = box.texture.x;
+        style.texture.y = box.texture.y;
+        style.texture.width = box.texture.width;
+        style.texture.height = box.texture.height;
+        style.background_color = box.background_color;
+        style.border_color = box.border_color;
+        style.scroll_x = box.scroll_x;
+        style.scroll_y = box.scroll_y;
+        style.width = box.width;
+        style.height = box.height;
+        style.min_width = box.min_width;
+        style.max_width = box.max_width;
+        style.min_height = box.min_height;
+        style.max_height = box.max_height;
+        style.gap_row = box.gap_row;
+        style.gap_column = box.gap_column;
+        style.x = box.x;
+        style.y = box.y;
+        style.width_unit = box.width_unit;
+        style.height_unit = box.height_unit;
+        style.min_width_unit = box.min_width_unit;
+        style.max_width_unit = box.max_width_unit;
+        style.min_height_unit = box.min_height_unit;
+        style.max_height_unit = box.max_height_unit;
+        style.grid_row_count = box.grid_row_count;
+        style.grid_column_count = box.grid_column_count;
+        style.grid_x = box.grid_x;
+        style.grid_y = box.grid_y;
+        style.grid_span_x = box.grid_span_x;
+        style.grid_span_y = box.grid_span_y;
+        style.flow_vertical_alignment = box.flow_vertical_alignment;
+        style.flow_horizontal_alignment = box.flow_horizontal_alignment;
+        style.corner_radius = box.corner_radius;
+        style.border_width = box.border_width;
+        style.padding = box.padding;
+        style.margin = box.margin;
+        style.layout = box.layout;
+        style.detach = box.detach;
+        style.type = box.type;
+        style.SetFlowAxis(box.GetFlowAxis());
+        style.SetScissor(box.IsScissor());
+
+        //A different style under the same hash moves on to the next key
+        uint64_t key = HashBytes(&style, sizeof(style));
+        key = key? key: 1;
+        uint32_t* index = box_styles.GetValue(key);
+        while(index && std::memcmp(box_records.Data() + (uint64_t)*index * sizeof(style), &style, sizeof(style)) != 0)
+        {
+            key = HashCombine(key, 1);
+            key = key? key: 1;
+            index = box_styles.GetValue(key);
+        }
+        if(index)
+            return *index;
+        WriteVarint(CAPTURE_BOX_STYLE);
+        WriteBytes(&style, sizeof(style));
+        uint32_t offset = box_records.Size();
+        box_records.Resize(offset + sizeof(style));
+        memcpy(box_records.Data() + offset, &style, sizeof(style));
+        box_styles.Insert(key, box_style_count);
+        return box_style_count++;
+    }
+    uint32_t CaptureRecorder::GetTextStyleIndex(const TextStyle& text_style)
+    {
+        TextStyle style;
+        std::memset((void*)&style, 0, sizeof(style));
+        style.fg_color = text_style.fg_color;
+        style.bg_color = text_style.bg_color;
+        style.font_size = text_style.font_size;
+        style.font_spacing = text_style.font_spacing;
+        style.line_spacing = text_style.line_spacing;
+
+        uint64_t key = HashBytes(&style, sizeof(style));
+        key = key? key: 1;
+        uint32_t* index = text_styles.GetValue(key);
+        while(index && std::memcmp(text_records.Data() + (uint64_t)*index * sizeof(style), &style, sizeof(style)) != 0)
+        {
+            key = HashCombine(key, 1);
+            key = key? key: 1;
+            index = text_styles.GetValue(key);
+        }
+        if(index)
+            return *index;
+        WriteVarint(CAPTURE_TEXT_STYLE);
+        WriteBytes(&style, sizeof(style));
+        uint32_t offset = text_records.Size();
+        text_records.Resize(offset + sizeof(style));
+        memcpy(text_records.Data() + offset, &style, sizeof(style));
+        text_styles.Insert(key, text_style_count);
+        return text_style_count++;
+    }
+    void CaptureRecorder::WriteText(BoxCore& box)
+    {
+        //Style records go before the text record
+        uint32_t span_count = 0;
+        for(auto span = box.text_style_spans.GetHead(); span != nullptr; span = span->next)
+        {
+            GetTextStyleIndex(span->value.style);
+            span_count++;
+        }
+        WriteVarint(CAPTURE_TEXT);
+        WriteVarint(span_count);
+        for(auto span = box.text_style_spans.GetHead(); span != nullptr; span = span->next)
+        {
+            const TextSpan& text = span->value;
+            uint64_t byte_count = 0;
+            for(uint64_t i = 0; i < text.Size(); i++)
+                byte_count += Utf8Size(text.data[i]);
+            WriteVarint(GetTextStyleIndex(text.style));
+            WriteVarint(byte_count);
+            for(uint64_t i = 0; i < text.Size(); i++)
+            {
+                char32_t c = text.data[i];
+                uint32_t length = Utf8Size(c);
+                if(length == 1)
+                {
+                    buffer.Push((uint8_t)c);
+                    continue;
+                }
+                buffer.Push((uint8_t)((0xf00 >> length) | (c >> (6 * (length - 1)))));
+                for(uint32_t j = length - 1; j > 0; j--)
+                    buffer.Push((uint8_t)(0x80 | ((c >> (6 * (j - 1))) & 0x3f)));
+            }
+        }
+    }
+    void CaptureRecorder::WriteFrame(const InputSnapshot& input, const BoxStyle& root_style, TreeNode<BoxCore>* root)
+    {
+        if(!file)
+            return;
+        buffer.Clear();
+        BoxStyle style = root_style;
+        style.texture.texture = nullptr;
+        WriteVarint(CAPTURE_FRAME);
+        WriteBytes(&input, sizeof(input));
+        WriteBytes(&style, sizeof(style));
+
+        //Pre order, walk holds the next sibling of every open box
+        walk.Clear();
+        ArenaLL<TreeNode<BoxCore>>::Node* node = root->children.GetHead();
+        while(true)
+        {
+            if(!node)
+            {
+                if(walk.IsEmpty())
+                    break;
+                node = walk.Back();
+                walk.Pop();
+                WriteVarint(CAPTURE_END_BOX);
+                continue;
+            }
+            BoxCore& box = node->value.box;
+            if(box.type == BoxCore::Type::TEXT)
+            {
+                WriteText(box);
+                node = node->next;
+                continue;
+            }
+            uint32_t index = GetBoxStyleIndex(box);
+            WriteVarint(box.id_key? CAPTURE_BOX_ID: CAPTURE_BOX);
+            WriteVarint(index);
+            if(box.id_key)
+                WriteBytes(&box.id_key, sizeof(box.id_key));
+            walk.Push(node->next);
+            node = node->value.children.GetHead();
+        }
+        WriteVarint(CAPTURE_END_FRAME);
+
+        if(std::fwrite(buffer.Data(), 1, buffer.Size(), file) != buffer.Size())
+        {
+            assert(0 && "Failed to write the capture");
+            Close();
+            return;
+        }
+        byte_count += buffer.Size();
+        frame_count++;
+    }
+
+    CaptureReplayer::~CaptureReplayer()
+    {
+        Close();
+    }
+    bool CaptureReplayer::Open(const char* path)
+    {
+        Close();
+        #if UI_VIRTUAL_MEMORY
+            int fd = ::open(path, O_RDONLY);
+            if(fd < 0)
+                return false;
+            struct stat info;
+            if(fstat(fd, &info) != 0 || info.st_size <= 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd); //The mapping keeps the file open
+            if(mapping == MAP_FAILED)
+                return false;
+            data = (const uint8_t*)mapping;
+            size = info.st_size;
+            is_mapped = true;
+        #else
+            std::FILE* file = std::fopen(path, "rb");
+            if(!file)
+                return false;
+            std::fseek(file, 0, SEEK_END);
+            long file_size = std::ftell(file);
+            std::fseek(file, 0, SEEK_SET);
+            if(file_size <= 0)
+            {
+                std::fclose(file);
+                return false;
+            }
+            uint8_t* bytes = new uint8_t[file_size];
+            bool is_read = std::fread(bytes, 1, file_size, file) == (size_t)file_size;
+            std::fclose(file);
+            data = bytes;
+            size = file_size;
+            if(!is_read)
+            {
+                Close();
+                return false;
+            }
+        #endif
+
+        CaptureReader reader{data, size, 0};
+        CaptureHeader header;
+        CaptureHeader expected;
+        if(!reader.Read(&header, sizeof(header)) || memcmp(&header, &expected, sizeof(header)) != 0)
+        {
+            Close();
+            return false;
+        }
+        //Indices are checked here so ReplayFrame() only has to follow them
+        uint64_t frame_offset = 0;
+        bool is_in_frame = false;
+        bool is_valid = true;
+        while(is_valid && reader.offset < size)
+        {
+            uint64_t record_offset = reader.offset;
+            uint64_t tag = 0;
+            uint64_t value = 0;
+            if(!reader.ReadVarint(tag))
+                break;
+            switch(tag)
+            {
+            case CAPTURE_FRAME:
+                frame_offset = record_offset;
+                is_in_frame = true;
+                is_valid = reader.Skip(sizeof(InputSnapshot) + sizeof(BoxStyle));
+                break;
+            case CAPTURE_BOX_STYLE:
+            {
+                BoxCore style;
+                is_valid = reader.Read(&style, sizeof(style));
+                #if UI_ENABLE_DEBUG
+                    style.debug_info = DebugInfo(); //Recorded as zeroes
+                #endif
+                if(is_valid)
+                    box_styles.Push(style);
+                break;
+            }
+            case CAPTURE_TEXT_STYLE:
+            {
+                TextStyle style;
+                is_valid = reader.Read(&style, sizeof(style));
+                if(is_valid)
+                    text_styles.Push(style);
+                break;
+            }
+            case CAPTURE_BOX:
+            case CAPTURE_BOX_ID:
+                is_valid = reader.ReadVarint(value) && value < box_styles.Size();
+                if(is_valid && tag == CAPTURE_BOX_ID)
+                    is_valid = reader.Skip(sizeof(uint64_t));
+                break;
+            case CAPTURE_END_BOX:
+                break;
+            case CAPTURE_TEXT:
+            {
+                uint64_t span_count = 0;
+                is_valid = reader.ReadVarint(span_count);
+                for(uint64_t i = 0; is_valid && i < span_count; i++)
+                {
+                    is_valid = reader.ReadVarint(value) && value < text_styles.Size() &&
+                        reader.ReadVarint(value) && reader.Skip(value);
+                }
+                break;
+            }
+            case CAPTURE_END_FRAME:
+                is_valid = is_in_frame;
+                if(is_valid)
+                    frames.Push(frame_offset);
+                is_in_frame = false;
+                break;
+            default:
+                is_valid = false;
+            }
+        }
+        return true;
+    }
+    void CaptureReplayer::Close()
+    {
+        #if UI_VIRTUAL_MEMORY
+            if(data && is_mapped)
+                munmap((void*)data, size);
+        #endif
+        if(data && !is_mapped)
+            delete[] data;
+        data = nullptr;
+        size = 0;
+        is_mapped = false;
+        box_styles.Clear();
+        text_styles.Clear();
+        frames.Clear();
+    }
+    bool CaptureReplayer::IsOpen() const
+    {
+        return data;
+    }
+    uint32_t CaptureReplayer::GetFrameCount() const
+    {
+        return frames.Size();
+    }
+    void CaptureReplayer::SetTexture(void* texture)
+    {
+        this->texture = texture;
+    }
+    bool CaptureReplayer::ReplayFrame(Context* context, uint32_t frame)
+    {
+        assert(context);
+        if(frame >= frames.Size())
+            return false;
+        CaptureReader reader{data, size, frames[frame]};
+        uint64_t tag = 0;
+        InputSnapshot input;
+        BoxStyle root_style;
+        reader.ReadVarint(tag);
+        reader.Read(&input, sizeof(input));
+        reader.Read(&root_style, sizeof(root_style));
+        context->SetInput(input);
+        UI::BeginRoot(context, root_style);
+
+        while(reader.ReadVarint(tag) && tag != CAPTURE_END_FRAME)
+        {
+            uint64_t index = 0;
+            switch(tag)
+            {
+            case CAPTURE_BOX_STYLE:
+                reader.Skip(sizeof(BoxCore));
+                break;
+            case CAPTURE_TEXT_STYLE:
+                reader.Skip(sizeof(TextStyle));
+                break;
+            case CAPTURE_BOX:
+            case CAPTURE_BOX_ID:
+            {
+                uint64_t id_key = 0;
+                reader.ReadVarint(index);
+                if(tag == CAPTURE_BOX_ID)
+                    reader.Read(&id_key, sizeof(id_key));
+                //Same checks as BeginBox(), the styles were validated when they were recorded
+                if(context->HasInternalError() || context->stack.IsEmpty())
+                    break;
+                const BoxCore& style = box_styles[index];
+                if(style.type != BoxCore::Type::IMAGE)
+                {
+                    context->BeginBoxCore(style, id_key);
+                    break;
+                }
+                BoxCore image = style;
+                if(texture)
+                    image.texture.texture = texture;
+                else
+                    image.type = BoxCore::Type::BOX;
+                context->BeginBoxCore(image, id_key);
+                break;
+            }
+            case CAPTURE_END_BOX:
+                context->EndBox();
+                break;
+            case CAPTURE_TEXT:
+            {
+                uint64_t span_count = 0;
+                reader.ReadVarint(span_count);
+                context->NewLine(); //Every text record is its own text box
+                for(uint64_t i = 0; i < span_count; i++)
+                {
+                    uint64_t byte_count = 0;
+                    reader.ReadVarint(index);
+                    reader.ReadVarint(byte_count);
+                    const uint8_t* utf8 = data + reader.offset;
+                    reader.Skip(byte_count);
+                    //Decoded into the frame arena, which InsertText() does not copy again
+                    char32_t* text = (char32_t*)context->arena3.Allocate(byte_count * sizeof(char32_t), alignof(char32_t));
+                    assert(text && "Arena3 out of memory");
+                    if(!text)
+                        break;
+                    uint64_t count = DecodeUtf8(utf8, byte_count, text);
+                    context->InsertText(text_styles[index], StringU32(text, count));
+                }
+                break;
+            }
+            }
+        }
+        UI::EndRoot();
+        return true;
+    }
+
+    DebugInspector::DebugInspector(uint64_t bytes) : arena(bytes/3), ui(bytes/3, bytes/3)
+    {
+
+    }
+    int DebugInspector::GetMouseDeltaX()
+    {
+        return ui.GetInput().mouse_x - mouse_x;
+    }
+    int DebugInspector::GetMouseDeltaY()
+    {
+        return ui.GetInput().mouse_y - mouse_y;
+    }
+    void DebugInspector::Push(BoxDebug box)
+    {
+        if(!box.id.IsEmpty())
+        {
+            box.id.data = arena.NewArrayCopy(box.id.data, box.id.Size());
+            assert(box.id.data && "DebugInspector out of memory");
+        }
+        if(!root)
+        {
+            root = arena.New<TreeNodeDebug>();
+            assert(root && "Inspector out of memory");
+            root->box = box;
+            bool pushed = stack.Push(root, &arena);
+            assert(pushed && "Inspector out of memory");
+            return;
+        }
+        assert(!stack.IsEmpty());
+        TreeNodeDebug* parent = stack.Peek(); assert(parent);
+        TreeNodeDebug* child = parent->children.Add(TreeNodeDebug(box), &arena);
+        assert(child && "Inspector out of memory");
+        bool pushed = stack.Push(child, &arena);
+        assert(pushed && "Inspector out of memory");
+    }
+    void DebugInspector::Pop()
+    {
+        assert(!stack.IsEmpty() && "Begin/End uneven");
+        stack.Pop();
+    }
+
+    void DebugInspector::Reset()
+    {
+        arena.Reset();
+        root = nullptr;
+        selected_node = nullptr;
+        hovered_node = nullptr;
+        stack.Clear();
+    }
+
+    void DebugInspector::Run()
+    {
+        assert(stack.IsEmpty());
+
+        BoxStyle root_style =
+        {
+            .width = {GetScreenWidth()},
+            .height = {GetScreenHeight()},
+        };
+
+        UI::Root(&ui, root_style, [&]
+        {
+           CreateMockUI(root);
+
+           // ===== Rendering Selected/Hovered Boxes ====
+            if(hovered_node)
+            {
+                auto dim = hovered_node->box.dim;
+                BoxStyle hovered_box_style =
+                {
+                    .x = dim.x,
+                    .y = dim.y,
+                    .width = {dim.width},
+                    .height = {dim.height},
+                    .border_color = {255, 233, 233, 255},
+                    .border_width = 2,
+                    .detach = Detach::ABSOLUTE
+                };
+                Box(hovered_box_style).Run();
+            }
+            if(selected_node)
+            {
+                auto dim = selected_node->box.dim;
+                BoxStyle selected_box_style =
+                {
+                    .x = dim.x,
+                    .y = dim.y,
+                    .width = {dim.width},
+                    .height = {dim.height},
+                    .border_color = {255, 100, 100, 255},
+                    .border_width = 2,
+                    .detach = Detach::ABSOLUTE
+                };
+
+                Box(selected_box_style).Run();
+            }
+            // ==========================================
+            CreateDebugUI();
+
+        });
+
+        this->mouse_x = ui.GetInput().mouse_x;
+        this->mouse_y = ui.GetInput().mouse_y;
+    }
+    bool DebugInspector::AutoCloseTreeView(TreeNodeDebug* node)
+    {
+        if(!node)
+            return false;
+
+        bool found = false;
+        for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+            found = &temp->value == selected_node || AutoCloseTreeView(&temp->value) || found;
+        node->box.is_open = found;
+
+        return found;
+    }
+    void DebugInspector::CreateMockUI(TreeNodeDebug* node)
+    {
+        if(node == nullptr)
+            return;
+
+        if(node->box.line_break)
+        {
+            LineBreak();
+        }
+        else if(node->box.text.IsEmpty())
+        {
+            Box(node->box.style)
+            .Id(Fmt("node-id:%llu", (uintptr_t)node))
+            .OnDirectHover([&]
+            {
+                hovered_node = node;
+                if(Input().IsMousePressed(MouseButton::MOUSE_LEFT))
+                {
+                    selected_node = node;
+                    AutoCloseTreeView(root);
+                }
+
+            })
+            .PreRun([&]
+            {
+                node->box.dim = {Info().DrawX(), Info().DrawY(), Info().DrawWidth(), Info().DrawHeight()};
+            })
+            .Run([&]
+            {
+                for(auto temp = node->children.GetHead(); temp != nullptr; temp = temp->next)
+                    CreateMockUI(&temp->value);
+            });
+        }
+        else
+        {
+            Text(node->box.text_style, node->box.text);
+        }
+    }
+
+    void DebugInspector::CreateDebugUI()
+    {
+        BoxStyle base =
+        {
+            .flow =
+            {
+                .axis = Flow::VERTICAL,
+                //.horizontal_alignment = Flow::CENTERED,
+            },
+            .x = base_dim.x,
+            .y = base_dim.y,
+            .width = {base_dim.width},
+            .height = {base_dim.height},
+            .color = theme.black1,
+            .border_color = theme.black0,
+            .corner_radius = 5,
+            .border_width = 2,
+            .detach = Detach::ABSOLUTE
+        };
+        base.color.a = 200;
+
+        BoxStyle title_bar =
+        {
+            //.y = -12,
+            .width = {100, Unit::PARENT_PERCENT},
+            .height = {100, Unit::CONTENT_PERCENT},
+            .min_width = {100, Unit::CONTENT_PERCENT},
+            .padding = {10, 10, 5, 5},
+            .color = theme.black1,
+            .border_color = theme.black0,
+            .corner_radius = 5,
+            .border_width = 2,
+        };
+
+        TextStyle title_bar_text;
+        title_bar_text.FgColor(theme.white0).FontSize(24);
+
+        BoxStyle resize_button =
+        {
+            .width = {14},
+            .height = {14},
+            .color = theme.white0,
+            .detach = Detach::BOTTOM_END
+        };
+
+        BoxStyle h_container =
         {
             .flow = { .axis = Flow::HORIZONTAL, .vertical_alignment = Flow::CENTERED},
             .width = {100, Unit::AVAILABLE_PERCENT},
@@ -2490,210 +5217,1187 @@ namespace UI
             .corner_radius = 2,
         };
 
-
-        Box(base)
-        .Run([&]
+
+        Box(base)
+        .Run([&]
+        {
+            Box(title_bar)
+            .Id("base_title_bar")
+            .PreRun([&]
+            {
+                if(IsDirectHover() && Input().IsMousePressed(MouseButton::MOUSE_LEFT))
+                    State().custom_flags = true;
+                //Disable Mouse dragging
+                if(Input().IsMouseReleased(MouseButton::MOUSE_LEFT))
+                    State().custom_flags = false;
+
+                //Drag if enabled
+                if(State().custom_flags)
+                {
+                    base_dim.x += GetMouseDeltaX();
+                    base_dim.y += GetMouseDeltaY();
+                }
+            })
+            .Run([&]
+            {
+                Text(title_bar_text, U"Inspector");
+            });
+            Box(h_container)
+            .Run([&]
+            {
+                Box(left_panel)
+                .Id("left-panel-scroll")
+                .OnHover([&]
+                {
+                    State().custom_anim -= Input().mouse_scroll * 30;
+                    State().custom_anim = (float)Clamp((int)State().custom_anim,0, Info().MaxScrollY());
+                })
+                .PreRun([&]
+                {
+                    Style().scroll_y = State().custom_anim;
+                })
+                .Run([&]
+                {
+                    Box(node_details_panel)
+                    .Run([&]
+                    {
+                        // Text(TextStyle{.fg_color = theme.black0, .font_size = 24}, U"Info\n");
+                        if(selected_node)
+                        {
+                            Internal::BoxDebug& box = selected_node->box;
+                            Color fg_color = theme.black0;
+                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"Name: ");
+                            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, box.debug_info.name);
+                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"\nline: ");
+                            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, Fmt("%d\n", box.debug_info.line));
+                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"id: ");
+                            Text(TextStyle{.fg_color = theme.yellow0, .font_size = 24}, selected_node->box.id);
+                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"\nFile: ");
+                            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, selected_node->box.debug_info.file);
+                        }
+                    });
+                    Box({.width = {100, Unit::AVAILABLE_PERCENT}, .height={1}, .margin = {0, 0, 5,6}, .color = theme.black0}).Run();
+                    this->CreateTreeView(this->root, 0);
+                });
+            });
+            Box(resize_button)
+            .Id("resize_button")
+            .PreRun([&]
+            {
+                if(IsDirectHover() && Input().IsMousePressed(MouseButton::MOUSE_LEFT))
+                    State().custom_flags = true;
+                //Disable Mouse dragging
+                if(Input().IsMouseReleased(MouseButton::MOUSE_LEFT))
+                    State().custom_flags = false;
+
+                //Drag if enabled
+                if(State().custom_flags)
+                {
+                    base_dim.width += GetMouseDeltaX();
+                    base_dim.height += GetMouseDeltaY();
+                    base_dim.width = Max(base_dim.width, 300);
+                    base_dim.height = Max(base_dim.height, 300);
+                }
+            })
+            .Run();
+        });
+
+
+
+    }
+    void DebugInspector::CreateTreeView(TreeNodeDebug* node, int depth)
+    {
+        if(!node)
+            return;
+        BoxStyle gap = {.width = {20}, .height = {100, Unit::AVAILABLE_PERCENT}};
+        BoxStyle bar =
+        {
+            .width = {1},
+            .height = {100, Unit::AVAILABLE_PERCENT},
+            .margin = {9, 9, 0, 0},
+            .color = theme.black0,
+        };
+        BoxStyle h_container =
+        {
+            .flow = {.vertical_alignment = Flow::CENTERED},
+            .width = {9999},
+            .height = {100, Unit::CONTENT_PERCENT},
+        };
+        BoxStyle icon_button =
+        {
+            .flow =
+            {
+                .vertical_alignment = Flow::CENTERED,
+                .horizontal_alignment = Flow::CENTERED
+            },
+            .width = {20},
+            .height = {20},
+            .border_color = theme.black0,
+            .corner_radius = 2,
+            .border_width = 1,
+        };
+        Color fg_color = theme.black0;
+        Color bg_color = theme.white0;
+        bool invert_color = selected_node == node || hovered_node == node;
+
+        Box(h_container)
+        .Id(Fmt("tree-element-%llu", (uintptr_t)node))
+        .PreRun([&]
         {
-            Box(title_bar)
-            .Id("base_title_bar")
-            .PreRun([&]
+            if(IsDirectHover())
             {
-                if(IsDirectHover() && IsMousePressed(MouseButton::MOUSE_LEFT))
-                    State().custom_flags = true;
-                //Disable Mouse dragging
-                if(IsMouseReleased(MouseButton::MOUSE_LEFT))
-                    State().custom_flags = false;
-
-                //Drag if enabled
-                if(State().custom_flags)
+                invert_color = true;
+                if(Input().IsMousePressed(MouseButton::MOUSE_LEFT))
                 {
-                    base_dim.x += GetMouseDeltaX();
-                    base_dim.y += GetMouseDeltaY();
+                    selected_node = node;
                 }
-            })
-            .Run([&]
+                hovered_node = node;
+            }
+            if(invert_color)
             {
-                Text(title_bar_text, U"Inspector");
-            });
-            Box(h_container)
-            .Run([&]
+                fg_color = theme.white0;
+                bg_color = theme.black0;
+                icon_button.border_color = fg_color;
+                Style().color = theme.black0;
+            }
+        })
+        .Run([&]
+        {
+            for(int i = 0; i < depth; i++)
             {
-                Box(left_panel)
-                .Id("left-panel-scroll")
-                .OnHover([&]
+                Box(bar).Run();
+                Box(gap).Run();
+            }
+
+            if(!node->children.IsEmpty())
+            {
+                Box(icon_button)
+                .Id(Fmt("tree-element-icon-%llu", (uintptr_t)node))
+                .PreRun([&]
                 {
-                    State().custom_anim -= GetMouseScroll() * 30;
-                    State().custom_anim = (float)Clamp((int)State().custom_anim,0, Info().MaxScrollY());
+                    if(node->box.is_open)
+                        Style().color = theme.green0;
                 })
-                .PreRun([&]
+                .OnDirectHover([&]
                 {
-                    Style().scroll_y = State().custom_anim;
+                    Style().color = theme.black0;
+                    icon_button.border_color = theme.white0;
+                    if(Input().IsMousePressed(MouseButton::MOUSE_LEFT))
+                        node->box.is_open = !node->box.is_open;
+
                 })
                 .Run([&]
                 {
-                    Box(node_details_panel)
-                    .Run([&]
-                    {
-                        // Text(TextStyle{.fg_color = theme.black0, .font_size = 24}, U"Info\n");
-                        if(selected_node)
-                        {
-                            Internal::BoxDebug& box = selected_node->box;
-                            Color fg_color = theme.black0;
-                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"Name: ");
-                            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, box.debug_info.name);
-                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"\nline: ");
-                            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, Fmt("%d\n", box.debug_info.line));
-                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"id: ");
-                            Text(TextStyle{.fg_color = theme.yellow0, .font_size = 24}, selected_node->box.id);
-                            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"\nFile: ");
-                            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, selected_node->box.debug_info.file);
-                        }
-                    });
-                    Box({.width = {100, Unit::AVAILABLE_PERCENT}, .height={1}, .margin = {0, 0, 5,6}, .color = theme.black0}).Run();
-                    this->CreateTreeView(this->root, 0);
+                    Text(TextStyle{.fg_color = icon_button.border_color, .font_size = 24}, (node->box.is_open? StringU32(U"-"): StringU32(U"+")));
                 });
-            });
-            Box(resize_button)
-            .Id("resize_button")
-            .PreRun([&]
+            }
+
+
+            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, node->box.debug_info.name);
+            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"  line: ");
+            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, Fmt("%d ", node->box.debug_info.line));
+
+            if(!node->box.text.IsEmpty())
+            {
+                Text(TextStyle{.fg_color = theme.green0, .font_size = 24}, U" \"");
+                Text(TextStyle{.fg_color = theme.green0, .font_size = 24}, node->box.text);
+                Text(TextStyle{.fg_color = theme.green0, .font_size = 24}, U"\" ");
+            }
+            if(!node->box.id.IsEmpty())
+            {
+                Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U" id: ");
+                Text(TextStyle{.fg_color = theme.yellow0, .font_size = 24}, node->box.id);
+            }
+
+        });
+
+        if(node->box.is_open)
+        {
+            for(auto temp = node->children.GetHead(); temp!=nullptr; temp = temp->next)
+            {
+                CreateTreeView(&temp->value, depth + 1);
+            }
+
+        }
+    }
+
+
+    /*
+        Greedy wrapping of [start, end) up to the first line break: breaks after the last space or before the character
+        that does not fit. Calls emit(start) for every wrapped line.
+        Returns the offset of the line break (or end), UINT64_MAX as soon as emit returns false.
+    */
+    template<typename CharAt, typename Emit>
+    uint64_t WrapLine(uint64_t start, uint64_t end, int wrap_width, const int* char_widths, CharAt&& char_at, Emit&& emit)
+    {
+        if(!emit(start))
+            return UINT64_MAX;
+        uint64_t line_start = start;
+        uint64_t break_pos = start; //After the last space of the line
+        int width = 0;
+        int break_width = 0;
+        for(uint64_t i = start; i < end; i++)
+        {
+            char c = char_at(i);
+            if(c == '\n')
+                return i;
+            int char_width = char_widths[(uint8_t)c];
+            if(width + char_width > wrap_width && i > line_start)
+            {
+                if(break_pos > line_start)
+                {
+                    line_start = break_pos;
+                    width -= break_width;
+                }
+                else
+                {
+                    line_start = i;
+                    width = 0;
+                }
+                if(!emit(line_start))
+                    return UINT64_MAX;
+            }
+            width += char_width;
+            if(c == ' ')
+            {
+                break_pos = i + 1;
+                break_width = width;
+            }
+        }
+        return end;
+    }
+
+    bool WrappedLines::SetLayout(int width, const TextStyle& style)
+    {
+        bool is_changed = width != wrap_width || style.GetFontSize() != this->style.GetFontSize() ||
+            style.GetFontSpacing() != this->style.GetFontSpacing() || style.GetLineSpacing() != this->style.GetLineSpacing();
+        this->style = style;
+        if(!is_changed)
+            return false;
+        wrap_width = width;
+        max_char_width = 0;
+        for(int c = 0; c < 256; c++)
+        {
+            char_widths[c] = (c == '\n' || c == '\r')? 0: MeasureChar_impl((char32_t)c, style);
+            max_char_width = Max(max_char_width, char_widths[c]);
+        }
+        return true;
+    }
+    int WrappedLines::GetLineHeight() const
+    {
+        return Max(1, style.GetFontSize() + style.GetLineSpacing());
+    }
+    int64_t WrappedLines::GetContentHeight() const
+    {
+        return (int64_t)line_starts.Size() * GetLineHeight();
+    }
+    void WrappedLines::SetScrollY(int64_t scroll_y)
+    {
+        if(scroll_y < this->scroll_y)
+            is_at_end = false;
+        this->scroll_y = Max((int64_t)0, scroll_y);
+    }
+    void WrappedLines::GetVisibleLines(int view_height, uint32_t& first, uint32_t& last)
+    {
+        int line_height = GetLineHeight();
+        int64_t max_scroll = Max((int64_t)0, GetContentHeight() - view_height);
+        if(follow_tail && is_at_end)
+            scroll_y = max_scroll;
+        scroll_y = Clamp(scroll_y, (int64_t)0, max_scroll);
+        is_at_end = scroll_y == max_scroll;
+
+        first = (uint32_t)Min(scroll_y / line_height, (int64_t)line_starts.Size());
+        last = (uint32_t)Min((int64_t)first + view_height / line_height + 2, (int64_t)line_starts.Size());
+    }
+    void WrappedLines::InsertBox(Context* context, const BoxStyle& style, const StringAsci& id, DebugInfo debug_info)
+    {
+        BoxStyle view_style = style;
+        view_style.scissor = true;
+        view_style.scroll_y = 0;
+        context->BeginBox(view_style, id, debug_info);
+        //Lines are already wrapped, the extra width keeps the layout from wrapping them again
+        BoxStyle lines_style;
+        lines_style.y = -(int)(scroll_y % GetLineHeight());
+        lines_style.width = {wrap_width + max_char_width};
+        lines_style.height = {100, Unit::CONTENT_PERCENT};
+        lines_style.max_width = {UINT16_MAX};
+        context->BeginBox(lines_style, StringAsci(), debug_info);
+        if(!visible_text.IsEmpty())
+            context->InsertText(this->style, StringU32(visible_text.Data(), visible_text.Size()), nullptr, true, debug_info);
+        context->EndBox();
+        context->EndBox();
+    }
+
+
+    void TextView::SetText(const StringAsci& text)
+    {
+        this->text = text;
+        ResetIndex();
+    }
+    void TextView::GrowText(const StringAsci& text)
+    {
+        assert(text.Size() >= this->text.Size() && "GrowText() can only append");
+        this->text = text;
+        if(is_tail_indexed)
+        {
+            lines.line_starts.Resize(tail_line);
+            is_tail_indexed = false;
+        }
+    }
+    void TextView::SetIndexBudget(uint64_t bytes)
+    {
+        index_budget = Max((uint64_t)1, bytes);
+    }
+    void TextView::SetFollowTail(bool flag)
+    {
+        lines.follow_tail = flag;
+    }
+    void TextView::ScrollBy(int64_t pixels)
+    {
+        lines.SetScrollY(lines.scroll_y + pixels);
+    }
+    void TextView::SetScrollY(int64_t scroll_y)
+    {
+        lines.SetScrollY(scroll_y);
+    }
+    int64_t TextView::GetScrollY() const
+    {
+        return lines.scroll_y;
+    }
+    int64_t TextView::GetContentHeight() const
+    {
+        return lines.GetContentHeight();
+    }
+    uint32_t TextView::GetLineCount() const
+    {
+        return lines.line_starts.Size();
+    }
+    bool TextView::IsIndexComplete() const
+    {
+        return is_tail_indexed || indexed_bytes == text.Size();
+    }
+    void TextView::ResetIndex()
+    {
+        lines.line_starts.Clear();
+        indexed_bytes = 0;
+        tail_line = 0;
+        is_tail_indexed = false;
+    }
+    void TextView::IndexStep(uint64_t byte_budget)
+    {
+        if(lines.wrap_width <= 0 || is_tail_indexed)
+            return;
+        auto char_at = [&](uint64_t i) { return text.data[i]; };
+        auto emit = [&](uint64_t start) { lines.line_starts.Push(start); return true; };
+        uint64_t budget_end = indexed_bytes + byte_budget;
+        while(indexed_bytes < text.Size() && indexed_bytes < budget_end)
+        {
+            uint32_t first_line = lines.line_starts.Size();
+            uint64_t line_break = WrapLine(indexed_bytes, text.Size(), lines.wrap_width, lines.char_widths, char_at, emit);
+            if(line_break == text.Size())
+            {
+                //Wrapped again when the text grows
+                tail_line = first_line;
+                is_tail_indexed = true;
+                return;
+            }
+            indexed_bytes = line_break + 1;
+        }
+    }
+    uint64_t TextView::GetLineEnd(uint32_t line)
+    {
+        if(line + 1 < lines.line_starts.Size())
+            return lines.line_starts[line + 1];
+        return is_tail_indexed? text.Size(): indexed_bytes;
+    }
+    void TextView::Run(const BoxStyle& style, const TextStyle& text_style, const StringAsci& id, DebugInfo debug_info)
+    {
+        if(!IsContextActive())
+            return;
+        assert(!id.IsEmpty() && "TextView needs an id");
+        Context* context = GetContext();
+        BoxInfo info = context->Info(id);
+
+        if(lines.SetLayout(info.IsValid()? info.width: 0, text_style))
+            ResetIndex();
+        IndexStep(index_budget);
+
+        uint32_t first = 0;
+        uint32_t last = 0;
+        lines.GetVisibleLines(info.height, first, last);
+        lines.visible_text.Clear();
+        for(uint32_t line = first; line < last; line++)
+        {
+            if(line != first)
+                lines.visible_text.Push(U'\n');
+            uint64_t start = lines.line_starts[line];
+            uint64_t end = GetLineEnd(line);
+            while(end > start && (text[end - 1] == '\n' || text[end - 1] == '\r'))
+                end--;
+            for(uint64_t i = start; i < end; i++)
+                lines.visible_text.Push((char32_t)(uint8_t)text[i]);
+        }
+        lines.InsertBox(context, style, id, debug_info);
+    }
+
+
+    TextEdit::~TextEdit()
+    {
+        delete[] data;
+    }
+    void TextEdit::SetText(const StringAsci& text)
+    {
+        gap_start = 0;
+        gap_end = capacity;
+        Insert(0, text);
+        is_wrapped = false;
+    }
+    uint64_t TextEdit::Size() const
+    {
+        return capacity - (gap_end - gap_start);
+    }
+    char TextEdit::At(uint64_t offset) const
+    {
+        assert(offset < Size());
+        return offset < gap_start? data[offset]: data[offset + gap_end - gap_start];
+    }
+    void TextEdit::MoveGap(uint64_t offset)
+    {
+        assert(offset <= Size());
+        if(offset < gap_start)
+        {
+            uint64_t count = gap_start - offset;
+            memmove(data + gap_end - count, data + offset, count);
+            gap_start -= count;
+            gap_end -= count;
+        }
+        else if(offset > gap_start)
+        {
+            uint64_t count = offset - gap_start;
+            memmove(data + gap_start, data + gap_end, count);
+            gap_start += count;
+            gap_end += count;
+        }
+    }
+    void TextEdit::ReserveGap(uint64_t bytes)
+    {
+        if(gap_end - gap_start >= bytes)
+            return;
+        uint64_t tail = capacity - gap_end;
+        uint64_t new_capacity = Max(capacity * 2, Size() + bytes + 64);
+        char* new_data = new char[new_capacity];
+        if(data)
+        {
+            memcpy(new_data, data, gap_start);
+            memcpy(new_data + new_capacity - tail, data + gap_end, tail);
+        }
+        delete[] data;
+        data = new_data;
+        gap_end = new_capacity - tail;
+        capacity = new_capacity;
+    }
+    void TextEdit::Insert(uint64_t offset, const StringAsci& text)
+    {
+        if(text.IsEmpty())
+            return;
+        assert(offset <= Size());
+        MoveGap(offset);
+        ReserveGap(text.Size());
+        memcpy(data + gap_start, text.data, text.Size());
+        gap_start += text.Size();
+        Rewrap(offset, 0, text.Size());
+    }
+    void TextEdit::Erase(uint64_t offset, uint64_t count)
+    {
+        assert(offset + count <= Size());
+        if(!count)
+            return;
+        MoveGap(offset);
+        gap_end += count;
+        Rewrap(offset, count, 0);
+    }
+    void TextEdit::ScrollBy(int64_t pixels)
+    {
+        lines.SetScrollY(lines.scroll_y + pixels);
+    }
+    void TextEdit::SetScrollY(int64_t scroll_y)
+    {
+        lines.SetScrollY(scroll_y);
+    }
+    int64_t TextEdit::GetScrollY() const
+    {
+        return lines.scroll_y;
+    }
+    int64_t TextEdit::GetContentHeight() const
+    {
+        return lines.GetContentHeight();
+    }
+    uint32_t TextEdit::GetLineCount() const
+    {
+        return lines.line_starts.Size();
+    }
+    uint32_t TextEdit::GetLineAt(uint64_t offset)
+    {
+        //Last line that starts at or before offset
+        uint32_t first = 0;
+        uint32_t count = lines.line_starts.Size();
+        while(count > 0)
+        {
+            uint32_t half = count / 2;
+            if(lines.line_starts[first + half] <= offset)
+            {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else
+                count = half;
+        }
+        return first? first - 1: 0;
+    }
+    uint64_t TextEdit::GetLineStart(uint32_t line)
+    {
+        assert(line < lines.line_starts.Size());
+        return lines.line_starts[line];
+    }
+    //Every line break starts a line, including one at the very end so a cursor can be placed there
+    void TextEdit::WrapAll()
+    {
+        lines.line_starts.Clear();
+        is_wrapped = lines.wrap_width > 0;
+        if(!is_wrapped)
+            return;
+        auto char_at = [&](uint64_t i) { return At(i); };
+        auto emit = [&](uint64_t start) { lines.line_starts.Push(start); return true; };
+        uint64_t size = Size();
+        uint64_t start = 0;
+        while(true)
+        {
+            uint64_t line_break = WrapLine(start, size, lines.wrap_width, lines.char_widths, char_at, emit);
+            if(line_break == size)
+                break;
+            start = line_break + 1;
+        }
+    }
+    /*
+        Greedy wrapping only depends on where a line starts, so wrapping starts at the line before the edit
+        (a shorter word can move up) and stops at the first new line that starts where an old one did,
+        shifted by the size of the edit. Everything after it is the same.
+    */
+    void TextEdit::Rewrap(uint64_t offset, uint64_t removed, uint64_t inserted)
+    {
+        if(!is_wrapped)
+            return;
+        DynamicArray<uint64_t>& starts = lines.line_starts;
+        assert(!starts.IsEmpty());
+        int64_t delta = (int64_t)inserted - (int64_t)removed;
+
+        uint32_t line = GetLineAt(offset);
+        if(line > 0 && At(starts[line] - 1) != '\n')
+            line--;
+        //Old lines that can still line up with the new ones
+        uint32_t old_line = line + 1;
+        while(old_line < starts.Size() && starts[old_line] < offset + removed)
+            old_line++;
+
+        bool is_synced = false;
+        rewrapped.Clear();
+        auto char_at = [&](uint64_t i) { return At(i); };
+        auto emit = [&](uint64_t start)
+        {
+            if(start >= offset + inserted)
             {
-                if(IsDirectHover() && IsMousePressed(MouseButton::MOUSE_LEFT))
-                    State().custom_flags = true;
-                //Disable Mouse dragging
-                if(IsMouseReleased(MouseButton::MOUSE_LEFT))
-                    State().custom_flags = false;
-
-                //Drag if enabled
-                if(State().custom_flags)
+                while(old_line < starts.Size() && (int64_t)starts[old_line] + delta < (int64_t)start)
+                    old_line++;
+                if(old_line < starts.Size() && (int64_t)starts[old_line] + delta == (int64_t)start)
                 {
-                    base_dim.width += GetMouseDeltaX();
-                    base_dim.height += GetMouseDeltaY();
-                    base_dim.width = Max(base_dim.width, 300);
-                    base_dim.height = Max(base_dim.height, 300);
+                    is_synced = true;
+                    return false;
                 }
-            })
-            .Run();
-        });
-
-
+            }
+            rewrapped.Push(start);
+            return true;
+        };
+        uint64_t size = Size();
+        uint64_t start = starts[line];
+        while(true)
+        {
+            uint64_t line_break = WrapLine(start, size, lines.wrap_width, lines.char_widths, char_at, emit);
+            if(line_break >= size)
+                break;
+            start = line_break + 1;
+        }
+        if(!is_synced)
+            old_line = starts.Size();
 
+        //Replaces the old lines [line, old_line) and shifts the rest
+        uint32_t tail = starts.Size() - old_line;
+        uint32_t new_size = line + rewrapped.Size() + tail;
+        if(new_size > starts.Size())
+        {
+            starts.Resize(new_size);
+            memmove(starts.Data() + new_size - tail, starts.Data() + old_line, tail * sizeof(uint64_t));
+        }
+        else
+        {
+            memmove(starts.Data() + new_size - tail, starts.Data() + old_line, tail * sizeof(uint64_t));
+            starts.Resize(new_size);
+        }
+        if(!rewrapped.IsEmpty())
+            memcpy(starts.Data() + line, rewrapped.Data(), rewrapped.Size() * sizeof(uint64_t));
+        for(uint32_t i = new_size - tail; i < new_size; i++)
+            starts[i] += delta;
     }
-    void DebugInspector::CreateTreeView(TreeNodeDebug* node, int depth)
+    void TextEdit::Run(const BoxStyle& style, const TextStyle& text_style, const StringAsci& id, DebugInfo debug_info)
     {
-        if(!node)
+        if(!IsContextActive())
             return;
-        BoxStyle gap = {.width = {20}, .height = {100, Unit::AVAILABLE_PERCENT}};
-        BoxStyle bar =
+        assert(!id.IsEmpty() && "TextEdit needs an id");
+        Context* context = GetContext();
+        BoxInfo info = context->Info(id);
+
+        if(lines.SetLayout(info.IsValid()? info.width: 0, text_style) || !is_wrapped)
+            WrapAll();
+
+        uint32_t first = 0;
+        uint32_t last = 0;
+        lines.GetVisibleLines(info.height, first, last);
+        lines.visible_text.Clear();
+        uint64_t size = Size();
+        for(uint32_t line = first; line < last; line++)
         {
-            .width = {1},
-            .height = {100, Unit::AVAILABLE_PERCENT},
-            .margin = {9, 9, 0, 0},
-            .color = theme.black0,
-        };
-        BoxStyle h_container =
+            if(line != first)
+                lines.visible_text.Push(U'\n');
+            uint64_t start = lines.line_starts[line];
+            uint64_t end = line + 1 < lines.line_starts.Size()? lines.line_starts[line + 1]: size;
+            while(end > start && (At(end - 1) == '\n' || At(end - 1) == '\r'))
+                end--;
+            for(uint64_t i = start; i < end; i++)
+                lines.visible_text.Push((char32_t)(uint8_t)At(i));
+        }
+        lines.InsertBox(context, style, id, debug_info);
+    }
+
+
+    void SkylinePacker::Init(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        Clear();
+    }
+    void SkylinePacker::Clear()
+    {
+        skyline.Clear();
+        skyline.Push(Segment{0, 0, width});
+        used_area = 0;
+    }
+    int SkylinePacker::FitAt(uint32_t index, int width, int height) const
+    {
+        if(skyline[index].x + width > this->width)
+            return -1;
+        int y = 0;
+        int remaining = width;
+        for(uint32_t i = index; remaining > 0; i++)
         {
-            .flow = {.vertical_alignment = Flow::CENTERED},
-            .width = {9999},
-            .height = {100, Unit::CONTENT_PERCENT},
-        };
-        BoxStyle icon_button =
+            assert(i < skyline.Size() && "Skyline does not cover the width");
+            y = Max(y, skyline[i].y);
+            if(y + height > this->height)
+                return -1;
+            remaining -= skyline[i].width;
+        }
+        return y;
+    }
+    bool SkylinePacker::Pack(int width, int height, int& x, int& y)
+    {
+        if(width <= 0 || height <= 0)
+            return false;
+        //Lowest placement, ties go to the narrowest segment so wide gaps stay open
+        uint32_t best = UINT32_MAX;
+        int best_y = INT_MAX;
+        int best_width = INT_MAX;
+        for(uint32_t i = 0; i < skyline.Size(); i++)
         {
-            .flow =
+            int fit_y = FitAt(i, width, height);
+            if(fit_y < 0)
+                continue;
+            if(fit_y < best_y || (fit_y == best_y && skyline[i].width < best_width))
             {
-                .vertical_alignment = Flow::CENTERED,
-                .horizontal_alignment = Flow::CENTERED
-            },
-            .width = {20},
-            .height = {20},
-            .border_color = theme.black0,
-            .corner_radius = 2,
-            .border_width = 1,
-        };
-        Color fg_color = theme.black0;
-        Color bg_color = theme.white0;
-        bool invert_color = selected_node == node || hovered_node == node;
+                best = i;
+                best_y = fit_y;
+                best_width = skyline[i].width;
+            }
+        }
+        if(best == UINT32_MAX)
+            return false;
+        x = skyline[best].x;
+        y = best_y;
+        used_area += (uint64_t)width * height;
+
+        //Insert the new top edge at best and cut the segments it covers
+        skyline.Push(Segment());
+        for(uint32_t i = skyline.Size() - 1; i > best; i--)
+            skyline[i] = skyline[i - 1];
+        skyline[best] = Segment{x, y + height, width};
+        uint32_t next = best + 1;
+        while(next < skyline.Size() && skyline[next].x < x + width)
+        {
+            Segment& segment = skyline[next];
+            int covered = Min(segment.width, x + width - segment.x);
+            segment.x += covered;
+            segment.width -= covered;
+            if(segment.width > 0)
+                break;
+            for(uint32_t i = next; i + 1 < skyline.Size(); i++)
+                skyline[i] = skyline[i + 1];
+            skyline.Pop();
+        }
+        //Merge neighbours at the same height
+        uint32_t count = 0;
+        for(uint32_t i = 0; i < skyline.Size(); i++)
+        {
+            if(count > 0 && skyline[count - 1].y == skyline[i].y)
+                skyline[count - 1].width += skyline[i].width;
+            else
+                skyline[count++] = skyline[i];
+        }
+        while(skyline.Size() > count)
+            skyline.Pop();
+        return true;
+    }
+    int SkylinePacker::GetWidth() const
+    {
+        return width;
+    }
+    int SkylinePacker::GetHeight() const
+    {
+        return height;
+    }
+    uint64_t SkylinePacker::GetUsedArea() const
+    {
+        return used_area;
+    }
 
-        Box(h_container)
-        .Id(Fmt("tree-element-%llu", (uintptr_t)node))
-        .PreRun([&]
+
+    float GlyphAtlas::Stats::GetOccupancy() const
+    {
+        return total_pixels? (float)used_pixels / total_pixels: 0.0f;
+    }
+    GlyphAtlas::~GlyphAtlas()
+    {
+        for(uint32_t i = 0; i < pages.Size(); i++)
+            delete pages[i];
+    }
+    void GlyphAtlas::Init(int page_width, int page_height, uint16_t max_pages, RasterizeFunc rasterize, ClearPageFunc clear_page, UploadFunc upload, void* user_data)
+    {
+        assert(page_width > 0 && page_height > 0 && max_pages > 0 && max_pages < NO_PAGE);
+        assert(page_width <= UINT16_MAX && page_height <= UINT16_MAX);
+        for(uint32_t i = 0; i < pages.Size(); i++)
+            delete pages[i];
+        pages.Clear();
+        glyphs.Free();
+        this->page_width = page_width;
+        this->page_height = page_height;
+        this->max_pages = max_pages;
+        this->rasterize = rasterize;
+        this->clear_page = clear_page;
+        this->upload = upload;
+        this->user_data = user_data;
+        evicted_pages = 0;
+    }
+    void GlyphAtlas::Clear()
+    {
+        glyphs.Free();
+        for(uint16_t i = 0; i < pages.Size(); i++)
         {
-            if(IsDirectHover())
-            {
-                invert_color = true;
-                if(IsMousePressed(MouseButton::MOUSE_LEFT))
-                {
-                    selected_node = node;
-                }
-                hovered_node = node;
-            }
-            if(invert_color)
-            {
-                fg_color = theme.white0;
-                bg_color = theme.black0;
-                icon_button.border_color = fg_color;
-                Style().color = theme.black0;
-            }
-        })
-        .Run([&]
+            pages[i]->packer.Clear();
+            pages[i]->glyph_count = 0;
+            if(clear_page)
+                clear_page(user_data, i);
+        }
+    }
+    int GlyphAtlas::GetSizeBucket(int font_size)
+    {
+        for(int size: SIZE_BUCKETS)
         {
-            for(int i = 0; i < depth; i++)
+            if(size >= font_size)
+                return size;
+        }
+        return SIZE_BUCKETS[std::size(SIZE_BUCKETS) - 1];
+    }
+    const GlyphAtlas::Glyph* GlyphAtlas::GetGlyph(char32_t codepoint, int font_size)
+    {
+        int size = GetSizeBucket(font_size);
+        uint64_t key = (((uint64_t)codepoint << 8) | (uint64_t)size) + 1; //0 is an empty slot in the map
+        use_count++;
+        Glyph* found = glyphs.GetValue(key);
+        if(found)
+        {
+            if(found->page != NO_PAGE)
+                pages[found->page]->last_use = use_count;
+            return found;
+        }
+
+        Glyph glyph;
+        glyph.page = NO_PAGE;
+        glyph.size = (uint16_t)size;
+        Bitmap bitmap;
+        if(rasterize && rasterize(user_data, codepoint, size, bitmap))
+        {
+            glyph.offset_x = (int16_t)bitmap.offset_x;
+            glyph.offset_y = (int16_t)bitmap.offset_y;
+            glyph.advance = (uint16_t)Max(0, bitmap.advance);
+            if(bitmap.pixels && bitmap.width > 0 && bitmap.height > 0)
             {
-                Box(bar).Run();
-                Box(gap).Run();
+                uint16_t page = 0;
+                int x = 0;
+                int y = 0;
+                if(!Allocate(bitmap.width + PADDING * 2, bitmap.height + PADDING * 2, page, x, y))
+                    return nullptr;
+                glyph.page = page;
+                glyph.x = (uint16_t)(x + PADDING);
+                glyph.y = (uint16_t)(y + PADDING);
+                glyph.width = (uint16_t)bitmap.width;
+                glyph.height = (uint16_t)bitmap.height;
+                pages[page]->glyph_count++;
+                pages[page]->last_use = use_count;
+                if(upload)
+                    upload(user_data, page, glyph.x, glyph.y, bitmap);
             }
-
-            if(!node->children.IsEmpty())
+        }
+        Glyph* inserted = glyphs.Insert(key, glyph);
+        assert(inserted && "Glyph map out of memory");
+        return inserted;
+    }
+    bool GlyphAtlas::Allocate(int width, int height, uint16_t& page, int& x, int& y)
+    {
+        if(width > page_width || height > page_height)
+            return false;
+        for(uint16_t i = 0; i < pages.Size(); i++)
+        {
+            if(pages[i]->packer.Pack(width, height, x, y))
             {
-                Box(icon_button)
-                .Id(Fmt("tree-element-icon-%llu", (uintptr_t)node))
-                .PreRun([&]
-                {
-                    if(node->box.is_open)
-                        Style().color = theme.green0;
-                })
-                .OnDirectHover([&]
-                {
-                    Style().color = theme.black0;
-                    icon_button.border_color = theme.white0;
-                    if(IsMousePressed(MouseButton::MOUSE_LEFT))
-                        node->box.is_open = !node->box.is_open;
-
-                })
-                .Run([&]
-                {
-                    Text(TextStyle{.fg_color = icon_button.border_color, .font_size = 24}, (node->box.is_open? StringU32(U"-"): StringU32(U"+")));
-                });
+                page = i;
+                return true;
             }
+        }
+        if(pages.Size() < max_pages)
+        {
+            Page* new_page = new Page();
+            new_page->packer.Init(page_width, page_height);
+            pages.Push(new_page);
+            page = (uint16_t)(pages.Size() - 1);
+            return new_page->packer.Pack(width, height, x, y);
+        }
+        //Every page is full, the least recently used one starts over
+        page = 0;
+        for(uint16_t i = 1; i < pages.Size(); i++)
+        {
+            if(pages[i]->last_use < pages[page]->last_use)
+                page = i;
+        }
+        EvictPage(page);
+        return pages[page]->packer.Pack(width, height, x, y);
+    }
+    void GlyphAtlas::EvictPage(uint16_t page)
+    {
+        evictions.Clear();
+        glyphs.ForEach([&](uint64_t key, Glyph& glyph)
+        {
+            if(glyph.page == page)
+                evictions.Push(key);
+        });
+        for(uint32_t i = 0; i < evictions.Size(); i++)
+            glyphs.Remove(evictions[i]);
+        pages[page]->packer.Clear();
+        pages[page]->glyph_count = 0;
+        evicted_pages++;
+        if(clear_page)
+            clear_page(user_data, page);
+    }
+    GlyphAtlas::Stats GlyphAtlas::GetStats() const
+    {
+        Stats stats;
+        stats.page_count = pages.Size();
+        stats.glyph_count = glyphs.Size();
+        stats.evicted_pages = evicted_pages;
+        for(uint32_t i = 0; i < pages.Size(); i++)
+        {
+            stats.used_pixels += pages[i]->packer.GetUsedArea();
+            stats.total_pixels += (uint64_t)page_width * page_height;
+        }
+        return stats;
+    }
+    uint16_t GlyphAtlas::GetPageCount() const
+    {
+        return (uint16_t)pages.Size();
+    }
 
 
-            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, node->box.debug_info.name);
-            Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U"  line: ");
-            Text(TextStyle{.fg_color = theme.black3, .font_size = 24}, Fmt("%d ", node->box.debug_info.line));
+    ImageAtlas::~ImageAtlas()
+    {
+        Clear();
+    }
+    void ImageAtlas::Init(int page_width, int page_height, int max_image_size, CreatePageFunc create_page, DestroyPageFunc destroy_page, UploadFunc upload, void* user_data)
+    {
+        assert(page_width > 0 && page_height > 0 && page_width <= UINT16_MAX && page_height <= UINT16_MAX);
+        assert(max_image_size + PADDING * 2 <= Min(page_width, page_height) && "Images have to fit a page");
+        Clear();
+        this->page_width = page_width;
+        this->page_height = page_height;
+        this->max_image_size = max_image_size;
+        this->create_page = create_page;
+        this->destroy_page = destroy_page;
+        this->upload = upload;
+        this->user_data = user_data;
+    }
+    void ImageAtlas::Clear()
+    {
+        for(uint32_t i = 0; i < pages.Size(); i++)
+        {
+            if(destroy_page)
+                destroy_page(user_data, pages[i]->texture);
+            delete pages[i];
+        }
+        pages.Clear();
+    }
+    TextureRect ImageAtlas::Add(const Pixels& pixels)
+    {
+        if(!pixels.rgba || pixels.width <= 0 || pixels.height <= 0)
+            return TextureRect();
+        if(pixels.width > max_image_size || pixels.height > max_image_size)
+            return TextureRect();
+        int width = pixels.width + PADDING * 2;
+        int height = pixels.height + PADDING * 2;
+        int x = 0;
+        int y = 0;
+        Page* page = nullptr;
+        //Images are only added at load time, first fit keeps the earlier pages full
+        for(uint32_t i = 0; i < pages.Size() && !page; i++)
+        {
+            if(pages[i]->packer.Pack(width, height, x, y))
+                page = pages[i];
+        }
+        if(!page)
+        {
+            void* texture = create_page? create_page(user_data, page_width, page_height): nullptr;
+            if(!texture)
+                return TextureRect();
+            page = new Page();
+            page->texture = texture;
+            page->packer.Init(page_width, page_height);
+            pages.Push(page);
+            bool is_packed = page->packer.Pack(width, height, x, y);
+            assert(is_packed);
+        }
+        TextureRect rect;
+        rect.texture = page->texture;
+        rect.x = (uint16_t)(x + PADDING);
+        rect.y = (uint16_t)(y + PADDING);
+        rect.width = (uint16_t)pixels.width;
+        rect.height = (uint16_t)pixels.height;
+        if(upload)
+            upload(user_data, page->texture, rect.x, rect.y, pixels);
+        return rect;
+    }
+    uint32_t ImageAtlas::GetPageCount() const
+    {
+        return pages.Size();
+    }
+    void* ImageAtlas::GetPage(uint32_t index) const
+    {
+        return pages[index]->texture;
+    }
+    bool ImageAtlas::IsPage(const void* texture) const
+    {
+        for(uint32_t i = 0; i < pages.Size(); i++)
+        {
+            if(pages[i]->texture == texture)
+                return true;
+        }
+        return false;
+    }
+    float ImageAtlas::GetOccupancy() const
+    {
+        uint64_t used = 0;
+        for(uint32_t i = 0; i < pages.Size(); i++)
+            used += pages[i]->packer.GetUsedArea();
+        uint64_t total = (uint64_t)pages.Size() * page_width * page_height;
+        return total? (float)used / total: 0.0f;
+    }
 
-            if(!node->box.text.IsEmpty())
-            {
-                Text(TextStyle{.fg_color = theme.green0, .font_size = 24}, U" \"");
-                Text(TextStyle{.fg_color = theme.green0, .font_size = 24}, node->box.text);
-                Text(TextStyle{.fg_color = theme.green0, .font_size = 24}, U"\" ");
-            }
-            if(!node->box.id.IsEmpty())
-            {
-                Text(TextStyle{.fg_color = fg_color, .font_size = 24}, U" id: ");
-                Text(TextStyle{.fg_color = theme.yellow0, .font_size = 24}, node->box.id);
-            }
 
-        });
+    ImageLoader::~ImageLoader()
+    {
+        Shutdown();
+        for(uint32_t i = 0; i < entries.Size(); i++)
+            delete[] entries[i].path;
+    }
+    void ImageLoader::Init(uint32_t worker_count, DecodeFunc decode, UploadFunc upload, FreeFunc free_image, void* user_data)
+    {
+        assert(worker_count && decode && upload && free_image);
+        Shutdown();
+        this->decode = decode;
+        this->upload = upload;
+        this->free_image = free_image;
+        this->user_data = user_data;
+        jobs.Init(QUEUE_CAPACITY);
+        results.Init(QUEUE_CAPACITY);
+        is_stopping.store(false);
+        this->worker_count = worker_count;
+        workers = new std::thread[worker_count];
+        for(uint32_t i = 0; i < worker_count; i++)
+            workers[i] = std::thread(&ImageLoader::WorkerLoop, this);
+    }
+    void ImageLoader::Shutdown()
+    {
+        if(!workers)
+            return;
+        is_stopping.store(true);
+        job_signal.release(worker_count);
+        for(uint32_t i = 0; i < worker_count; i++)
+            workers[i].join();
+        delete[] workers;
+        workers = nullptr;
+        worker_count = 0;
+
+        //Whatever did not make it stays a placeholder
+        Job job;
+        while(jobs.Pop(job));
+        Result result;
+        while(results.Pop(result))
+            ready.Push(result);
+        for(uint32_t i = 0; i < ready.Size(); i++)
+        {
+            if(ready[i].is_decoded)
+                free_image(user_data, ready[i].image);
+        }
+        for(uint32_t i = 0; i < entries.Size(); i++)
+        {
+            if(entries[i].state == State::PENDING)
+                entries[i].state = State::FAILED;
+        }
+        ready.Clear();
+        backlog.Clear();
+        in_flight = 0;
+        //The semaphore may still hold releases nobody acquired
+        while(job_signal.try_acquire());
+    }
+    uint32_t ImageLoader::Request(const char* path)
+    {
+        assert(path);
+        uint64_t length = std::strlen(path);
+        uint64_t key = Internal::HashBytes(path, length);
+        key = key? key: 1; //0 is an empty slot in the map
+        //Another path under the same hash moves on to the next key
+        uint32_t* found = handles.GetValue(key);
+        while(found && std::strcmp(entries[*found - 1].path, path) != 0)
+        {
+            key = Internal::HashCombine(key, 1);
+            key = key? key: 1;
+            found = handles.GetValue(key);
+        }
+        if(found)
+            return *found;
+
+        Entry entry;
+        entry.path = new char[length + 1];
+        std::memcpy(entry.path, path, length + 1);
+        entry.state = workers? State::PENDING: State::FAILED;
+        entries.Push(entry);
+        uint32_t handle = entries.Size();
+        uint32_t* inserted = handles.Insert(key, handle);
+        assert(inserted && "Image handle map failed to insert");
+        if(workers)
+        {
+            backlog.Push(Job{handle, entry.path});
+            SubmitBacklog();
+        }
+        return handle;
+    }
+    void ImageLoader::SubmitBacklog()
+    {
+        uint32_t submitted = 0;
+        for(; submitted < backlog.Size(); submitted++)
+        {
+            if(!jobs.Push(backlog[submitted]))
+                break;
+            in_flight++;
+            job_signal.release();
+        }
+        if(!submitted)
+            return;
+        for(uint32_t i = submitted; i < backlog.Size(); i++)
+            backlog[i - submitted] = backlog[i];
+        backlog.Resize(backlog.Size() - submitted);
+    }
+    uint32_t ImageLoader::Update(uint32_t upload_budget)
+    {
+        Result result;
+        while(results.Pop(result))
+        {
+            in_flight--;
+            if(result.is_decoded)
+                ready.Push(result);
+            else
+                entries[result.handle - 1].state = State::FAILED;
+        }
+        SubmitBacklog();
 
-        if(node->box.is_open)
+        uint32_t uploaded = Min(upload_budget, ready.Size());
+        for(uint32_t i = 0; i < uploaded; i++)
         {
-            for(auto temp = node->children.GetHead(); temp!=nullptr; temp = temp->next)
+            Entry& entry = entries[ready[i].handle - 1];
+            entry.rect = upload(user_data, ready[i].image);
+            entry.state = entry.rect.HasTexture()? State::READY: State::FAILED;
+            free_image(user_data, ready[i].image);
+        }
+        //Oldest first, so an image can not starve behind newer ones
+        for(uint32_t i = uploaded; i < ready.Size(); i++)
+            ready[i - uploaded] = ready[i];
+        ready.Resize(ready.Size() - uploaded);
+        return uploaded;
+    }
+    TextureRect ImageLoader::Get(uint32_t handle) const
+    {
+        if(!handle || handle > entries.Size())
+            return TextureRect();
+        return entries[handle - 1].rect;
+    }
+    ImageLoader::State ImageLoader::GetState(uint32_t handle) const
+    {
+        if(!handle || handle > entries.Size())
+            return State::NONE;
+        return entries[handle - 1].state;
+    }
+    bool ImageLoader::IsBusy() const
+    {
+        return in_flight || !backlog.IsEmpty() || !ready.IsEmpty();
+    }
+    void ImageLoader::WorkerLoop()
+    {
+        while(true)
+        {
+            job_signal.acquire();
+            if(is_stopping.load())
+                return;
+            Job job;
+            if(!jobs.Pop(job))
+                continue;
+            Result result;
+            result.handle = job.handle;
+            result.is_decoded = decode(user_data, job.path, result.image);
+            //The main thread drains the results every frame, a full queue only waits for the next Update()
+            while(!results.Push(result))
             {
-                CreateTreeView(&temp->value, depth + 1);
+                if(is_stopping.load())
+                {
+                    if(result.is_decoded)
+                        free_image(user_data, result.image);
+                    return;
+                }
+                std::this_thread::yield();
             }
-
         }
     }
 
 
-
 }
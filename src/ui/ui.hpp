@@ -25,6 +25,10 @@
 //#include <uchar.h>
 
 #include <iostream>
+#include <new>
+#include <thread>
+#include <semaphore>
+#include <cstdio>
 #include "Memory.hpp"
 
 
@@ -37,9 +41,14 @@ namespace UI
     using StringU32 = BaseString<const char32_t>;
     class Context;
     class DebugInspector;
+    class TextView;
+    class TextEdit;
     class Builder;
+    class CaptureRecorder;
+    class CaptureReplayer;
     struct Error;
     struct BoxStyle;
+    struct CompiledStyle;
     struct Grid;
     struct Flow;
     struct Color;
@@ -47,6 +56,7 @@ namespace UI
     struct Spacing;
     struct BoxInfo;
     struct Rect;
+    struct InputSnapshot;
 }
 namespace UI
 {
@@ -191,11 +201,11 @@ namespace UI
     inline int CmToPx(float cm) { return int(cm * DPI / 2.54f); }
     inline int InchToPx(float inches) { return int(inches * DPI); }
     template<typename T>
-    inline T Min(T a, T b) {return a < b? a: b;}
+    constexpr T Min(T a, T b) {return a < b? a: b;}
     template<typename T>
-    inline T Max(T a, T b) {return a > b? a: b;}
+    constexpr T Max(T a, T b) {return a > b? a: b;}
     template<typename T>
-    inline T Clamp(T value, T minimum, T maximum) { return Max(Min(value, maximum), minimum); }
+    constexpr T Clamp(T value, T minimum, T maximum) { return Max(Min(value, maximum), minimum); }
     template<typename T>
     inline T Mix(T a, T b, float amount) { return a + Clamp(amount, 0.0f, 1.0f) * (b - a); }
     template<>
@@ -418,7 +428,7 @@ namespace UI
         uint16_t y =        0;
         uint16_t width =    0;
         uint16_t height =   0;
-        inline bool HasTexture() const { return texture; }
+        constexpr bool HasTexture() const { return texture; }
     };
     struct BoxStyle
     {
@@ -458,6 +468,64 @@ namespace UI
         bool scissor = false;
         Detach detach = Detach::NONE;
     };
+
+    // ========== Style Registry ==========
+    /*
+        A BoxStyle registered with Context::RegisterStyle() is converted once and
+        boxes only carry this handle. The key is a hash of the style, so registering
+        an identical style again returns the same handle. A different style with the
+        same hash is given the next free key.
+    */
+    struct StyleHandle
+    {
+        uint64_t key = 0;
+        bool IsValid() const { return key != 0; }
+    };
+    //Small per-box changes applied on top of a registered style
+    struct StyleOverride
+    {
+        enum Flags : uint8_t
+        {
+            NONE =          0,
+            WIDTH =         1 << 0,
+            HEIGHT =        1 << 1,
+            COLOR =         1 << 2,
+            BORDER_COLOR =  1 << 3,
+            SCROLL =        1 << 4,
+        };
+        StyleOverride& Width(Unit width);
+        StyleOverride& Height(Unit height);
+        StyleOverride& BgColor(const Color& color);
+        StyleOverride& BorderColor(const Color& color);
+        StyleOverride& Scroll(int x, int y);
+        bool Has(Flags flag) const;
+
+        uint8_t flags = NONE;
+        Unit width;
+        Unit height;
+        Color color;
+        Color border_color;
+        int scroll_x = 0;
+        int scroll_y = 0;
+    };
+    //Per instance values for the slots of a template, see UI::Instance()
+    struct InstanceArgs
+    {
+        static constexpr uint8_t MAX_SLOTS = 8;
+        //An empty text keeps the placeholder of the template
+        InstanceArgs& Text(uint8_t slot, const StringU32& text);
+        InstanceArgs& BgColor(uint8_t slot, const Color& color);
+        InstanceArgs& Id(uint8_t slot, const StringAsci& id);
+
+        //One bit per slot
+        uint8_t text_flags = 0;
+        uint8_t color_flags = 0;
+        uint8_t id_flags = 0;
+        StringU32 texts[MAX_SLOTS];
+        Color colors[MAX_SLOTS];
+        uint64_t id_keys[MAX_SLOTS] = {};
+    };
+    // ====================================
     struct TextStyle
     {
         TextStyle& FontSize(int size);
@@ -469,7 +537,7 @@ namespace UI
         int GetLineSpacing() const;
         Color GetFgColor() const;
         Color GetBgColor() const;
-        // bool operator==(const TextStyle& t) const;
+        bool operator==(const TextStyle& t) const;
         Color fg_color = {255, 255, 255, 255};
         Color bg_color;
         uint8_t font_size = 32;
@@ -530,13 +598,56 @@ namespace UI
     void BeginRoot(Context* context, const BoxStyle& style, DebugInfo debug_info = UI_DEBUG("Root"));
     void EndRoot();
     void BeginBox(const BoxStyle& box_style, const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
+    void BeginBox(StyleHandle handle, const StyleOverride& style_override = StyleOverride(), const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
+    void BeginBox(const CompiledStyle& style, const StyleOverride& style_override = StyleOverride(), const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
     void EndBox();
+    StyleHandle RegisterStyle(const BoxStyle& style);
     //void InsertText(const char16_t* text, const char* id = nullptr, bool copy_text = true, DebugInfo debug_info = UI_DEBUG("Text"));
     void Draw();
     // ====================================
     // ========== Builder Notation ==========
     template<typename Func>
     void Root(Context* context, const BoxStyle& style, Func&& func, DebugInfo debug_info = UI_DEBUG("Root"));
+    /*
+        Skips func and reuses the boxes it built last time when deps_hash and the root size did not change.
+        deps_hash has to cover everything func reads, ids must be unique per frame.
+        When func builds a single box that is not sized by its content, the layout inside it is cached too.
+    */
+    template<typename Func>
+    void Memo(const StringAsci& id, uint64_t deps_hash, Func&& func);
+    /*
+        Builds shape once per template_id and root size, every call then copies it and fills its slots from args.
+        Slots are marked with Builder::Slot() and UI::TextSlot(), shape must not read anything else.
+        Instances made of a single box that is not sized by its content also share their layout
+        when their text slots measure the same. They then only add that box to the tree, wrap their
+        text slots and are drawn from the shared layout at their own position, or skipped outside the clip.
+    */
+    template<typename Func>
+    void Instance(const StringAsci& template_id, const InstanceArgs& args, Func&& shape);
+    //Placeholder text node filled by InstanceArgs::Text()
+    void TextSlot(uint8_t index, const TextStyle& style);
+    //func(const BoxInfo&) receives the box with this frame's layout and hover, see Context::OnLayout()
+    template<typename Func>
+    void OnLayout(const StringAsci& id, Func&& func);
+    /*
+        Calls func(index) for every index in [0, count) and adds the boxes they build to the current box in index order.
+        With Context::SetBuildThreads() ranges of indices are built at the same time on worker threads, each into
+        its own arenas, and stitched together afterwards. The tree is the same as a serial build:
+        every index starts a new text node, like NewLine(), and memos and instances inside func are rebuilt every frame.
+        func runs concurrently with itself, it may read anything but must only write through its index.
+        RegisterStyle() only finds styles that were registered before, ids must be unique as usual
+    */
+    template<typename Func>
+    void ParallelFor(uint32_t count, Func&& func);
+    /*
+        Scratch memory for the code that builds the ui, taken from the frame arena of the current context
+        (the one that holds copied texts). It stays valid until the next BeginRoot() of that context,
+        so until its Draw() is done. Nothing is destructed. nullptr without a context or when the arena is full
+    */
+    template<typename T>
+    T* FrameAlloc(uint64_t count);
+    //printf into frame memory, Text() uses it without copying
+    StringU32 FrameString(const char* fmt, ...);
 
     // ===== Text Overloads ====
     void Text(const TextStyle& style, const StringU32& string, bool copy_text = true, DebugInfo debug_info = UI_DEBUG("Text"));
@@ -553,12 +664,17 @@ namespace UI
     void LineBreak();
     // =========================
     Builder& Box(const BoxStyle& style = BoxStyle(), const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
+    Builder& Box(StyleHandle handle, const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
+    Builder& Box(const CompiledStyle& style, const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
     BoxInfo Info();
     // BoxInfo Info(const StringAsci& id);
     // BoxInfo SetState(const StringAsci& id);
     void SetState(const StringAsci& id, const BoxState& state);
     BoxStyle& Style();
+    StyleOverride& Override();
     BoxState& State();
+    //Input of the active context for this frame
+    const InputSnapshot& Input();
     bool IsHover();
     bool IsDirectHover();
     // ======================================
@@ -588,10 +704,17 @@ namespace UI
 
     void DrawText_impl(TextPrimitive draw_command);
     //Backend function to implement
-    void Init_impl(const char* font_path);
+    //When atlas_cache_path is set the baked font atlas is saved there and loaded on the next launch instead of the font
+    void Init_impl(const char* font_path, const char* atlas_cache_path = nullptr);
 
     void DrawRectangle_impl(float x, float y, float width, float height, float corner_radius, float border_size, Color border_color, Color background_color);
     void DrawTexturedRectangle_impl(int x, int y, int width, int height, const TextureRect& texture);
+    //Not required. Loads an image file, small ones are packed into shared atlas pages so they draw in one batch
+    TextureRect LoadImage_impl(const char* path);
+    //Not required. Frees an image from LoadImage_impl() or an ImageLoader that got its own texture, packed ones stay until UnloadImages_impl()
+    void UnloadImage_impl(const TextureRect& texture);
+    //Not required. Frees the atlas pages, every packed image is invalid afterwards
+    void UnloadImages_impl();
     void DrawText_impl(TextStyle style, int x, int y, const char32_t* text, int size);
     int MeasureChar_impl(char32_t c, int font_size, int spacing);
     void BeginScissorMode_impl(float x, float y, float width, float height);
@@ -617,7 +740,311 @@ namespace UI
     int GetScreenHeight();
     float GetFrameTime();
 
+    /*
+        Input read from the backend once per frame by Context::BeginRoot().
+        Layout, drawing and widgets only read this copy, so a frame never sees input change midway.
+        Context::SetInput() replaces the backend for one frame, for tests, benchmarks or replays.
+    */
+    struct InputSnapshot
+    {
+        static constexpr int KEY_COUNT = 349;
+        static constexpr int CHAR_CAPACITY = 16;
+        //Reads everything from the backend functions above
+        static InputSnapshot Capture();
+
+        bool IsKeyPressed(Key key) const;
+        bool IsKeyReleased(Key key) const;
+        bool IsKeyDown(Key key) const;
+        bool IsKeyRepeat(Key key) const;
+        bool IsMousePressed(MouseButton button) const;
+        bool IsMouseReleased(MouseButton button) const;
+        bool IsMouseDown(MouseButton button) const;
+        //True when anything other than the frame time differs from the previous frame
+        bool HasEvents(const InputSnapshot& previous) const;
+        void SetKey(uint64_t (&keys)[(KEY_COUNT + 63) / 64], Key key, bool flag);
+
+        int mouse_x = 0;
+        int mouse_y = 0;
+        float mouse_scroll = 0.0f;
+        float frame_time = 0.0f;
+        int screen_width = 0;
+        int screen_height = 0;
+        //One bit per MouseButton
+        uint8_t mouse_pressed = 0;
+        uint8_t mouse_released = 0;
+        uint8_t mouse_down = 0;
+        //Characters typed this frame, in order
+        uint8_t char_count = 0;
+        char chars[CHAR_CAPACITY] = {};
+        //One bit per Key
+        uint64_t keys_pressed[(KEY_COUNT + 63) / 64] = {};
+        uint64_t keys_released[(KEY_COUNT + 63) / 64] = {};
+        uint64_t keys_down[(KEY_COUNT + 63) / 64] = {};
+        uint64_t keys_repeat[(KEY_COUNT + 63) / 64] = {};
+    };
+
+    //Packs rectangles into a fixed size area by keeping the top edge of the packed ones as a skyline
+    class SkylinePacker
+    {
+    public:
+        void Init(int width, int height);
+        void Clear();
+        //Bottom left placement, returns false when the rectangle does not fit anywhere
+        bool Pack(int width, int height, int& x, int& y);
+        int GetWidth() const;
+        int GetHeight() const;
+        uint64_t GetUsedArea() const;
+    private:
+        struct Segment
+        {
+            int x = 0;
+            int y = 0; //Top of the packed area under the segment
+            int width = 0;
+        };
+        //Returns the y a rectangle starting at segment index would be placed at, -1 if it does not fit
+        int FitAt(uint32_t index, int width, int height) const;
 
+        Internal::DynamicArray<Segment> skyline;
+        int width = 0;
+        int height = 0;
+        uint64_t used_area = 0;
+    };
+
+    /*
+        Glyph cache for backends. A glyph is rasterized the first time a (codepoint, size bucket) is asked for
+        and packed into fixed size pages. When every page is full the least recently used page is emptied.
+        Only does the bookkeeping, the backend rasterizes and uploads the pixels through the callbacks,
+        so it works without a graphics context.
+    */
+    class GlyphAtlas
+    {
+    public:
+        //8 bit coverage, owned by the backend until the upload returns
+        struct Bitmap
+        {
+            const unsigned char* pixels = nullptr;
+            int width = 0;
+            int height = 0;
+            int offset_x = 0;
+            int offset_y = 0;
+            int advance = 0;
+        };
+        struct Glyph
+        {
+            uint16_t page = 0;
+            uint16_t x = 0;
+            uint16_t y = 0;
+            uint16_t width = 0;
+            uint16_t height = 0;
+            int16_t offset_x = 0;
+            int16_t offset_y = 0;
+            uint16_t advance = 0;
+            uint16_t size = 0; //Pixel size of the bucket it was rasterized at
+        };
+        struct Stats
+        {
+            uint32_t page_count = 0;
+            uint32_t glyph_count = 0;
+            uint64_t used_pixels = 0;
+            uint64_t total_pixels = 0; //Of the pages in use
+            uint64_t evicted_pages = 0;
+            float GetOccupancy() const;
+        };
+        //Returns false when the codepoint can not be rasterized
+        using RasterizeFunc = bool(*)(void* user_data, char32_t codepoint, int pixel_size, Bitmap& bitmap);
+        //Called before a page is reused, and to copy a packed glyph into its page.
+        //A page is created by the backend on its first upload
+        using ClearPageFunc = void(*)(void* user_data, uint16_t page);
+        using UploadFunc = void(*)(void* user_data, uint16_t page, int x, int y, const Bitmap& bitmap);
+
+        static constexpr int PADDING = 1; //Empty pixels around every glyph so filtering does not bleed
+        static constexpr uint16_t NO_PAGE = UINT16_MAX;
+        static constexpr int SIZE_BUCKETS[] = {8, 10, 12, 14, 16, 18, 20, 24, 28, 32, 40, 48, 56, 64, 80, 96, 128};
+
+        GlyphAtlas() = default;
+        GlyphAtlas(const GlyphAtlas&) = delete;
+        GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+        ~GlyphAtlas();
+
+        void Init(int page_width, int page_height, uint16_t max_pages, RasterizeFunc rasterize, ClearPageFunc clear_page, UploadFunc upload, void* user_data);
+        //Drops every glyph, the pages are kept
+        void Clear();
+        //Rasterizes on first use, nullptr when it is larger than a page. Glyphs without pixels (spaces, missing
+        //codepoints) have no page and a zero size. The pointer is valid until the next call to GetGlyph()
+        const Glyph* GetGlyph(char32_t codepoint, int font_size);
+        //Smallest bucket that is at least font_size, so glyphs are scaled down rather than up
+        static int GetSizeBucket(int font_size);
+        Stats GetStats() const;
+        uint16_t GetPageCount() const;
+    private:
+        struct Page
+        {
+            SkylinePacker packer;
+            uint64_t last_use = 0;
+            uint32_t glyph_count = 0;
+        };
+        //Returns false when the glyph is larger than a page
+        bool Allocate(int width, int height, uint16_t& page, int& x, int& y);
+        void EvictPage(uint16_t page);
+
+        Internal::Map<Glyph> glyphs;
+        Internal::DynamicArray<Page*> pages;
+        Internal::DynamicArray<uint64_t> evictions; //Scratch for EvictPage()
+        RasterizeFunc rasterize = nullptr;
+        ClearPageFunc clear_page = nullptr;
+        UploadFunc upload = nullptr;
+        void* user_data = nullptr;
+        int page_width = 0;
+        int page_height = 0;
+        uint16_t max_pages = 0;
+        uint64_t use_count = 0; //Ticks on every GetGlyph(), orders the pages by their last use
+        uint64_t evicted_pages = 0;
+    };
+    //Implemented by backends that rasterize glyphs on demand
+    GlyphAtlas::Stats GetGlyphAtlasStats();
+
+    /*
+        Packs small images into shared pages at load time, so boxes that draw them use the same texture
+        and the backend can batch them. Images stay until Clear(), the backend creates and destroys the page
+        textures and copies the pixels through the callbacks.
+    */
+    class ImageAtlas
+    {
+    public:
+        //8 bit RGBA with tightly packed rows
+        struct Pixels
+        {
+            const unsigned char* rgba = nullptr;
+            int width = 0;
+            int height = 0;
+        };
+        //Returns the texture handle put in TextureRect::texture, nullptr on failure
+        using CreatePageFunc = void*(*)(void* user_data, int width, int height);
+        using DestroyPageFunc = void(*)(void* user_data, void* page);
+        using UploadFunc = void(*)(void* user_data, void* page, int x, int y, const Pixels& pixels);
+
+        static constexpr int PADDING = 1; //Empty pixels around every image so filtering does not bleed
+
+        ImageAtlas() = default;
+        ImageAtlas(const ImageAtlas&) = delete;
+        ImageAtlas& operator=(const ImageAtlas&) = delete;
+        ~ImageAtlas();
+
+        void Init(int page_width, int page_height, int max_image_size, CreatePageFunc create_page, DestroyPageFunc destroy_page, UploadFunc upload, void* user_data);
+        //Destroys the pages, the TextureRects returned by Add() are invalid afterwards
+        void Clear();
+        //Returns an empty TextureRect when either side is larger than max_image_size, those need their own texture
+        TextureRect Add(const Pixels& pixels);
+        uint32_t GetPageCount() const;
+        void* GetPage(uint32_t index) const;
+        //False for textures that were not made by create_page, like the ones of images too large to pack
+        bool IsPage(const void* texture) const;
+        float GetOccupancy() const;
+    private:
+        struct Page
+        {
+            SkylinePacker packer;
+            void* texture = nullptr;
+        };
+        Internal::DynamicArray<Page*> pages;
+        CreatePageFunc create_page = nullptr;
+        DestroyPageFunc destroy_page = nullptr;
+        UploadFunc upload = nullptr;
+        void* user_data = nullptr;
+        int page_width = 0;
+        int page_height = 0;
+        int max_image_size = 0;
+    };
+
+    /*
+        Decodes images on worker threads and uploads a limited number of them per frame on the main thread.
+        Decoded pixels come back through a lock-free queue. Until an image is uploaded Get() returns an empty
+        TextureRect, so a box using it draws its background color as the placeholder.
+        Decoding, uploading and freeing are callbacks, nothing here touches the GPU.
+    */
+    class ImageLoader
+    {
+    public:
+        enum class State : uint8_t
+        {
+            NONE,
+            PENDING,
+            READY,
+            FAILED,
+        };
+        //8 bit RGBA with tightly packed rows, owned by whoever decoded it until FreeFunc
+        struct Decoded
+        {
+            unsigned char* rgba = nullptr;
+            int width = 0;
+            int height = 0;
+        };
+        //Runs on the worker threads, returns false when the file can not be decoded
+        using DecodeFunc = bool(*)(void* user_data, const char* path, Decoded& image);
+        //Runs on the main thread inside Update(), returns an empty TextureRect on failure
+        using UploadFunc = TextureRect(*)(void* user_data, const Decoded& image);
+        using FreeFunc = void(*)(void* user_data, Decoded& image);
+
+        static constexpr uint32_t QUEUE_CAPACITY = 256;
+
+        ImageLoader() = default;
+        ImageLoader(const ImageLoader&) = delete;
+        ImageLoader& operator=(const ImageLoader&) = delete;
+        //Joins the workers, images that were not uploaded yet are dropped
+        ~ImageLoader();
+
+        void Init(uint32_t worker_count, DecodeFunc decode, UploadFunc upload, FreeFunc free_image, void* user_data);
+        void Shutdown();
+        //Returns a handle, asking for the same path again returns the same handle. 0 is never a valid handle
+        uint32_t Request(const char* path);
+        //Call once per frame. Uploads at most upload_budget images and returns how many became ready
+        uint32_t Update(uint32_t upload_budget);
+        TextureRect Get(uint32_t handle) const;
+        State GetState(uint32_t handle) const;
+        //True while images are decoding or waiting for an upload, frames have to keep coming until it is false
+        bool IsBusy() const;
+    private:
+        struct Entry
+        {
+            char* path = nullptr;
+            TextureRect rect;
+            State state = State::NONE;
+        };
+        struct Job
+        {
+            uint32_t handle = 0;
+            const char* path = nullptr;
+        };
+        struct Result
+        {
+            uint32_t handle = 0;
+            bool is_decoded = false;
+            Decoded image;
+        };
+        void WorkerLoop();
+        //Moves requests that did not fit into the job queue
+        void SubmitBacklog();
+
+        Internal::ConcurrentQueue<Job> jobs;
+        Internal::ConcurrentQueue<Result> results;
+        std::counting_semaphore<> job_signal{0};
+        std::atomic<bool> is_stopping{false};
+        std::thread* workers = nullptr;
+        uint32_t worker_count = 0;
+
+        //Main thread only
+        Internal::DynamicArray<Entry> entries;
+        Internal::Map<uint32_t> handles; //Path hash to handle
+        Internal::DynamicArray<Job> backlog;
+        Internal::DynamicArray<Result> ready; //Decoded, waiting for an upload slot
+        uint32_t in_flight = 0; //Submitted jobs whose result was not received yet
+        DecodeFunc decode = nullptr;
+        UploadFunc upload = nullptr;
+        FreeFunc free_image = nullptr;
+        void* user_data = nullptr;
+    };
+    //Implemented by backends that load images, wires the loader to their decoder and ImageAtlas
+    void InitImageLoader_impl(ImageLoader& loader, uint32_t worker_count);
 
 }
 
@@ -633,7 +1060,23 @@ namespace UI
         {
             TextStyle style;
         };
-        struct TextSpans : public ArenaDLL<TextSpan>
+        using TextSpans = ArenaDLL<TextSpan>;
+
+        //A piece of a run placed in the box, the characters are looked up in TextLines::runs
+        struct TextLine
+        {
+            uint32_t start = 0;
+            uint32_t size = 0;
+            int y = 0;
+            int16_t x = 0;
+            uint16_t width = 0;
+            uint16_t run = 0;
+        };
+        /*
+            The wrapped text of one box. Spans next to each other with the same
+            style are merged into a single run. Both arrays are contiguous in arena2
+        */
+        struct TextLines
         {
             /*
                 This is only used in ComputeTextLines so I can
@@ -641,33 +1084,52 @@ namespace UI
             */
             struct Iterator
             {
-                TextSpans::Node* node = nullptr;
+                const TextSpan* run = nullptr;
+                const TextSpan* last = nullptr;
                 int string_index = 0;
                 Iterator Next() const;
-                Iterator Prev() const;
                 char32_t GetChar() const;
                 TextStyle GetStyle() const;
                 bool IsValid() const;
-
-                /*
-                   End is inclusive,
-                   End should be within the same node as Start or else
-                   Start will return its entire string
-                */
             };
-            static StringU32 GetString(Iterator start, Iterator end);
-            static TextSpan GetTextSpan(Iterator start, Iterator end);
-            Iterator Begin();
-            //The last character in the TextSpan list
-            Iterator End();
+            ArrayView<TextSpan> runs;
+            //Sorted by y, lines on the same row share their y
+            ArrayView<TextLine> lines;
+            Iterator Begin() const;
+            bool IsEmpty() const;
+            uint64_t Size() const;
+            StringU32 GetString(const TextLine& line) const;
+            const TextStyle& GetStyle(const TextLine& line) const;
         };
 
-        //The same as a text span with positions
-        struct TextLine : public TextSpan
+        //One backend call recorded by the draw traversal, Context::FlushDrawCommands() sends it to the backend
+        struct DrawCommand
         {
-            int x = 0;
-            int y = 0;
-            int width = 0;
+            enum class Type : uint8_t
+            {
+                RECTANGLE,
+                TEXTURE,
+                TEXT,
+            };
+            //Commands with the same key draw with the same texture and can share a batch
+            static constexpr uintptr_t SHAPES_KEY = 0;
+            static constexpr uintptr_t TEXT_KEY = 1;
+
+            Type type = Type::RECTANGLE;
+            uintptr_t batch_key = SHAPES_KEY;
+            Rect bounds; //Pixels it can touch, used by the overlap tests
+            Rect clip; //Scissor region
+            //RECTANGLE
+            float corner_radius = 0;
+            float border_width = 0;
+            Color border_color;
+            Color background_color;
+            //TEXTURE
+            TextureRect texture;
+            //TEXT, the characters and style live in the frame arenas
+            const TextStyle* style = nullptr;
+            const char32_t* text = nullptr;
+            int text_size = 0;
         };
 
         struct BoxCore
@@ -692,6 +1154,8 @@ namespace UI
 
             TextureRect texture;
             uint64_t id_key =       0;
+            //Index + 1 in Context::memo_roots when the box is the root of a memoized subtree, only valid for one frame
+            uint32_t memo_root =    0;
 
             Color background_color =    UI::Color{0, 0, 0, 0};
             Color border_color =        UI::Color{0, 0, 0, 0};
@@ -721,7 +1185,7 @@ namespace UI
                 to see what variable get passed down for caching into the next arena.
             */
             //Info sent to BoxResult
-            ArenaDLL<TextLine> result_text_lines;
+            TextLines* result_text_lines = nullptr;
             int16_t result_rel_x = 0;
             int16_t result_rel_y = 0;
             uint16_t result_content_width = 0;
@@ -751,18 +1215,19 @@ namespace UI
             Layout layout = Layout::FLOW;
             Detach detach = Detach::NONE;
             Type type = Type::BOX;
+            uint8_t slot = 0; //Index + 1 of the template slot filled by InstanceArgs
         private:
             //Values that can potentially use bit array
             Flow::Axis flow_axis = Flow::Axis::HORIZONTAL;
             bool scissor = false;
         public:
             Type GetElementType() const;
-            void SetFlowAxis(Flow::Axis axis);
-            void SetScissor(bool flag);
+            constexpr void SetFlowAxis(Flow::Axis axis) { flow_axis = axis; }
+            constexpr void SetScissor(bool flag) { scissor = flag; }
             Layout GetLayout() const;
             Flow::Axis GetFlowAxis() const;
             bool IsScissor() const;
-            bool IsDetached() const;
+            constexpr bool IsDetached() const { return detach != Detach::NONE; }
             bool IsTextElement() const;
             int GetBoxExpansionWidth() const;
             int GetBoxExpansionHeight() const;
@@ -777,7 +1242,7 @@ namespace UI
         struct BoxResult
         {
             BoxCore* core = nullptr;
-            ArenaDLL<TextLine> text_lines;
+            const TextLines* text_lines = nullptr;
             int16_t rel_x = 0;
             int16_t rel_y = 0;
             uint16_t draw_width = 0;
@@ -825,14 +1290,261 @@ namespace UI
             MISSING_END,
             MISSING_BEGIN,
             TEXT_NODE_CONTRADICTION,
-            TEXT_UNKOWN_ESCAPE_CODE
+            TEXT_UNKOWN_ESCAPE_CODE,
+            INVALID_STYLE_HANDLE
         };
         Type type = Type::NO_ERROR;
         char msg[ERROR_MSG_SIZE]{};
     };
 
+    //Called when CompileStyle() finds an error, this makes constant evaluation fail
+    void InvalidUnitCombination(const char* msg);
+
+    namespace Internal
+    {
+        constexpr Error CheckUnitErrors(const BoxCore& box)
+        {
+            if(box.width_unit == Unit::WIDTH_PERCENT ||
+                box.min_width_unit == Unit::WIDTH_PERCENT ||
+                box.max_width_unit == Unit::WIDTH_PERCENT)
+                return Error{Error::Type::INCORRENT_UNIT_TYPE, "WIDTH_PERCENT can only be applied to height"};
+
+            if(box.min_width_unit == Unit::AVAILABLE_PERCENT ||
+                box.max_width_unit == Unit::AVAILABLE_PERCENT ||
+                box.min_height_unit == Unit::AVAILABLE_PERCENT ||
+                box.max_height_unit == Unit::AVAILABLE_PERCENT)
+                return Error{Error::Type::INCORRENT_UNIT_TYPE, "AVAILABLE_PERCENT is limited to width/height"};
+
+            if(box.IsDetached() &&
+                (box.width_unit == Unit::AVAILABLE_PERCENT || box.height_unit == Unit::AVAILABLE_PERCENT))
+                return Error{Error::Type::INCORRENT_UNIT_TYPE, "Detached boxes cannot be AVAILABLE_PERCENT"};
+            return Error();
+        }
+
+        constexpr BoxCore ComputeStyleSheet(const BoxStyle& style, const BoxCore& root)
+        {
+            int root_width = root.width - style.margin.left - style.margin.right - style.padding.left - style.padding.right;
+            int root_height = root.height - style.margin.top - style.margin.bottom - style.padding.top - style.padding.bottom;
+            root_width = Max(0, root_width);
+            root_height = Max(0, root_height);
+
+            BoxCore box;
+            box.texture = style.texture;
+            box.type = style.texture.HasTexture()? BoxCore::Type::IMAGE: BoxCore::Type::BOX;
+
+            box.background_color =          style.color;
+            box.border_color =              style.border_color;
+            //type 3
+
+            box.scroll_x =                  style.scroll_x;
+            box.scroll_y =                  style.scroll_y;
+
+            box.x =                         (int16_t)style.x;
+            box.y =                         (int16_t)style.y;
+            box.width =                     (uint16_t)style.width.value;
+            box.height =                    (uint16_t)style.height.value;
+            box.gap_row =                   (uint16_t)style.gap_row;
+            box.gap_column =                (uint16_t)style.gap_column;
+            box.min_width =                 (uint16_t)style.min_width.value;
+            box.max_width =                 (uint16_t)style.max_width.value;
+            box.min_height =                (uint16_t)style.min_height.value;
+            box.max_height =                (uint16_t)style.max_height.value;
+
+            box.width_unit =                style.width.unit;
+            box.height_unit =               style.height.unit;
+            box.min_width_unit =            style.min_width.unit;
+            box.max_width_unit =            style.max_width.unit;
+            box.min_height_unit =           style.min_height.unit;
+            box.max_height_unit =           style.max_height.unit;
+
+            box.grid_row_count =            Max((uint8_t)1, style.grid.row_count);
+            box.grid_column_count =         Max((uint8_t)1, style.grid.column_count);
+            box.grid_x =                    style.grid.x;
+            box.grid_y =                    style.grid.y;
+            box.grid_span_x =               Max((uint8_t)1, style.grid.span_x);
+            box.grid_span_y =               Max((uint8_t)1, style.grid.span_y);
+
+            box.flow_vertical_alignment =   style.flow.vertical_alignment;
+            box.flow_horizontal_alignment = style.flow.horizontal_alignment;
+            //PIXEL VALUES
+            box.corner_radius =             style.corner_radius; //255 sets to circle
+            box.border_width =              style.border_width;
+            box.padding =                   style.padding;
+            box.margin =                    style.margin;
+            box.layout =                    style.layout;
+            box.detach =                    style.detach;
+
+            box.SetFlowAxis(style.flow.axis);
+            box.SetScissor(style.scissor);
+            return box;
+        }
+    }
+
+    /*
+        A BoxStyle converted to its internal form. Styles that are known at compile time
+        can be declared as
+            static constexpr UI::CompiledStyle row = UI::CompileStyle({...});
+        so BeginBox only has to copy the result. Fields that change at runtime
+        (screen size, hover colors) are patched with a StyleOverride.
+        An invalid style fails to compile when it is constant evaluated, otherwise BeginBox reports the error.
+    */
+    struct CompiledStyle
+    {
+        BoxStyle style; //kept for the debug inspector
+        Internal::BoxCore core;
+        Error::Type error = Error::Type::NO_ERROR; //The message is found again by BeginBox
+    };
+    constexpr CompiledStyle CompileStyle(const BoxStyle& style)
+    {
+        CompiledStyle compiled{style, Internal::ComputeStyleSheet(style, Internal::BoxCore())};
+        Error error = Internal::CheckUnitErrors(compiled.core);
+        compiled.error = error.type;
+        if(std::is_constant_evaluated() && error.type != Error::Type::NO_ERROR)
+            InvalidUnitCombination(error.msg); //Not constexpr, so it stops the compilation
+        return compiled;
+    }
+
 
 
+    //Everything the backend needs to draw one frame. Owned by the packet, so it stays valid while the context builds the next frame
+    struct FramePacket
+    {
+        Internal::DynamicArray<Internal::DrawCommand> commands; //In draw order, text and styles point into this packet
+        Internal::DynamicArray<char32_t> text;
+        Internal::DynamicArray<TextStyle> styles;
+        Rect screen;
+        uint64_t frame_index = 0;
+    };
+    //Sends the commands of the packet to the backend
+    void ReplayFramePacket(const FramePacket& packet);
+
+    /*
+        Single producer, single consumer ring of frame packets. The ui thread fills a packet in Context::Draw()
+        and a render thread that owns the graphics context replays it, so building the next frame overlaps
+        drawing the last one. Packets are reused and keep their capacity.
+        Handing over a packet is lock-free, the waiting functions block with atomic waits.
+        Backend calls that touch the graphics context (Init_impl, LoadImage_impl, ImageLoader::Update) belong on the render thread
+    */
+    class FrameRing
+    {
+    public:
+        static constexpr uint32_t CAPACITY = 3;
+
+        //Producer. Waits while every packet is queued, nullptr once closed
+        FramePacket* BeginWrite();
+        void EndWrite();
+        //Consumer. Waits for the next packet, nullptr once closed and empty
+        const FramePacket* BeginRead();
+        //Returns nullptr instead of waiting
+        const FramePacket* TryBeginRead();
+        void EndRead();
+        //Wakes both sides, no more packets are written
+        void Close();
+        bool IsClosed() const;
+    private:
+        static constexpr uint64_t CLOSED_BIT = 1ull << 63; //Set in both counters so waiting threads wake up
+        FramePacket packets[CAPACITY];
+        alignas(64) std::atomic<uint64_t> written{0}; //Only the producer adds to it
+        alignas(64) std::atomic<uint64_t> read{0}; //Only the consumer adds to it
+    };
+
+    /*
+        Writes the tree a context builds every frame to a file, as the BeginBox()/InsertText()/NewLine()/EndBox()
+        calls that build it again, with the input snapshot and the root style of the frame.
+        Box and text styles are written once and referenced by index, texts are UTF-8. A frame is written at EndRoot().
+        While recording, memo and instance functions run every frame so the file only holds plain boxes.
+        Styles are stored as this build lays them out, a capture can only be replayed by the same build.
+        Textures are not recorded, see CaptureReplayer::SetTexture()
+    */
+    class CaptureRecorder
+    {
+    public:
+        CaptureRecorder() = default;
+        CaptureRecorder(const CaptureRecorder&) = delete;
+        CaptureRecorder& operator=(const CaptureRecorder&) = delete;
+        ~CaptureRecorder();
+        //Truncates the file, returns false when it cannot be created
+        bool Open(const char* path);
+        void Close();
+        bool IsOpen() const;
+        uint32_t GetFrameCount() const;
+        uint64_t GetByteCount() const;
+    private:
+        friend Context;
+        void WriteFrame(const InputSnapshot& input, const BoxStyle& root_style, Internal::TreeNode<Internal::BoxCore>* root);
+        void WriteBytes(const void* src, uint64_t byte_count);
+        void WriteVarint(uint64_t value);
+        void WriteText(Internal::BoxCore& box);
+        //Writes a style record the first time a style is seen
+        uint32_t GetBoxStyleIndex(const Internal::BoxCore& box);
+        uint32_t GetTextStyleIndex(const TextStyle& style);
+    private:
+        std::FILE* file = nullptr;
+        Internal::DynamicArray<uint8_t> buffer; //The frame being written
+        Internal::DynamicArray<Internal::ArenaLL<Internal::TreeNode<Internal::BoxCore>>::Node*> walk;
+        Internal::Map<uint32_t> box_styles; //Index of the style keyed by its hash
+        Internal::Map<uint32_t> text_styles;
+        //Bytes of the written styles in index order, compared on a hash hit
+        Internal::DynamicArray<uint8_t> box_records;
+        Internal::DynamicArray<uint8_t> text_records;
+        uint32_t box_style_count = 0;
+        uint32_t text_style_count = 0;
+        uint32_t frame_count = 0;
+        uint64_t byte_count = 0;
+    };
+
+    //Memory maps a capture of CaptureRecorder and builds its frames into a context without the application
+    class CaptureReplayer
+    {
+    public:
+        CaptureReplayer() = default;
+        CaptureReplayer(const CaptureReplayer&) = delete;
+        CaptureReplayer& operator=(const CaptureReplayer&) = delete;
+        ~CaptureReplayer();
+        //Indexes the frames, returns false when the file is missing or was recorded by a different build.
+        //A frame cut off at the end of the file is ignored
+        bool Open(const char* path);
+        void Close();
+        bool IsOpen() const;
+        uint32_t GetFrameCount() const;
+        //Builds the frame between UI::BeginRoot() and UI::EndRoot() with its recorded input, UI::Draw() is up to the caller
+        bool ReplayFrame(Context* context, uint32_t frame);
+        //Used for every image box, without a texture they are drawn as plain boxes
+        void SetTexture(void* texture);
+    private:
+        const uint8_t* data = nullptr;
+        uint64_t size = 0;
+        bool is_mapped = false;
+        Internal::DynamicArray<Internal::BoxCore> box_styles;
+        Internal::DynamicArray<TextStyle> text_styles;
+        Internal::DynamicArray<uint64_t> frames; //Offset of every frame record
+        void* texture = nullptr;
+    };
+
+    //Counts of the draw commands of the last Context::Draw()
+    struct DrawStats
+    {
+        uint32_t command_count = 0;
+        //Runs of commands the backend can draw without switching texture or scissor
+        uint32_t batches_before = 0; //In tree order
+        uint32_t batches_after = 0; //As sent to the backend
+    };
+
+    //Arena usage of the frame, valid after Draw() until the next BeginRoot(). Includes the ParallelFor() arenas
+    struct MemoryStats
+    {
+        uint64_t frame_alloc_bytes = 0; //Asked for through FrameAlloc() and FrameString()
+        uint64_t frame_arena_bytes = 0; //Frame allocations and copied texts
+        uint64_t frame_arena_capacity = 0;
+        uint64_t tree_arena_bytes = 0;
+        uint64_t layout_arena_bytes = 0;
+        uint64_t committed_bytes = 0; //Memory the arenas take, see MemoryArena
+    };
+
+    //FUSED does the layout and drawing in three tree traversals,
+    //MULTI_PASS is the reference pipeline with one traversal per step
+    enum class LayoutPipeline : unsigned char { FUSED, MULTI_PASS };
+
     class Context
     {
         using BoxCore = Internal::BoxCore;
@@ -843,6 +1555,7 @@ namespace UI
         using ArenaLL = Internal::ArenaLL<T>;
         using BoxType = Internal::BoxCore::Type;
         friend DebugInspector;
+        friend CaptureReplayer;
 
         struct DeferredBox
         {
@@ -851,8 +1564,29 @@ namespace UI
             int y = 0;
         };
 
+        //Explicit stack frames used by the layout passes instead of recursion.
+        //next_child is the next child to visit, x/y is the origin of the children.
+        struct CoreFrame
+        {
+            TreeNode<BoxCore>* node = nullptr;
+            ArenaLL<TreeNode<BoxCore>>::Node* next_child = nullptr;
+        };
+        struct ResultFrame
+        {
+            TreeNode<BoxResult>* node = nullptr;
+            ArenaLL<TreeNode<BoxResult>>::Node* next_child = nullptr;
+            int x = 0;
+            int y = 0;
+            Rect scissor_aabb;
+        };
+        struct MemoFrame;
+        struct MemoEntry;
+        struct MemoRoot;
+        struct TemplateEntry;
+
     public:
         Context(uint64_t arena_bytes, uint64_t string_bytes);
+        ~Context();
 
 
         /* Set Persistent variables
@@ -866,16 +1600,96 @@ namespace UI
         void BeginRoot(BoxStyle style, DebugInfo debug_info = UI_DEBUG("Root"));
         void EndRoot();
         void BeginBox(const UI::BoxStyle& style, const StringAsci& id, DebugInfo debug_info = UI_DEBUG("Box"));
+        void BeginBox(StyleHandle handle, const StyleOverride& style_override, const StringAsci& id, DebugInfo debug_info = UI_DEBUG("Box"));
+        void BeginBox(const CompiledStyle& style, const StyleOverride& style_override, const StringAsci& id, DebugInfo debug_info = UI_DEBUG("Box"));
         void InsertText(const UI::TextStyle& style, const StringU32& string, const char* id = nullptr, bool copy_text = true, DebugInfo info = UI_DEBUG("Text"));
         void NewLine();
         void EndBox();
         void Draw();
 
+        //Returns true when the memoized function has to run, EndMemo() is needed either way. See UI::Memo()
+        bool BeginMemo(const StringAsci& id, uint64_t deps_hash);
+        void EndMemo();
+        //Returns true when the template shape has to be built, EndInstance() is needed either way. See UI::Instance()
+        bool BeginInstance(const StringAsci& template_id, const InstanceArgs& args);
+        void EndInstance();
+        //Marks the box that was just begun as a template slot
+        void SetSlot(uint8_t index);
+        void InsertTextSlot(uint8_t index, const TextStyle& style, DebugInfo debug_info = UI_DEBUG("TextSlot"));
+
         uint32_t GetElementCount() const;
 
+        //Converts the style once and returns a handle that can be passed to BeginBox
+        StyleHandle RegisterStyle(const BoxStyle& style);
+        bool IsStyleRegistered(StyleHandle handle);
+
         //Might not even use this
         void ResetAllStates();
 
+        void SetLayoutPipeline(LayoutPipeline pipeline);
+        LayoutPipeline GetLayoutPipeline() const;
+
+        //Used by the next BeginRoot() instead of reading the backend
+        void SetInput(const InputSnapshot& input);
+        const InputSnapshot& GetInput() const;
+
+        /*
+            Hover and Info() normally come from the previous frame because hit testing happens while drawing.
+            With same frame input, Draw() hit tests the whole tree after layout, fires the OnLayout() callbacks
+            and only then draws, so callbacks react to clicks on this frame's boxes. Costs one more traversal.
+        */
+        void SetSameFrameInput(bool flag);
+        bool IsSameFrameInput() const;
+        /*
+            func(const BoxInfo&) is called by Draw() once the box with this id has been laid out and hit tested.
+            Without same frame input it is called after drawing. func is copied into the frame arena,
+            so it must be trivially destructible (capture by reference or plain values).
+        */
+        template<typename Func>
+        void OnLayout(const StringAsci& id, Func&& func);
+
+        /*
+            Redraw scheduling, valid after Draw(). A frame is needed while hover/appear animations are running,
+            after frames with input events and when the hovered box changed. Otherwise the host can block
+            until the next input event (raylib: EnableEventWaiting()) or until NextRequiredFrameTime().
+        */
+        bool NeedsRedraw() const;
+        //Seconds until the next frame is needed: 0 now, INFINITY when only input can change the ui.
+        //Hosts must honor it, a host that blocks on input without a timeout has to keep polling while it is finite
+        float NextRequiredFrameTime() const;
+        //For changes the context cannot see, like new data or a blinking cursor
+        void RequestRedraw(float seconds = 0.0f);
+
+        /*
+            Draw() records its backend calls and sends them at its end. With sorting on, commands in the same
+            scissor region that do not overlap are grouped by texture, so the backend flushes less often.
+            Overlapping commands keep their painter's order. On by default
+        */
+        void SetDrawSorting(bool flag);
+        bool IsDrawSorting() const;
+        const DrawStats& GetDrawStats() const;
+        //When set, Draw() writes its commands into the ring instead of calling the backend. nullptr draws directly
+        void SetFrameRing(FrameRing* ring);
+
+        /*
+            ParallelFor() runs on count worker threads plus the calling one. Each of them builds into its own
+            arenas of arena_bytes and string_bytes, which hold its boxes until the next BeginRoot(). 0 builds serially
+        */
+        void SetBuildThreads(uint32_t count, uint64_t arena_bytes, uint64_t string_bytes);
+        uint32_t GetBuildThreads() const;
+        //See UI::ParallelFor()
+        template<typename Func>
+        void ParallelFor(uint32_t count, Func&& func);
+
+        //See UI::FrameAlloc()
+        template<typename T>
+        T* FrameAlloc(uint64_t count);
+        StringU32 FrameString(const char* fmt, va_list args);
+        MemoryStats GetMemoryStats() const;
+
+        //Every frame built after this is written to recorder, nullptr stops. Only called between frames
+        void SetCapture(CaptureRecorder* recorder);
+
         void SetDebugInspector(DebugInspector* inspector, Key activate_key);
     private:
         void ResetAtBeginRoot();
@@ -888,41 +1702,177 @@ namespace UI
         bool HandleInternalError(const Error& error);
 
         BoxType GetPreviousNodeBoxType() const;
+
+        //Shared by every BeginBox overload once the style is in its core form
+        void BeginBoxCore(const BoxCore& box, const StringAsci& id);
+        //id_key is 0 for boxes without an id
+        void BeginBoxCore(const BoxCore& box, uint64_t id_key);
+        //Advances the hover/appear animations of a box that is in the tree this frame
+        void UpdateBoxState(uint64_t id_key);
+
+        // ========== Memoization ===============
+        enum CopyFlags : uint8_t
+        {
+            COPY_SHALLOW =      0,
+            COPY_SPANS =        1 << 0, //Copies text spans and their strings into the arena
+            COPY_LINES =        1 << 1, //Copies computed text lines and their strings into the arena
+            UPDATE_STATES =     1 << 2, //The copy is part of this frame's tree
+        };
+        //Bytes needed to copy first, its following siblings and all their children
+        uint64_t MeasureNodes(ArenaLL<TreeNode<BoxCore>>::Node* first, uint8_t flags);
+        //args fills the template slots of the copies
+        TreeNode<BoxCore>* CopyNode(TreeNode<BoxCore>* src, ArenaLL<TreeNode<BoxCore>>* dst, Internal::MemoryArena* arena, uint8_t flags, const InstanceArgs* args = nullptr);
+        //Copies first, its following siblings and all their children to the end of dst
+        void CopyNodes(ArenaLL<TreeNode<BoxCore>>::Node* first, ArenaLL<TreeNode<BoxCore>>* dst, Internal::MemoryArena* arena, uint8_t flags, const InstanceArgs* args = nullptr);
+        void ApplyInstanceArgs(BoxCore& box, const InstanceArgs& args, Internal::MemoryArena* arena);
+        //Applies args to the boxes an instance just built, entry records their text slots when the shape was recorded
+        void FillInstanceSlots(ArenaLL<TreeNode<BoxCore>>::Node* first, const InstanceArgs& args, TemplateEntry* entry);
+        bool IsMemoLayoutCached(const BoxCore& box);
+        //Called once the final size of a memo root is known. Returns true when its cached layout can be used,
+        //otherwise the subtree is rebuilt from the pristine copy and its widths are laid out again
+        bool ResolveMemoLayout(TreeNode<BoxCore>* node);
+        void SaveMemoLayouts();
+        //Records the boxes with an id or a slot of a saved layout and the area its children draw to
+        void IndexMemoLayout(MemoEntry& entry, bool is_instance);
+        //Box states and element count of a memo root whose children come from its cached layout
+        void UpdateMemoLayoutStates(const MemoEntry& entry, const InstanceArgs* args);
+        //Only reports the boxes with an id of a cached memo root that is outside the clip, x/y is the origin of its children
+        void CullMemoLayout(const MemoRoot& memo, int x, int y, const Rect& scissor_aabb);
+        void EvictMemoEntries();
+        //Pops the innermost memo/instance frame, returns false on errors
+        bool PopMemoFrame(MemoFrame& frame, bool is_instance);
+        uint64_t InstanceLayoutKey(uint64_t template_key, const InstanceArgs& args);
+        //Fragments and recording contexts run memo and instance functions every frame
+        bool IsCacheBypassed() const;
+        //Returns a copy of the string that stays valid until the end of the frame
+        const char32_t* InternString(const StringU32& string);
+        void EvictInternedStrings();
+        // ======================================
         // ========== Layout ===============
         //Text
         void ComputeTextLinesAndHeight(BoxCore& box);
+        void BuildTextRuns(Internal::TextSpans& spans, Internal::TextLines& text);
+        //Every pass walks the tree iteratively, the _Flow/_Grid helpers only handle one node and its direct children
         //Width
         void WidthContentPercentPass_Flow(TreeNode<BoxCore>* node);
         void WidthContentPercentPass_Grid(TreeNode<BoxCore>* node);
-        void WidthContentPercentPass(TreeNode<BoxCore>* node);
-        void WidthPass(TreeNode<BoxCore>* node);
-        void WidthPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box); //Recurse Helper
-        void WidthPass_Grid(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box); //Recurse Helper
+        void WidthContentPercentPass(TreeNode<BoxCore>* root);
+        void WidthContentPercentPass_Node(TreeNode<BoxCore>* node);
+        void WidthPass(TreeNode<BoxCore>* root);
+        void WidthPass_Node(TreeNode<BoxCore>* node);
+        //Resolves the sizes of grow_items along the flow axis
+        void SolveAvailablePercent(float available_space, float total_percent);
+        void WidthPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box);
+        void WidthPass_Grid(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box);
         //Height
         void HeightContentPercentPass_Flow(TreeNode<BoxCore>* node);
         void HeightContentPercentPass_Grid(TreeNode<BoxCore>* node);
-        void HeightContentPercentPass(TreeNode<BoxCore>* node);
-        void HeightPass(TreeNode<BoxCore>* node);
-        void HeightPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box); //Recurse Helper
-        void HeightPass_Grid(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box); //Recurse Helpe
+        void HeightContentPercentPass(TreeNode<BoxCore>* root);
+        void HeightContentPercentPass_Node(TreeNode<BoxCore>* node);
+        void HeightPass(TreeNode<BoxCore>* root);
+        void HeightPass_Node(TreeNode<BoxCore>* node);
+        void HeightPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box);
+        void HeightPass_Grid(ArenaLL<TreeNode<BoxCore>>::Node* child, const BoxCore& parent_box);
 
         //Computes relative positions from parent
-        void PositionPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, int x, int y, BoxCore& parent_box);
-        void PositionPass_Grid(ArenaLL<TreeNode<BoxCore>>::Node* child, int x, int y, BoxCore& parent_box);
-        void PositionPass(TreeNode<BoxCore>* node, int x, int y, const BoxCore& parent_box);
+        void PositionPass_Flow(ArenaLL<TreeNode<BoxCore>>::Node* child, BoxCore& parent_box);
+        void PositionPass_Grid(ArenaLL<TreeNode<BoxCore>>::Node* child, BoxCore& parent_box);
+        void PositionPass(TreeNode<BoxCore>* root);
+        //Lays out the children of node and adds their margin/padding offsets
+        void PositionPass_Node(TreeNode<BoxCore>* node);
+
+        //Replaces every pass above plus the detached and draw passes of the root
+        void FusedPipeline();
+        //Pre order: widths. Post order: content heights and text lines
+        void WidthAndHeightContentPass(TreeNode<BoxCore>* root);
 
         void GenerateComputedTree();
-        void GenerateComputedTree_h(TreeNode<BoxCore>* tree_core, TreeNode<BoxResult>* tree_result);
         // ================================
 
         //This is most likely temporary since its just searching for floating/detached windows
         void DetachedBoxesPass(TreeNode<BoxResult>* root, int x, int y);
         void AddDetachedBoxToQueue(TreeNode<BoxResult>* node, const Rect& parent);
-        void DrawPass(TreeNode<BoxResult>* node, int x, int y, Rect scissor_aabb);
+        void DrawPass(TreeNode<BoxResult>* root, int x, int y, Rect scissor_aabb);
+        void DrawDeferredBoxes();
+        //Renders a single box, handles its input and returns the frame used to visit its children
+        ResultFrame DrawBox(TreeNode<BoxResult>* node, int parent_x, int parent_y, Rect scissor_aabb);
+        //visible_aabb is the part of draw inside the clip
+        void InsertBoxInfo(const BoxCore& box, const BoxResult& result, const Rect& draw, const Rect& visible_aabb, bool is_rendered);
+        //Only draws the lines and glyphs that overlap clip
+        void DrawTextLines(const Internal::TextLines& text, int x, int y, const Rect& clip);
+        // ========== Draw commands ===============
+        void PushDrawCommand(const Internal::DrawCommand& command);
+        void PushRectangle(const Rect& bounds, const Rect& clip, float corner_radius, float border_width, Color border_color, Color background_color);
+        //Orders the recorded commands, sorted if sorting is on, and sends them to the backend or the frame ring
+        void FlushDrawCommands();
+        void PublishFramePacket();
+        //Groups the commands of one scissor region into draw_batches
+        void BatchDrawCommands(uint32_t first, uint32_t end);
+        bool OverlapsBatch(uint32_t batch, const Rect& bounds) const;
+        // ================================
+        void RunLayoutCallbacks();
+        // ========== Parallel build ===============
+        //Contexts the build threads write to, shared state is read from owner
+        Context(Context* owner, uint64_t arena_bytes, uint64_t string_bytes);
+        void ParallelFor_impl(uint32_t count, void (*invoke)(void* func, uint32_t index), void* func);
+        //Builds chunks of the current ParallelFor() into fragment until none are left
+        void BuildChunks(Context* fragment);
+        void BuildWorkerLoop(uint32_t worker, uint64_t generation);
+        void StopBuildThreads();
+        // ================================
+        void* FrameAllocate(uint64_t bytes, uint8_t alignment);
 
     private:
         Error internal_error;
         uint32_t element_count = 0;
+        LayoutPipeline layout_pipeline = LayoutPipeline::FUSED;
+        InputSnapshot input;
+        bool is_input_set = false;
+        bool is_same_frame_input = false;
+
+        //Redraw scheduling
+        InputSnapshot previous_input;
+        double time = 0.0; //Sum of frame times
+        double redraw_time = INFINITY; //Earliest RequestRedraw()
+        bool has_input_events = true;
+        bool is_animating = false;
+        bool needs_redraw = true;
+
+        //What DrawBox() does, same frame input splits drawing into a hit test and a render traversal
+        enum DrawFlags : uint8_t
+        {
+            DRAW_RENDER =   1 << 0,
+            DRAW_HIT_TEST = 1 << 1,
+        };
+        uint8_t draw_flags = DRAW_RENDER | DRAW_HIT_TEST;
+
+        struct LayoutCallback
+        {
+            uint64_t key = 0;
+            void (*invoke)(void* func, const BoxInfo& info) = nullptr;
+            void* func = nullptr;
+        };
+        Internal::ArenaLL<LayoutCallback> layout_callbacks; //Lives in arena1
+
+        struct DrawBatch
+        {
+            uintptr_t key = 0;
+            Rect bounds; //Union of its commands
+            uint32_t first = 0; //Commands linked through draw_command_next
+            uint32_t last = 0;
+            uint32_t count = 0;
+        };
+        static constexpr uint32_t MAX_BATCH_LOOKBACK = 32; //Batches a command may move back over
+        static constexpr uint32_t MAX_BATCH_OVERLAP_TESTS = 64; //Larger batches only test their bounds
+        Internal::DynamicArray<Internal::DrawCommand> draw_commands; //Recorded during Draw()
+        Internal::DynamicArray<uint32_t> draw_command_next; //Scratch for FlushDrawCommands()
+        Internal::DynamicArray<uint32_t> draw_order; //Indices into draw_commands as they are sent
+        Internal::DynamicArray<DrawBatch> draw_batches; //Scratch for FlushDrawCommands()
+        DrawStats draw_stats;
+        bool is_draw_sorting = true;
+        FrameRing* frame_ring = nullptr;
+        CaptureRecorder* capture = nullptr;
+        BoxStyle capture_root_style; //As passed to BeginRoot()
 
         #if UI_ENABLE_DEBUG
             DebugInspector* inspector = nullptr;
@@ -933,17 +1883,165 @@ namespace UI
 
 
         Internal::ArenaDoubleBufferMap<BoxInfo> double_buffer_map;
+
+        //Persistent across frames, only cleared when the context is destroyed
+        struct StyleSheet
+        {
+            BoxStyle style; //kept for the debug inspector
+            BoxCore core;
+        };
+        Internal::Map<StyleSheet> style_registry;
+
+        //Scratch buffers for the AVAILABLE_PERCENT solver, reused by every flow box
+        struct GrowItem
+        {
+            BoxCore* box = nullptr;
+            float weight = 0;
+            float min = 0;
+            float max = 0;
+            float result = 0;
+        };
+        struct GrowEvent
+        {
+            float level = 0;
+            float slope = 0;
+        };
+        Internal::DynamicArray<GrowItem> grow_items;
+        Internal::DynamicArray<GrowEvent> grow_events;
+
+        //Memoized subtrees, persistent across frames and evicted after MEMO_MAX_AGE unused frames
+        static constexpr uint64_t MEMO_MAX_AGE = 120;
+        struct LayoutBox
+        {
+            TreeNode<BoxCore>* node = nullptr;
+            int x = 0; //Relative to the origin of the memo root's children
+            int y = 0;
+        };
+        struct MemoEntry
+        {
+            uint64_t deps_hash = 0;
+            uint64_t last_frame = 0;
+            int root_width = 0;
+            int root_height = 0;
+            //The boxes as func built them, before any layout
+            Internal::MemoryArena* pristine_arena = nullptr;
+            TreeNode<BoxCore>* pristine = nullptr; //Only its children are used
+            //Children of the single memo root after layout, only valid when the root has the same size.
+            //The frame's tree only gets the root, its children are drawn straight from here
+            Internal::MemoryArena* layout_arena = nullptr;
+            TreeNode<BoxCore>* layout = nullptr;
+            LayoutBox* layout_boxes = nullptr; //Boxes with an id or a slot in pre order
+            uint32_t layout_box_count = 0;
+            uint32_t layout_element_count = 0;
+            Rect layout_bounds; //Everything the children draw, relative to the origin of the root's children
+            uint16_t layout_width = 0;
+            uint16_t layout_height = 0;
+            uint16_t layout_content_width = 0;
+            uint16_t layout_content_height = 0;
+            uint64_t layout_frame = 0;
+            bool has_detached = false; //Detached boxes are drawn from the deferred queue, the layout is never culled
+            bool is_layout_cacheable = false;
+        };
+        //Template shapes. Their layouts are MemoEntry in memo_cache that borrow the pristine boxes,
+        //keyed by the template and the width of its text slots
+        struct TemplateEntry
+        {
+            uint64_t last_frame = 0;
+            int root_width = 0;
+            int root_height = 0;
+            Internal::MemoryArena* pristine_arena = nullptr;
+            TreeNode<BoxCore>* pristine = nullptr;
+            TextStyle slot_styles[InstanceArgs::MAX_SLOTS];
+            uint8_t text_slots = 0; //One bit per text slot
+            bool is_layout_cacheable = false;
+        };
+        struct MemoFrame
+        {
+            uint64_t key = 0; //0 when the memo is bypassed
+            uint64_t deps_hash = 0;
+            TreeNode<BoxCore>* parent = nullptr;
+            ArenaLL<TreeNode<BoxCore>>::Node* prev_tail = nullptr;
+            const InstanceArgs* args = nullptr; //Only set for instances
+            uint32_t depth = 0;
+            bool is_recording = false;
+        };
+        //Memo roots in this frame's tree
+        struct MemoRoot
+        {
+            TreeNode<BoxCore>* node = nullptr;
+            uint64_t key = 0;
+            const InstanceArgs* args = nullptr;
+            bool is_layout_cached = false;
+            //Set by ResolveMemoLayout() when the cached layout is used
+            const MemoEntry* entry = nullptr;
+            BoxCore* boxes = nullptr; //Instance copies of entry->layout_boxes with the args applied, in arena2
+            uint32_t next_box = 0; //Drawing walks the layout boxes in the same order
+        };
+        struct CopyFrame
+        {
+            ArenaLL<TreeNode<BoxCore>>::Node* next = nullptr;
+            ArenaLL<TreeNode<BoxCore>>* dst = nullptr;
+        };
+        Internal::Map<MemoEntry> memo_cache;
+        Internal::Map<TemplateEntry> template_cache;
+        Internal::ArenaStack<MemoFrame> memo_stack; //Lives in arena1
+        Internal::DynamicArray<MemoRoot> memo_roots;
+        Internal::DynamicArray<CopyFrame> copy_frames;
+        Internal::DynamicArray<uint64_t> memo_evictions;
+        uint64_t frame_index = 0;
+
+        /*
+            Copied texts that repeat across frames, keyed by their content hash and
+            evicted after INTERN_MAX_AGE unused frames. A text is only kept once it
+            is seen a second time, before that it is copied into arena3 like any other
+        */
+        static constexpr uint64_t INTERN_MAX_AGE = 120;
+        static constexpr uint32_t INTERN_MAX_CANDIDATES = 4096;
+        struct InternEntry
+        {
+            char32_t* data = nullptr; //Null while it was only seen once
+            uint64_t size = 0;
+            uint64_t last_frame = 0;
+        };
+        Internal::Map<InternEntry> intern_pool;
+        uint32_t intern_candidate_count = 0;
+
         TreeNode<BoxCore>* tree_core = nullptr;
         TreeNode<BoxResult>* tree_result = nullptr;
 
         Internal::MemoryArena arena1; //Arena used for building the ui tree
         Internal::MemoryArena arena2; //Arena used for caching computed ui tree and computed text lines after measurements
-        Internal::MemoryArena arena3; //Arena used for string allocation
+        Internal::MemoryArena arena3; //Arena used for string allocation and FrameAlloc()
+        uint64_t frame_alloc_bytes = 0;
 
-        Internal::FixedStack<TreeNode<BoxCore>*, 64> stack; //elements should never nest over 100 layers deep
+        Internal::ArenaStack<TreeNode<BoxCore>*> stack; //Lives in arena1 with the tree, so nesting depth is only limited by memory
         BoxCore* prev_inserted_box = nullptr; //
         Internal::ArenaLL<DeferredBox> deferred_elements;
         uint64_t directly_hovered_element_key = 0;
+        /*
+            Parallel build. Every thread builds its chunks under a stand-in copy of the parent box in its own fragment
+            context, the calling thread uses fragments[0]. Chunks are appended to the parent in order once all are built
+        */
+        static constexpr uint32_t CHUNKS_PER_BUILD_THREAD = 4; //Evens out indices that build more boxes than others
+        struct BuildChunk
+        {
+            uint32_t begin = 0;
+            uint32_t end = 0;
+            TreeNode<BoxCore>* node = nullptr; //Stand-in parent, only its children are used
+            Internal::ArenaLL<LayoutCallback> layout_callbacks;
+        };
+        Context* owner = nullptr; //Only set for fragments
+        Context** fragments = nullptr;
+        std::thread* build_workers = nullptr;
+        uint32_t build_thread_count = 0;
+        Internal::DynamicArray<BuildChunk> build_chunks;
+        void (*build_invoke)(void* func, uint32_t index) = nullptr;
+        void* build_func = nullptr;
+        TreeNode<BoxCore>* build_parent = nullptr;
+        std::atomic<uint32_t> next_build_chunk{0};
+        std::atomic<uint32_t> finished_build_workers{0};
+        std::atomic<uint64_t> build_generation{0}; //Workers wake up when it changes
+        std::atomic<bool> is_build_stopping{false};
     };
 
     namespace Internal
@@ -1007,7 +2105,7 @@ namespace UI
 
         // ===== Stores a copy of ui tree =====
         Internal::MemoryArena arena;
-        Internal::FixedStack<TreeNodeDebug*, 64> stack;
+        Internal::ArenaStack<TreeNodeDebug*> stack;
         Context ui;
         TreeNodeDebug* root = nullptr;
         // ====================================
@@ -1024,6 +2122,124 @@ namespace UI
         //=============================
     };
 
+    namespace Internal
+    {
+        //Wrapped line starts of a text and the visible window of them, shared by TextView and TextEdit
+        struct WrappedLines
+        {
+            TextStyle style;
+            DynamicArray<uint64_t> line_starts;
+            DynamicArray<char32_t> visible_text;
+            int char_widths[256] = {};
+            int max_char_width = 0;
+            int wrap_width = 0;
+            int64_t scroll_y = 0;
+            bool follow_tail = false;
+            bool is_at_end = true;
+
+            //Returns true when the width or style changed and every line has to be wrapped again
+            bool SetLayout(int width, const TextStyle& style);
+            int GetLineHeight() const;
+            int64_t GetContentHeight() const;
+            void SetScrollY(int64_t scroll_y);
+            //Clamps the scroll, then returns the lines that are at least partly inside view_height
+            void GetVisibleLines(int view_height, uint32_t& first, uint32_t& last);
+            //A scissor box with visible_text, offset by the scroll
+            void InsertBox(Context* context, const BoxStyle& style, const StringAsci& id, DebugInfo debug_info);
+        };
+    }
+
+    /*
+        Scrollable view of a large ASCII buffer, like a log file. The buffer is not copied,
+        it has to outlive the view (a memory mapped file works).
+        Wrapped lines are indexed once and kept across frames, only the visible lines are put in the tree.
+        The index is built over several frames when the text is larger than the index budget.
+    */
+    class TextView
+    {
+    public:
+        static constexpr uint64_t DEFAULT_INDEX_BUDGET = 1 * MB;
+
+        //Drops the index
+        void SetText(const StringAsci& text);
+        //text has to start with the current text, e.g. a log file that was appended to.
+        //Only the unfinished last line is wrapped again
+        void GrowText(const StringAsci& text);
+        //Bytes wrapped per frame
+        void SetIndexBudget(uint64_t bytes);
+        //Keeps the view at the end while it is scrolled to the end
+        void SetFollowTail(bool flag);
+        void ScrollBy(int64_t pixels);
+        void SetScrollY(int64_t scroll_y);
+        int64_t GetScrollY() const;
+        //Height of the indexed lines, grows while the index is built
+        int64_t GetContentHeight() const;
+        uint32_t GetLineCount() const;
+        bool IsIndexComplete() const;
+
+        //Inserts a scissor box with the visible lines.
+        //Text is wrapped to the width the box had in the previous frame, so it needs an id
+        void Run(const BoxStyle& style, const TextStyle& text_style, const StringAsci& id, DebugInfo debug_info = UI_DEBUG("TextView"));
+    private:
+        void ResetIndex();
+        void IndexStep(uint64_t byte_budget);
+        //Exclusive, includes the line break
+        uint64_t GetLineEnd(uint32_t line);
+
+        StringAsci text;
+        Internal::WrappedLines lines;
+        uint64_t indexed_bytes = 0; //Next unwrapped byte, always the start of a line
+        uint64_t index_budget = DEFAULT_INDEX_BUDGET;
+        uint32_t tail_line = 0; //First wrapped line of the last line when it has no line break
+        bool is_tail_indexed = false;
+    };
+
+    /*
+        Editable ASCII text in a gap buffer. Wrapped lines are kept across frames and an edit only wraps
+        the lines from the one before the edit down to the first line that starts where it did before,
+        the rest of the index is shifted. Shown like TextView, only the visible lines are put in the tree.
+    */
+    class TextEdit
+    {
+    public:
+        TextEdit() = default;
+        TextEdit(const TextEdit&) = delete;
+        TextEdit& operator=(const TextEdit&) = delete;
+        ~TextEdit();
+
+        void SetText(const StringAsci& text);
+        void Insert(uint64_t offset, const StringAsci& text);
+        void Erase(uint64_t offset, uint64_t count);
+        uint64_t Size() const;
+        char At(uint64_t offset) const;
+
+        void ScrollBy(int64_t pixels);
+        void SetScrollY(int64_t scroll_y);
+        int64_t GetScrollY() const;
+        int64_t GetContentHeight() const;
+        uint32_t GetLineCount() const;
+        //Wrapped line that contains offset, and the first offset of a wrapped line. Only valid after Run()
+        uint32_t GetLineAt(uint64_t offset);
+        uint64_t GetLineStart(uint32_t line);
+
+        //Same as TextView::Run()
+        void Run(const BoxStyle& style, const TextStyle& text_style, const StringAsci& id, DebugInfo debug_info = UI_DEBUG("TextEdit"));
+    private:
+        void MoveGap(uint64_t offset);
+        void ReserveGap(uint64_t bytes);
+        void WrapAll();
+        //Called after the buffer changed, offsets in the index are still the old ones
+        void Rewrap(uint64_t offset, uint64_t removed, uint64_t inserted);
+
+        char* data = nullptr;
+        uint64_t capacity = 0;
+        uint64_t gap_start = 0;
+        uint64_t gap_end = 0;
+        Internal::WrappedLines lines;
+        Internal::DynamicArray<uint64_t> rewrapped; //Scratch for Rewrap()
+        bool is_wrapped = false; //Index matches the text, false until the first Run() knows the width
+    };
+
 
     //Builder Notation
     class Builder
@@ -1034,11 +2250,15 @@ namespace UI
 
         //Also Implemented as global functions
         Builder& Box(const BoxStyle& style = BoxStyle(), const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
+        Builder& Box(StyleHandle handle, const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
+        Builder& Box(const CompiledStyle& style, const StringAsci& id = StringAsci(), DebugInfo debug_info = UI_DEBUG("Box"));
         void Text(const TextStyle& style, const StringU32& string, bool copy_text = true, DebugInfo debug_info = UI_DEBUG("Text"));
         void LineBreak();
         BoxInfo Info() const;
         BoxInfo Info(const StringAsci& id) const;
         BoxStyle& Style();
+        //Only applies when the box was created with a StyleHandle or CompiledStyle
+        StyleOverride& Override();
         BoxState& State();
         void NewLine();
         void SetState(const StringAsci& id, const BoxState& state);
@@ -1048,10 +2268,15 @@ namespace UI
         //Parmeters
         Builder& Style(const BoxStyle& style);
         Builder& Id(const StringAsci& id);
+        //Marks the box as a template slot, see UI::Instance()
+        Builder& Slot(uint8_t index);
         template<typename Func>
         Builder& OnHover(Func&& func);
         template<typename Func>
         Builder& OnDirectHover(Func&& func);
+        //Needs an id, see Context::OnLayout()
+        template<typename Func>
+        Builder& OnLayout(Func&& func);
         template<typename Func>
         Builder& PreRun(Func&& func);
 
@@ -1072,7 +2297,11 @@ namespace UI
         BoxInfo info;
         BoxState state;
         BoxStyle style;
+        StyleHandle style_handle;
+        const CompiledStyle* compiled_style = nullptr;
+        StyleOverride style_override;
         DebugInfo debug_info;
+        uint8_t slot = 0; //Index + 1
         bool copy_text = true;
     };
 
@@ -1122,10 +2351,106 @@ namespace UI
     {
         return line_spacing;
     }
-    // inline bool TextStyle::operator==(const TextStyle& t) const
-    // {
-    //     return std::memcmp(this, &t, sizeof(TextStyle)) == 0;
-    // }
+    inline StyleOverride& StyleOverride::Width(Unit width)
+    {
+        this->width = width;
+        flags |= WIDTH;
+        return *this;
+    }
+    inline StyleOverride& StyleOverride::Height(Unit height)
+    {
+        this->height = height;
+        flags |= HEIGHT;
+        return *this;
+    }
+    inline StyleOverride& StyleOverride::BgColor(const Color& color)
+    {
+        this->color = color;
+        flags |= COLOR;
+        return *this;
+    }
+    inline StyleOverride& StyleOverride::BorderColor(const Color& color)
+    {
+        this->border_color = color;
+        flags |= BORDER_COLOR;
+        return *this;
+    }
+    inline StyleOverride& StyleOverride::Scroll(int x, int y)
+    {
+        scroll_x = x;
+        scroll_y = y;
+        flags |= SCROLL;
+        return *this;
+    }
+    inline bool InputSnapshot::IsKeyPressed(Key key) const
+    {
+        return key < KEY_COUNT && (keys_pressed[key / 64] >> (key % 64) & 1);
+    }
+    inline bool InputSnapshot::IsKeyReleased(Key key) const
+    {
+        return key < KEY_COUNT && (keys_released[key / 64] >> (key % 64) & 1);
+    }
+    inline bool InputSnapshot::IsKeyDown(Key key) const
+    {
+        return key < KEY_COUNT && (keys_down[key / 64] >> (key % 64) & 1);
+    }
+    inline bool InputSnapshot::IsKeyRepeat(Key key) const
+    {
+        return key < KEY_COUNT && (keys_repeat[key / 64] >> (key % 64) & 1);
+    }
+    inline bool InputSnapshot::IsMousePressed(MouseButton button) const
+    {
+        return mouse_pressed >> button & 1;
+    }
+    inline bool InputSnapshot::IsMouseReleased(MouseButton button) const
+    {
+        return mouse_released >> button & 1;
+    }
+    inline bool InputSnapshot::IsMouseDown(MouseButton button) const
+    {
+        return mouse_down >> button & 1;
+    }
+    inline void InputSnapshot::SetKey(uint64_t (&keys)[(KEY_COUNT + 63) / 64], Key key, bool flag)
+    {
+        assert(key < KEY_COUNT);
+        if(flag)
+            keys[key / 64] |= 1ull << (key % 64);
+        else
+            keys[key / 64] &= ~(1ull << (key % 64));
+    }
+    inline InstanceArgs& InstanceArgs::Text(uint8_t slot, const StringU32& text)
+    {
+        assert(slot < MAX_SLOTS);
+        if(text.IsEmpty())
+            return *this;
+        texts[slot] = text;
+        text_flags |= 1 << slot;
+        return *this;
+    }
+    inline InstanceArgs& InstanceArgs::BgColor(uint8_t slot, const Color& color)
+    {
+        assert(slot < MAX_SLOTS);
+        colors[slot] = color;
+        color_flags |= 1 << slot;
+        return *this;
+    }
+    inline InstanceArgs& InstanceArgs::Id(uint8_t slot, const StringAsci& id)
+    {
+        assert(slot < MAX_SLOTS);
+        if(id.IsEmpty())
+            return *this;
+        id_keys[slot] = Hash(id);
+        id_flags |= 1 << slot;
+        return *this;
+    }
+    inline bool StyleOverride::Has(Flags flag) const
+    {
+        return flags & flag;
+    }
+    inline bool TextStyle::operator==(const TextStyle& t) const
+    {
+        return std::memcmp(this, &t, sizeof(TextStyle)) == 0;
+    }
 
     template<typename Func>
     inline void Root(Context* context, const BoxStyle& style, Func&& func, DebugInfo debug_info)
@@ -1134,6 +2459,85 @@ namespace UI
         func();
         UI::EndRoot();
     }
+    template<typename Func>
+    inline void Memo(const StringAsci& id, uint64_t deps_hash, Func&& func)
+    {
+        if(!IsContextActive())
+            return;
+        Context* context = GetContext();
+        if(context->BeginMemo(id, deps_hash))
+            func();
+        context->EndMemo();
+    }
+    template<typename Func>
+    inline void Instance(const StringAsci& template_id, const InstanceArgs& args, Func&& shape)
+    {
+        if(!IsContextActive())
+            return;
+        Context* context = GetContext();
+        if(context->BeginInstance(template_id, args))
+            shape();
+        context->EndInstance();
+    }
+    template<typename Func>
+    inline void OnLayout(const StringAsci& id, Func&& func)
+    {
+        if(IsContextActive())
+            GetContext()->OnLayout(id, std::forward<Func>(func));
+    }
+    template<typename T>
+    inline T* FrameAlloc(uint64_t count)
+    {
+        if(!IsContextActive())
+            return nullptr;
+        return GetContext()->FrameAlloc<T>(count);
+    }
+    template<typename T>
+    T* Context::FrameAlloc(uint64_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "Frame memory is never destructed");
+        assert(count && "0 count");
+        assert(count <= UINT64_MAX / sizeof(T) && "FrameAlloc size overflow");
+        if(count > UINT64_MAX / sizeof(T))
+            return nullptr;
+        T* data = (T*)FrameAllocate(count * sizeof(T), alignof(T));
+        if(!data)
+            return nullptr;
+        for(uint64_t i = 0; i < count; i++)
+            new(data + i) T();
+        return data;
+    }
+    template<typename Func>
+    inline void ParallelFor(uint32_t count, Func&& func)
+    {
+        if(IsContextActive())
+            GetContext()->ParallelFor(count, std::forward<Func>(func));
+    }
+    template<typename Func>
+    void Context::ParallelFor(uint32_t count, Func&& func)
+    {
+        using Callable = std::remove_reference_t<Func>;
+        auto invoke = [](void* func, uint32_t index) { (*(Callable*)func)(index); };
+        ParallelFor_impl(count, invoke, (void*)&func);
+    }
+    template<typename Func>
+    void Context::OnLayout(const StringAsci& id, Func&& func)
+    {
+        using Callable = std::decay_t<Func>;
+        static_assert(std::is_trivially_destructible_v<Callable>, "OnLayout() callbacks are never destroyed");
+        assert(!id.IsEmpty() && "OnLayout() needs an id");
+        if(id.IsEmpty())
+            return;
+
+        void* memory = arena1.Allocate(sizeof(Callable), alignof(Callable));
+        assert(memory && "Arena out of memory");
+        LayoutCallback callback;
+        callback.key = Hash(id);
+        callback.invoke = [](void* func, const BoxInfo& info) { (*(Callable*)func)(info); };
+        callback.func = new(memory) Callable(std::forward<Func>(func));
+        LayoutCallback* added = layout_callbacks.Add(callback, &arena1);
+        assert(added && "Arena out of memory");
+    }
 
 
     //Builder Implementation
@@ -1150,6 +2554,32 @@ namespace UI
         }
         return *this;
     }
+    inline Builder& Builder::Box(StyleHandle handle, const StringAsci& id, DebugInfo debug_info)
+    {
+        ClearStates();
+        if(HasContext())
+        {
+            this->style_handle = handle;
+            this->debug_info = debug_info;
+            this->id = id;
+            info = context->Info(id);
+            state = info.state;
+        }
+        return *this;
+    }
+    inline Builder& Builder::Box(const CompiledStyle& style, const StringAsci& id, DebugInfo debug_info)
+    {
+        ClearStates();
+        if(HasContext())
+        {
+            this->compiled_style = &style;
+            this->debug_info = debug_info;
+            this->id = id;
+            info = context->Info(id);
+            state = info.state;
+        }
+        return *this;
+    }
     inline void Builder::Text(const TextStyle& style, const StringU32& string, bool copy_text, DebugInfo debug_info)
     {
         ClearStates();
@@ -1178,7 +2608,11 @@ namespace UI
         id = StringAsci{};
         info = BoxInfo();
         style = BoxStyle();
+        style_handle = StyleHandle();
+        compiled_style = nullptr;
+        style_override = StyleOverride();
         debug_info = DebugInfo();
+        slot = 0;
         copy_text = true;
     }
     inline BoxInfo Builder::Info() const
@@ -1203,6 +2637,10 @@ namespace UI
     {
         return style;
     }
+    inline StyleOverride& Builder::Override()
+    {
+        return style_override;
+    }
     inline BoxState& Builder::State()
     {
         return state;
@@ -1231,6 +2669,12 @@ namespace UI
         this->style = style;
         return *this;
     }
+    inline Builder& Builder::Slot(uint8_t index)
+    {
+        assert(index < InstanceArgs::MAX_SLOTS);
+        this->slot = index + 1;
+        return *this;
+    }
     template<typename Func>
     Builder& Builder::OnHover(Func&& func)
     {
@@ -1250,6 +2694,13 @@ namespace UI
         return *this;
     }
     template<typename Func>
+    Builder& Builder::OnLayout(Func&& func)
+    {
+        if(HasContext())
+            context->OnLayout(id, std::forward<Func>(func));
+        return *this;
+    }
+    template<typename Func>
     Builder& Builder::PreRun(Func&& func)
     {
         func();
@@ -1260,7 +2711,14 @@ namespace UI
         if(HasContext())
         {
             context->SetStates(info.GetKey(), state);
-            context->BeginBox(style, id, debug_info);
+            if(compiled_style)
+                context->BeginBox(*compiled_style, style_override, id, debug_info);
+            else if(style_handle.IsValid())
+                context->BeginBox(style_handle, style_override, id, debug_info);
+            else
+                context->BeginBox(style, id, debug_info);
+            if(slot)
+                context->SetSlot(slot - 1);
             context->EndBox();
         }
     }
@@ -1270,7 +2728,14 @@ namespace UI
         if(HasContext())
         {
             context->SetStates(info.GetKey(), state);
-            context->BeginBox(style, id, debug_info);
+            if(compiled_style)
+                context->BeginBox(*compiled_style, style_override, id, debug_info);
+            else if(style_handle.IsValid())
+                context->BeginBox(style_handle, style_override, id, debug_info);
+            else
+                context->BeginBox(style, id, debug_info);
+            if(slot)
+                context->SetSlot(slot - 1);
             func();
             context->EndBox();
         }
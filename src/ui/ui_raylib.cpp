@@ -1,6 +1,14 @@
 #include <raylib/raylib.h>
 #include <raylib/rlgl.h>
 #include "ui.hpp"
+#if defined(_WIN32)
+    //Falls back to reading the whole file
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 //Raylib backend
 
 namespace UI
@@ -8,15 +16,289 @@ namespace UI
     //std::unordered_map<std::string, Font> fonts;
     Font font;
     GlyphInfo font_info[128]{};
-    void Init_impl(const char* font_path)
+
+    /*
+        Glyphs are drawn from a GlyphAtlas rasterized at the size bucket of the text instead of scaling
+        the baked atlas, the baked font only gives the ascii advances used by the layout.
+        The ttf stays loaded for it
+    */
+    constexpr int GLYPH_PAGE_SIZE = 1024;
+    constexpr uint16_t GLYPH_MAX_PAGES = 4;
+    unsigned char* ttf_data = nullptr;
+    int ttf_size = 0;
+    GlyphAtlas glyph_atlas;
+    Texture2D glyph_pages[GLYPH_MAX_PAGES]{};
+    Internal::DynamicArray<unsigned char> glyph_pixels; //The last rasterized glyph
+    Internal::DynamicArray<unsigned char> page_pixels; //Scratch for the uploads
+    /*
+        Advances of the glyphs outside the baked font for MeasureChar_impl(), at the size buckets of the atlas.
+        Measuring never touches the atlas, so layout can run on another thread than drawing (see FrameRing)
+    */
+    Internal::Map<int> glyph_advances;
+
+    bool RasterizeGlyph(void* user_data, char32_t codepoint, int pixel_size, GlyphAtlas::Bitmap& bitmap)
+    {
+        int value = (int)codepoint;
+        GlyphInfo* info = LoadFontData(ttf_data, ttf_size, pixel_size, &value, 1, FONT_DEFAULT);
+        if(!info)
+            return false;
+        bitmap.offset_x = info->offsetX;
+        bitmap.offset_y = info->offsetY;
+        bitmap.advance = info->advanceX;
+        //Spaces come back as a blank image, they are never drawn
+        if(codepoint != U' ' && info->image.data && info->image.format == PIXELFORMAT_UNCOMPRESSED_GRAYSCALE)
+        {
+            bitmap.width = info->image.width;
+            bitmap.height = info->image.height;
+            glyph_pixels.Resize(bitmap.width * bitmap.height);
+            std::memcpy(glyph_pixels.Data(), info->image.data, bitmap.width * bitmap.height);
+            bitmap.pixels = glyph_pixels.Data();
+        }
+        UnloadFontData(info, 1);
+        return true;
+    }
+    void ClearGlyphPage(void* user_data, uint16_t page)
+    {
+        if(!glyph_pages[page].id)
+            return;
+        //Text already batched from this page has to be drawn before its pixels change
+        rlDrawRenderBatchActive();
+        page_pixels.Resize(GLYPH_PAGE_SIZE * GLYPH_PAGE_SIZE * 2);
+        std::memset(page_pixels.Data(), 0, page_pixels.Size());
+        UpdateTexture(glyph_pages[page], page_pixels.Data());
+    }
+    void UploadGlyph(void* user_data, uint16_t page, int x, int y, const GlyphAtlas::Bitmap& bitmap)
+    {
+        if(!glyph_pages[page].id)
+        {
+            Image blank = {};
+            blank.data = RL_CALLOC(GLYPH_PAGE_SIZE * GLYPH_PAGE_SIZE, 2);
+            blank.width = GLYPH_PAGE_SIZE;
+            blank.height = GLYPH_PAGE_SIZE;
+            blank.mipmaps = 1;
+            blank.format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA;
+            glyph_pages[page] = LoadTextureFromImage(blank);
+            UnloadImage(blank);
+            SetTextureFilter(glyph_pages[page], TEXTURE_FILTER_BILINEAR);
+        }
+        //White with the coverage as alpha, like the baked atlas
+        page_pixels.Resize(bitmap.width * bitmap.height * 2);
+        for(int i = 0; i < bitmap.width * bitmap.height; i++)
+        {
+            page_pixels[i * 2] = 255;
+            page_pixels[i * 2 + 1] = bitmap.pixels[i];
+        }
+        UpdateTextureRec(glyph_pages[page], {(float)x, (float)y, (float)bitmap.width, (float)bitmap.height}, page_pixels.Data());
+    }
+    GlyphAtlas::Stats GetGlyphAtlasStats()
+    {
+        return glyph_atlas.GetStats();
+    }
+    void DrawGlyph(char32_t c, float x, float y, int font_size, Color color)
+    {
+        //Ascii comes from the baked atlas, only the codepoints it lacks are rasterized on demand
+        if(c < 128 || !ttf_data)
+        {
+            DrawTextCodepoint(font, c, {x, y}, (float)font_size, {color.r, color.g, color.b, color.a});
+            return;
+        }
+        const GlyphAtlas::Glyph* glyph = glyph_atlas.GetGlyph(c, font_size);
+        if(!glyph || glyph->page == GlyphAtlas::NO_PAGE)
+            return;
+        float scale = (float)font_size / glyph->size;
+        Rectangle src = {(float)glyph->x, (float)glyph->y, (float)glyph->width, (float)glyph->height};
+        Rectangle dest = {x + glyph->offset_x * scale, y + glyph->offset_y * scale, glyph->width * scale, glyph->height * scale};
+        DrawTexturePro(glyph_pages[glyph->page], src, dest, {0, 0}, 0, {color.r, color.g, color.b, color.a});
+    }
+
+    /*
+        Font atlas cache file. Baking the atlas parses the ttf and rasterizes every glyph,
+        the cache stores the result so the next launch only uploads the atlas.
+        Layout: FontCacheHeader, FontCacheGlyph[glyph_count], atlas pixels
+    */
+    constexpr int FONT_BASE_SIZE = 48;
+    constexpr uint32_t FONT_CACHE_VERSION = 1;
+    struct FontCacheHeader
+    {
+        char magic[4] = {'U', 'I', 'F', 'C'};
+        uint32_t version = FONT_CACHE_VERSION;
+        uint64_t font_hash = 0; //Of the ttf bytes and the base size
+        int32_t base_size = 0;
+        int32_t glyph_count = 0;
+        int32_t glyph_padding = 0;
+        int32_t atlas_width = 0;
+        int32_t atlas_height = 0;
+        int32_t atlas_format = 0;
+        uint64_t atlas_bytes = 0;
+    };
+    struct FontCacheGlyph
+    {
+        Rectangle rec;
+        int32_t value = 0;
+        int32_t offset_x = 0;
+        int32_t offset_y = 0;
+        int32_t advance_x = 0;
+    };
+
+    struct MappedFile
+    {
+        const unsigned char* data = nullptr;
+        uint64_t size = 0;
+    };
+    MappedFile MapFile(const char* path)
+    {
+        MappedFile file;
+        #if defined(_WIN32)
+            int size = 0;
+            file.data = LoadFileData(path, &size);
+            file.size = file.data? (uint64_t)size: 0;
+        #else
+            int fd = open(path, O_RDONLY);
+            if(fd < 0)
+                return file;
+            struct stat info;
+            if(fstat(fd, &info) == 0 && info.st_size > 0)
+            {
+                void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(data != MAP_FAILED)
+                {
+                    file.data = (const unsigned char*)data;
+                    file.size = (uint64_t)info.st_size;
+                }
+            }
+            close(fd);
+        #endif
+        return file;
+    }
+    void UnmapFile(MappedFile& file)
+    {
+        if(!file.data)
+            return;
+        #if defined(_WIN32)
+            UnloadFileData((unsigned char*)file.data);
+        #else
+            munmap((void*)file.data, (size_t)file.size);
+        #endif
+        file = MappedFile();
+    }
+
+    //Returns false when the cache is missing, from another version or from another font
+    bool LoadFontCache(const char* path, uint64_t font_hash)
+    {
+        MappedFile file = MapFile(path);
+        if(!file.data)
+            return false;
+        FontCacheHeader header;
+        bool is_valid = file.size >= sizeof(FontCacheHeader);
+        if(is_valid)
+        {
+            std::memcpy(&header, file.data, sizeof(FontCacheHeader));
+            is_valid = std::memcmp(header.magic, FontCacheHeader().magic, sizeof(header.magic)) == 0
+                && header.version == FONT_CACHE_VERSION
+                && header.font_hash == font_hash
+                && header.glyph_count > 0
+                && header.atlas_bytes == (uint64_t)GetPixelDataSize(header.atlas_width, header.atlas_height, header.atlas_format)
+                && file.size == sizeof(FontCacheHeader) + header.glyph_count * sizeof(FontCacheGlyph) + header.atlas_bytes;
+        }
+        if(!is_valid)
+        {
+            UnmapFile(file);
+            return false;
+        }
+
+        Font cached = {};
+        cached.baseSize = header.base_size;
+        cached.glyphCount = header.glyph_count;
+        cached.glyphPadding = header.glyph_padding;
+        cached.recs = (Rectangle*)RL_MALLOC(header.glyph_count * sizeof(Rectangle));
+        cached.glyphs = (GlyphInfo*)RL_CALLOC(header.glyph_count, sizeof(GlyphInfo));
+        const unsigned char* glyphs = file.data + sizeof(FontCacheHeader);
+        for(int i = 0; i < header.glyph_count; i++)
+        {
+            FontCacheGlyph glyph;
+            std::memcpy(&glyph, glyphs + i * sizeof(FontCacheGlyph), sizeof(FontCacheGlyph));
+            cached.recs[i] = glyph.rec;
+            cached.glyphs[i].value = glyph.value;
+            cached.glyphs[i].offsetX = glyph.offset_x;
+            cached.glyphs[i].offsetY = glyph.offset_y;
+            cached.glyphs[i].advanceX = glyph.advance_x;
+        }
+        //The atlas is uploaded straight from the mapped file
+        Image atlas = {};
+        atlas.data = (void*)(glyphs + header.glyph_count * sizeof(FontCacheGlyph));
+        atlas.width = header.atlas_width;
+        atlas.height = header.atlas_height;
+        atlas.mipmaps = 1;
+        atlas.format = header.atlas_format;
+        cached.texture = LoadTextureFromImage(atlas);
+        UnmapFile(file);
+
+        font = cached;
+        return true;
+    }
+    void SaveFontCache(const char* path, uint64_t font_hash)
     {
-        font = LoadFontEx(font_path, 48, 0, 0);
+        //Only the gpu keeps the baked atlas
+        Image atlas = LoadImageFromTexture(font.texture);
+        if(!atlas.data)
+            return;
+        FontCacheHeader header;
+        header.font_hash = font_hash;
+        header.base_size = font.baseSize;
+        header.glyph_count = font.glyphCount;
+        header.glyph_padding = font.glyphPadding;
+        header.atlas_width = atlas.width;
+        header.atlas_height = atlas.height;
+        header.atlas_format = atlas.format;
+        header.atlas_bytes = (uint64_t)GetPixelDataSize(atlas.width, atlas.height, atlas.format);
+
+        uint64_t size = sizeof(FontCacheHeader) + font.glyphCount * sizeof(FontCacheGlyph) + header.atlas_bytes;
+        unsigned char* data = (unsigned char*)RL_MALLOC(size);
+        unsigned char* write = data;
+        std::memcpy(write, &header, sizeof(FontCacheHeader));
+        write += sizeof(FontCacheHeader);
+        for(int i = 0; i < font.glyphCount; i++)
+        {
+            FontCacheGlyph glyph;
+            glyph.rec = font.recs[i];
+            glyph.value = font.glyphs[i].value;
+            glyph.offset_x = font.glyphs[i].offsetX;
+            glyph.offset_y = font.glyphs[i].offsetY;
+            glyph.advance_x = font.glyphs[i].advanceX;
+            std::memcpy(write, &glyph, sizeof(FontCacheGlyph));
+            write += sizeof(FontCacheGlyph);
+        }
+        std::memcpy(write, atlas.data, header.atlas_bytes);
+        //A failed write is only a slower next launch
+        SaveFileData(path, data, (int)size);
+        RL_FREE(data);
+        UnloadImage(atlas);
+    }
+
+    void Init_impl(const char* font_path, const char* atlas_cache_path)
+    {
+        //The ttf is still read to validate the cache, hashing it is much cheaper than baking it
+        unsigned char* ttf = LoadFileData(font_path, &ttf_size);
+        if(!ttf)
+            return;
+        uint64_t font_hash = Internal::HashCombine(Internal::HashBytes(ttf, (uint64_t)ttf_size), FONT_BASE_SIZE);
+        if(!atlas_cache_path || !LoadFontCache(atlas_cache_path, font_hash))
+        {
+            font = LoadFontFromMemory(GetFileExtension(font_path), ttf, ttf_size, FONT_BASE_SIZE, 0, 0);
+            if(atlas_cache_path && IsFontValid(font))
+                SaveFontCache(atlas_cache_path, font_hash);
+        }
         if(IsFontValid(font))
         {
             for(int i = 32; i<=126; i++) //Printable asci characters
                 font_info[i] = GetGlyphInfo(font, i);
             SetTextureFilter(font.texture, TEXTURE_FILTER_BILINEAR);
+            ttf_data = ttf;
+            glyph_advances.Clear();
+            glyph_atlas.Init(GLYPH_PAGE_SIZE, GLYPH_PAGE_SIZE, GLYPH_MAX_PAGES, RasterizeGlyph, ClearGlyphPage, UploadGlyph, nullptr);
         }
+        else
+            UnloadFileData(ttf);
     }
     ::MouseButton TraslateMouseButtonToRaylib_impl(MouseButton button)
     {
@@ -201,6 +483,122 @@ namespace UI
             DrawRectangle(x + near_offset, y + height - border_size, width - far_offset, border_size, {brdr.r, brdr.g, brdr.b, brdr.a}); //bottom
         }
     }
+    /*
+        Images loaded with LoadImage_impl() share atlas pages. The first page also holds a white block that
+        raylib uses for shapes, so rectangles and the images on that page do not break the batch
+    */
+    constexpr int IMAGE_PAGE_SIZE = 2048;
+    constexpr int IMAGE_MAX_PACKED_SIZE = 256;
+    ImageAtlas image_atlas;
+    bool is_image_atlas_ready = false;
+
+    void* CreateImagePage(void* user_data, int width, int height)
+    {
+        Image blank = GenImageColor(width, height, ::Color{0, 0, 0, 0});
+        Texture2D* texture = new Texture2D(LoadTextureFromImage(blank));
+        UnloadImage(blank);
+        if(!texture->id)
+        {
+            delete texture;
+            return nullptr;
+        }
+        SetTextureFilter(*texture, TEXTURE_FILTER_BILINEAR);
+        return texture;
+    }
+    void DestroyImagePage(void* user_data, void* page)
+    {
+        Texture2D* texture = (Texture2D*)page;
+        if(GetShapesTexture().id == texture->id) //Back to the default white pixel of raylib
+            SetShapesTexture({rlGetTextureIdDefault(), 1, 1, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8}, {0, 0, 1, 1});
+        //The atlas can outlive the window at exit, closing it already freed the textures
+        if(IsWindowReady())
+            UnloadTexture(*texture);
+        delete texture;
+    }
+    void UploadImage(void* user_data, void* page, int x, int y, const ImageAtlas::Pixels& pixels)
+    {
+        UpdateTextureRec(*(Texture2D*)page, {(float)x, (float)y, (float)pixels.width, (float)pixels.height}, pixels.rgba);
+    }
+    void InitImageAtlas()
+    {
+        if(is_image_atlas_ready)
+            return;
+        image_atlas.Init(IMAGE_PAGE_SIZE, IMAGE_PAGE_SIZE, IMAGE_MAX_PACKED_SIZE, CreateImagePage, DestroyImagePage, UploadImage, nullptr);
+        //Shapes sample the center of a 3x3 white block so filtering never reaches its neighbours
+        unsigned char white[3 * 3 * 4];
+        std::memset(white, 255, sizeof(white));
+        TextureRect block = image_atlas.Add({white, 3, 3});
+        if(block.HasTexture())
+            SetShapesTexture(*(Texture2D*)block.texture, {(float)block.x + 1, (float)block.y + 1, 1, 1});
+        is_image_atlas_ready = true;
+    }
+    //Packs the pixels into the atlas or gives them their own texture when they are too large to share a page
+    TextureRect UploadImagePixels(const ImageAtlas::Pixels& pixels)
+    {
+        InitImageAtlas();
+        TextureRect rect = image_atlas.Add(pixels);
+        if(rect.HasTexture())
+            return rect;
+        Image image = {(void*)pixels.rgba, pixels.width, pixels.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+        Texture2D* texture = new Texture2D(LoadTextureFromImage(image));
+        if(!texture->id)
+        {
+            delete texture;
+            return TextureRect();
+        }
+        SetTextureFilter(*texture, TEXTURE_FILTER_BILINEAR);
+        return {texture, 0, 0, (uint16_t)pixels.width, (uint16_t)pixels.height};
+    }
+    TextureRect LoadImage_impl(const char* path)
+    {
+        Image image = LoadImage(path);
+        if(!image.data)
+            return TextureRect();
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        TextureRect rect = UploadImagePixels({(const unsigned char*)image.data, image.width, image.height});
+        UnloadImage(image);
+        return rect;
+    }
+    void UnloadImage_impl(const TextureRect& texture)
+    {
+        if(!texture.HasTexture() || image_atlas.IsPage(texture.texture))
+            return;
+        Texture2D* standalone = (Texture2D*)texture.texture;
+        UnloadTexture(*standalone);
+        delete standalone;
+    }
+    void UnloadImages_impl()
+    {
+        image_atlas.Clear();
+        is_image_atlas_ready = false;
+    }
+
+    //Runs on the loader threads, LoadImage() and ImageFormat() only decode with stb and never touch the GPU
+    bool DecodeImageAsync(void* user_data, const char* path, ImageLoader::Decoded& decoded)
+    {
+        Image image = LoadImage(path);
+        if(!image.data)
+            return false;
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        decoded.rgba = (unsigned char*)image.data;
+        decoded.width = image.width;
+        decoded.height = image.height;
+        return true;
+    }
+    TextureRect UploadImageAsync(void* user_data, const ImageLoader::Decoded& decoded)
+    {
+        return UploadImagePixels({decoded.rgba, decoded.width, decoded.height});
+    }
+    void FreeImageAsync(void* user_data, ImageLoader::Decoded& decoded)
+    {
+        MemFree(decoded.rgba);
+        decoded.rgba = nullptr;
+    }
+    void InitImageLoader_impl(ImageLoader& loader, uint32_t worker_count)
+    {
+        loader.Init(worker_count, DecodeImageAsync, UploadImageAsync, FreeImageAsync, nullptr);
+    }
+
     void DrawTexturedRectangle_impl(int x, int y, int width, int height, const TextureRect& texture)
     {
         Rectangle src = { (float)texture.x, (float)texture.y, (float)texture.width, (float)texture.height};
@@ -221,7 +619,15 @@ namespace UI
         for(int i = 0; i< size; i++)
         {
             char32_t c = text[i];
-            int width = MeasureChar_impl(c, style.GetFontSize(), style.GetFontSpacing());
+            int width = 0;
+            if(c >= 128 && ttf_data)
+            {
+                //Same advance as MeasureChar_impl(), read from the atlas that only the drawing thread uses
+                const GlyphAtlas::Glyph* glyph = glyph_atlas.GetGlyph(c, style.GetFontSize());
+                width = (glyph? glyph->advance * style.GetFontSize() / glyph->size: 0) + style.GetFontSpacing();
+            }
+            else
+                width = MeasureChar_impl(c, style.GetFontSize(), style.GetFontSpacing());
             if(c == '\n')
             {
                 cursor_x = 0;
@@ -235,8 +641,7 @@ namespace UI
             }
             int render_x = x + cursor_x;
             int render_y = y + cursor_y;
-            Color color = style.GetFgColor();
-            DrawTextCodepoint(font, c, {(float)render_x, (float)render_y}, (float)style.GetFontSize(), {color.r, color.g, color.b, color.a});
+            DrawGlyph(c, (float)render_x, (float)render_y, style.GetFontSize(), style.GetFgColor());
             cursor_x += width + style.GetFontSpacing();
         }
     }
@@ -262,7 +667,7 @@ namespace UI
             }
             int render_x = p.x + p.cursor_x;
             int render_y = p.y + p.cursor_y;
-            DrawTextCodepoint(font, c, {(float)render_x, (float)render_y}, p.font_size, {color.r, color.g, color.b, color.a});
+            DrawGlyph((char32_t)c, (float)render_x, (float)render_y, p.font_size, color);
             p.cursor_x += width + p.font_spacing;
         }
     }
@@ -272,6 +677,22 @@ namespace UI
         {
             if(c >= 32 && c < 128)
                 return (int)font_info[(int)c].advanceX * font_size / font.baseSize + spacing;
+            else if(c >= 128 && ttf_data)
+            {
+                //The baked font only has ascii
+                int size = GlyphAtlas::GetSizeBucket(font_size);
+                uint64_t key = ((uint64_t)c << 8) | (uint64_t)size;
+                int* advance = glyph_advances.GetValue(key);
+                if(!advance)
+                {
+                    int value = (int)c;
+                    GlyphInfo* info = LoadFontData(ttf_data, ttf_size, size, &value, 1, FONT_DEFAULT);
+                    advance = glyph_advances.Insert(key, info? Max(0, info->advanceX): 0);
+                    if(info)
+                        UnloadFontData(info, 1);
+                }
+                return *advance * font_size / size + spacing;
+            }
             else if(c >= 128)
             {
                 GlyphInfo info = GetGlyphInfo(font, (int)c);